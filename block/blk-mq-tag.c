@@ -248,6 +248,13 @@ static int bt_get(struct blk_mq_alloc_data *data,
 	if (!(data->gfp & __GFP_WAIT))
 		return -1;
 
+	/*
+	 * Count ourselves as a waiter before the last __bt_get() attempt,
+	 * bt_clear_tag() skips the wake path entirely when there are none.
+	 */
+	atomic_inc(&bt->nr_waiters);
+	smp_mb__after_atomic();
+
 	bs = bt_wait_ptr(bt, hctx);
 	do {
 		prepare_to_wait(&bs->wait, &wait, TASK_UNINTERRUPTIBLE);
@@ -263,6 +270,7 @@ static int bt_get(struct blk_mq_alloc_data *data,
 		data->ctx = blk_mq_get_ctx(data->q);
 		data->hctx = data->q->mq_ops->map_queue(data->q,
 				data->ctx->cpu);
+		atomic_dec(&bt->nr_waiters);
 		if (data->reserved) {
 			bt = &data->hctx->tags->breserved_tags;
 		} else {
@@ -270,11 +278,14 @@ static int bt_get(struct blk_mq_alloc_data *data,
 			hctx = data->hctx;
 			bt = &hctx->tags->bitmap_tags;
 		}
+		atomic_inc(&bt->nr_waiters);
+		smp_mb__after_atomic();
 		finish_wait(&bs->wait, &wait);
 		bs = bt_wait_ptr(bt, hctx);
 	} while (1);
 
 	finish_wait(&bs->wait, &wait);
+	atomic_dec(&bt->nr_waiters);
 	return tag;
 }
 
@@ -347,6 +358,14 @@ static void bt_clear_tag(struct blk_mq_bitmap_tags *bt, unsigned int tag)
 	/* Ensure that the wait list checks occur after clear_bit(). */
 	smp_mb();
 
+	/*
+	 * Nobody is sleeping on this map, which is the common case until
+	 * it runs dry. Don't pull in the BT_WAIT_QUEUES wait state
+	 * cachelines just to find that out.
+	 */
+	if (!atomic_read(&bt->nr_waiters))
+		return;
+
 	bs = bt_wake_ptr(bt);
 	if (!bs)
 		return;
@@ -505,6 +524,7 @@ static int bt_alloc(struct blk_mq_bitmap_tags *bt, unsigned int depth,
 	}
 
 	bt_update_count(bt, depth);
+	atomic_set(&bt->nr_waiters, 0);
 
 	for (i = 0; i < BT_WAIT_QUEUES; i++) {
 		init_waitqueue_head(&bt->bs[i].wait);
@@ -604,6 +624,8 @@ ssize_t blk_mq_tag_sysfs_show(struct blk_mq_tags *tags, char *page)
 
 	page += sprintf(page, "nr_free=%u, nr_reserved=%u\n", free, res);
 	page += sprintf(page, "active_queues=%u\n", atomic_read(&tags->active_queues));
+	page += sprintf(page, "nr_waiters=%u\n",
+			atomic_read(&tags->bitmap_tags.nr_waiters));
 
 	return page - orig_page;
 }
@@ -25,6 +25,7 @@ struct blk_mq_bitmap_tags {
 	struct blk_align_bitmap *map;
 
 	atomic_t wake_index;
+	atomic_t nr_waiters;
 	struct bt_wait_state *bs;
 };
 
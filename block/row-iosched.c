@@ -0,0 +1,410 @@
+/*
+ *  ROW (Read Over Write) i/o scheduler.
+ *
+ *  A scheduler for flash based block devices (eMMC/UFS). Flash has no seek
+ *  penalty, so there is no sorting and no idling; instead requests are
+ *  split into priority queues and sync reads are served ahead of writes:
+ *
+ *	reg_read	reads from foreground tasks
+ *	reg_swrite	sync writes from foreground tasks
+ *	reg_write	async writes from foreground tasks
+ *	bg_read		reads from background tasks
+ *	bg_write	writes from background tasks
+ *
+ *  A request is background when it comes from a blkcg whose weight is below
+ *  bg_weight, or when its io priority class is IOPRIO_CLASS_IDLE.
+ *
+ *  The highest priority non-empty queue is served, with two limits to keep
+ *  the lower queues from starving: a queue whose oldest request is older
+ *  than its expire time is served first, and a queue that was passed over
+ *  more than its starve limit times is served next.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 and
+ *  only version 2 as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/ioprio.h>
+#include <linux/jiffies.h>
+#include "blk-cgroup.h"
+
+enum row_queue_prio {
+	ROWQ_PRIO_REG_READ = 0,
+	ROWQ_PRIO_REG_SWRITE,
+	ROWQ_PRIO_REG_WRITE,
+	ROWQ_PRIO_BG_READ,
+	ROWQ_PRIO_BG_WRITE,
+	ROWQ_MAX_PRIO,
+};
+
+/* max time (ms) before the oldest request of a queue is served */
+static const int row_expire[ROWQ_MAX_PRIO] = {
+	[ROWQ_PRIO_REG_READ]	= 100,
+	[ROWQ_PRIO_REG_SWRITE]	= 250,
+	[ROWQ_PRIO_REG_WRITE]	= 500,
+	[ROWQ_PRIO_BG_READ]	= 1000,
+	[ROWQ_PRIO_BG_WRITE]	= 2000,
+};
+
+/* max times a queue is passed over by higher priority queues */
+static const int row_starve_limit[ROWQ_MAX_PRIO] = {
+	[ROWQ_PRIO_REG_READ]	= 0,
+	[ROWQ_PRIO_REG_SWRITE]	= 4,
+	[ROWQ_PRIO_REG_WRITE]	= 8,
+	[ROWQ_PRIO_BG_READ]	= 16,
+	[ROWQ_PRIO_BG_WRITE]	= 32,
+};
+
+struct row_queue {
+	struct list_head fifo;
+	int expire;		/* in jiffies */
+	int starve_limit;
+	int starved;		/* times passed over since last served */
+};
+
+struct row_data {
+	struct row_queue row_queues[ROWQ_MAX_PRIO];
+
+	/* blkcg weight below which requests are background */
+	int bg_weight;
+};
+
+static bool row_rq_is_background(struct row_data *rd, struct request *rq)
+{
+#ifdef CONFIG_BLK_CGROUP
+	struct request_list *rl = blk_rq_rl(rq);
+
+	if (rl->blkg && rl->blkg->blkcg->cfq_weight < rd->bg_weight)
+		return true;
+#endif
+	return IOPRIO_PRIO_CLASS(req_get_ioprio(rq)) == IOPRIO_CLASS_IDLE;
+}
+
+static enum row_queue_prio row_get_queue_prio(struct row_data *rd,
+					      struct request *rq)
+{
+	const bool bg = row_rq_is_background(rd, rq);
+
+	if (rq_data_dir(rq) == READ)
+		return bg ? ROWQ_PRIO_BG_READ : ROWQ_PRIO_REG_READ;
+	if (bg)
+		return ROWQ_PRIO_BG_WRITE;
+
+	return rq_is_sync(rq) ? ROWQ_PRIO_REG_SWRITE : ROWQ_PRIO_REG_WRITE;
+}
+
+static void row_add_request(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue = &rd->row_queues[row_get_queue_prio(rd, rq)];
+
+	rq->fifo_time = jiffies + rqueue->expire;
+	list_add_tail(&rq->queuelist, &rqueue->fifo);
+}
+
+static void row_merged_requests(struct request_queue *q, struct request *req,
+				struct request *next)
+{
+	/*
+	 * if next expires before req, assign its expire time to req
+	 * and move into next position (next will be deleted) in fifo
+	 */
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before(next->fifo_time, req->fifo_time)) {
+			list_move(&req->queuelist, &next->queuelist);
+			req->fifo_time = next->fifo_time;
+		}
+	}
+
+	rq_fifo_clear(next);
+}
+
+static void row_dispatch_insert(struct row_data *rd, int prio)
+{
+	struct request *rq = rq_entry_fifo(rd->row_queues[prio].fifo.next);
+
+	rq_fifo_clear(rq);
+	elv_dispatch_add_tail(rq->q, rq);
+}
+
+/*
+ * row_dispatch_requests picks the queue to serve: an expired queue in
+ * priority order, then the lowest priority queue over its starve limit,
+ * then the highest priority non-empty queue. One request is dispatched per
+ * call so that a newly arrived read is considered right away.
+ */
+static int row_dispatch_requests(struct request_queue *q, int force)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue;
+	int prio, first = -1;
+	int dispatched = 0;
+
+	if (unlikely(force)) {
+		for (prio = 0; prio < ROWQ_MAX_PRIO; prio++) {
+			rqueue = &rd->row_queues[prio];
+			while (!list_empty(&rqueue->fifo)) {
+				row_dispatch_insert(rd, prio);
+				dispatched++;
+			}
+			rqueue->starved = 0;
+		}
+		return dispatched;
+	}
+
+	for (prio = 0; prio < ROWQ_MAX_PRIO; prio++) {
+		rqueue = &rd->row_queues[prio];
+		if (list_empty(&rqueue->fifo))
+			continue;
+		if (first < 0)
+			first = prio;
+		if (time_after_eq(jiffies,
+				  rq_entry_fifo(rqueue->fifo.next)->fifo_time))
+			goto dispatch;
+	}
+
+	if (first < 0)
+		return 0;
+
+	for (prio = ROWQ_MAX_PRIO - 1; prio > first; prio--) {
+		rqueue = &rd->row_queues[prio];
+		if (!list_empty(&rqueue->fifo) &&
+		    rqueue->starved >= rqueue->starve_limit)
+			goto dispatch;
+	}
+
+	prio = first;
+
+dispatch:
+	rd->row_queues[prio].starved = 0;
+	for (first = prio + 1; first < ROWQ_MAX_PRIO; first++) {
+		rqueue = &rd->row_queues[first];
+		if (!list_empty(&rqueue->fifo))
+			rqueue->starved++;
+	}
+
+	row_dispatch_insert(rd, prio);
+
+	return 1;
+}
+
+static bool row_is_queue_head(struct row_data *rd, struct list_head *entry)
+{
+	int prio;
+
+	for (prio = 0; prio < ROWQ_MAX_PRIO; prio++)
+		if (entry == &rd->row_queues[prio].fifo)
+			return true;
+
+	return false;
+}
+
+static struct request *
+row_former_request(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+
+	if (row_is_queue_head(rd, rq->queuelist.prev))
+		return NULL;
+	return list_entry(rq->queuelist.prev, struct request, queuelist);
+}
+
+static struct request *
+row_latter_request(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+
+	if (row_is_queue_head(rd, rq->queuelist.next))
+		return NULL;
+	return list_entry(rq->queuelist.next, struct request, queuelist);
+}
+
+static int row_init_queue(struct request_queue *q, struct elevator_type *e)
+{
+	struct row_data *rd;
+	struct elevator_queue *eq;
+	int prio;
+
+	eq = elevator_alloc(q, e);
+	if (!eq)
+		return -ENOMEM;
+
+	rd = kzalloc_node(sizeof(*rd), GFP_KERNEL, q->node);
+	if (!rd) {
+		kobject_put(&eq->kobj);
+		return -ENOMEM;
+	}
+	eq->elevator_data = rd;
+
+	for (prio = 0; prio < ROWQ_MAX_PRIO; prio++) {
+		INIT_LIST_HEAD(&rd->row_queues[prio].fifo);
+		rd->row_queues[prio].expire =
+			msecs_to_jiffies(row_expire[prio]);
+		rd->row_queues[prio].starve_limit = row_starve_limit[prio];
+	}
+	rd->bg_weight = CFQ_WEIGHT_DEFAULT;
+
+	spin_lock_irq(q->queue_lock);
+	q->elevator = eq;
+	spin_unlock_irq(q->queue_lock);
+	return 0;
+}
+
+static void row_exit_queue(struct elevator_queue *e)
+{
+	struct row_data *rd = e->elevator_data;
+	int prio;
+
+	for (prio = 0; prio < ROWQ_MAX_PRIO; prio++)
+		BUG_ON(!list_empty(&rd->row_queues[prio].fifo));
+
+	kfree(rd);
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+row_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+row_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct row_data *rd = e->elevator_data;				\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return row_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(row_reg_read_expire_show,
+	rd->row_queues[ROWQ_PRIO_REG_READ].expire, 1);
+SHOW_FUNCTION(row_reg_swrite_expire_show,
+	rd->row_queues[ROWQ_PRIO_REG_SWRITE].expire, 1);
+SHOW_FUNCTION(row_reg_swrite_starve_show,
+	rd->row_queues[ROWQ_PRIO_REG_SWRITE].starve_limit, 0);
+SHOW_FUNCTION(row_reg_write_expire_show,
+	rd->row_queues[ROWQ_PRIO_REG_WRITE].expire, 1);
+SHOW_FUNCTION(row_reg_write_starve_show,
+	rd->row_queues[ROWQ_PRIO_REG_WRITE].starve_limit, 0);
+SHOW_FUNCTION(row_bg_read_expire_show,
+	rd->row_queues[ROWQ_PRIO_BG_READ].expire, 1);
+SHOW_FUNCTION(row_bg_read_starve_show,
+	rd->row_queues[ROWQ_PRIO_BG_READ].starve_limit, 0);
+SHOW_FUNCTION(row_bg_write_expire_show,
+	rd->row_queues[ROWQ_PRIO_BG_WRITE].expire, 1);
+SHOW_FUNCTION(row_bg_write_starve_show,
+	rd->row_queues[ROWQ_PRIO_BG_WRITE].starve_limit, 0);
+SHOW_FUNCTION(row_bg_weight_show, rd->bg_weight, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct row_data *rd = e->elevator_data;				\
+	int __data;							\
+	int ret = row_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(row_reg_read_expire_store,
+	&rd->row_queues[ROWQ_PRIO_REG_READ].expire, 0, INT_MAX, 1);
+STORE_FUNCTION(row_reg_swrite_expire_store,
+	&rd->row_queues[ROWQ_PRIO_REG_SWRITE].expire, 0, INT_MAX, 1);
+STORE_FUNCTION(row_reg_swrite_starve_store,
+	&rd->row_queues[ROWQ_PRIO_REG_SWRITE].starve_limit, 0, INT_MAX, 0);
+STORE_FUNCTION(row_reg_write_expire_store,
+	&rd->row_queues[ROWQ_PRIO_REG_WRITE].expire, 0, INT_MAX, 1);
+STORE_FUNCTION(row_reg_write_starve_store,
+	&rd->row_queues[ROWQ_PRIO_REG_WRITE].starve_limit, 0, INT_MAX, 0);
+STORE_FUNCTION(row_bg_read_expire_store,
+	&rd->row_queues[ROWQ_PRIO_BG_READ].expire, 0, INT_MAX, 1);
+STORE_FUNCTION(row_bg_read_starve_store,
+	&rd->row_queues[ROWQ_PRIO_BG_READ].starve_limit, 0, INT_MAX, 0);
+STORE_FUNCTION(row_bg_write_expire_store,
+	&rd->row_queues[ROWQ_PRIO_BG_WRITE].expire, 0, INT_MAX, 1);
+STORE_FUNCTION(row_bg_write_starve_store,
+	&rd->row_queues[ROWQ_PRIO_BG_WRITE].starve_limit, 0, INT_MAX, 0);
+STORE_FUNCTION(row_bg_weight_store, &rd->bg_weight,
+	CFQ_WEIGHT_MIN, CFQ_WEIGHT_MAX + 1, 0);
+#undef STORE_FUNCTION
+
+#define ROW_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
+				      row_##name##_store)
+
+static struct elv_fs_entry row_attrs[] = {
+	ROW_ATTR(reg_read_expire),
+	ROW_ATTR(reg_swrite_expire),
+	ROW_ATTR(reg_swrite_starve),
+	ROW_ATTR(reg_write_expire),
+	ROW_ATTR(reg_write_starve),
+	ROW_ATTR(bg_read_expire),
+	ROW_ATTR(bg_read_starve),
+	ROW_ATTR(bg_write_expire),
+	ROW_ATTR(bg_write_starve),
+	ROW_ATTR(bg_weight),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_row = {
+	.ops = {
+		.elevator_merge_req_fn =	row_merged_requests,
+		.elevator_dispatch_fn =		row_dispatch_requests,
+		.elevator_add_req_fn =		row_add_request,
+		.elevator_former_req_fn =	row_former_request,
+		.elevator_latter_req_fn =	row_latter_request,
+		.elevator_init_fn =		row_init_queue,
+		.elevator_exit_fn =		row_exit_queue,
+	},
+
+	.elevator_attrs = row_attrs,
+	.elevator_name = "row",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init row_init(void)
+{
+	return elv_register(&iosched_row);
+}
+
+static void __exit row_exit(void)
+{
+	elv_unregister(&iosched_row);
+}
+
+module_init(row_init);
+module_exit(row_exit);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("Read Over Write IO scheduler");
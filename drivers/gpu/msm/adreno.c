@@ -2100,6 +2100,33 @@ static int adreno_setproperty(struct kgsl_device_private *dev_priv,
 			kgsl_context_put(context);
 		}
 		break;
+	case KGSL_PROP_CONTEXT_DEADLINE: {
+			struct kgsl_context_deadline deadline;
+			struct kgsl_context *context;
+
+			if (sizebytes != sizeof(deadline))
+				break;
+
+			if (copy_from_user(&deadline, value,
+				sizeof(deadline))) {
+				status = -EFAULT;
+				break;
+			}
+
+			context = kgsl_context_get_owner(dev_priv,
+							deadline.context_id);
+
+			if (context == NULL)
+				break;
+
+			/* Applies to command batches queued from now on */
+			ADRENO_CONTEXT(context)->deadline_us =
+				deadline.deadline_us;
+
+			kgsl_context_put(context);
+			status = 0;
+		}
+		break;
 	default:
 		break;
 	}
@@ -291,6 +291,18 @@ static int ctx_print(struct seq_file *s, void *unused)
 		   queued, consumed, retired,
 		   drawctxt->internal_timestamp);
 
+	seq_printf(s, "deadline: %u us misses: %u\n",
+		   drawctxt->deadline_us, drawctxt->deadline_misses);
+
+	seq_puts(s, "queue wait:\n");
+	for (i = 0; i < ADRENO_QUEUE_WAIT_BUCKETS - 1; i++)
+		seq_printf(s, "\t< %u us: %u\n",
+			(1 << ADRENO_QUEUE_WAIT_SHIFT) << i,
+			drawctxt->queue_wait[i]);
+	seq_printf(s, "\t>= %u us: %u\n",
+		(1 << ADRENO_QUEUE_WAIT_SHIFT) << (i - 1),
+		drawctxt->queue_wait[i]);
+
 	seq_puts(s, "cmdqueue:\n");
 
 	spin_lock(&drawctxt->lock);
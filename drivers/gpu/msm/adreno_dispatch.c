@@ -51,6 +51,12 @@ static unsigned int _context_queue_wait = 10000;
 /* Number of command batches sent at a time from a single context */
 static unsigned int _context_cmdbatch_burst = 5;
 
+/*
+ * Default deadline in milliseconds for command batches from contexts that
+ * haven't declared one with KGSL_PROP_CONTEXT_DEADLINE
+ */
+static unsigned int _context_deadline = 100;
+
 /*
  * GFT throttle parameters. If GFT recovered more than
  * X times in Y ms invalidate the context and do not attempt recovery.
@@ -348,11 +354,25 @@ static bool _marker_expired(struct kgsl_cmdbatch *cmdbatch)
 			cmdbatch->marker_timestamp);
 }
 
+/*
+ * Cache the deadline of the command batch at the head of the context queue
+ * so the dispatcher can order the pending contexts without taking the
+ * context lock. Must be called with drawctxt->lock held; the dispatcher
+ * reads the value under its plist_lock only, hence WRITE_ONCE().
+ */
+static inline void _update_context_deadline(struct adreno_context *drawctxt)
+{
+	if (drawctxt->cmdqueue_head != drawctxt->cmdqueue_tail)
+		WRITE_ONCE(drawctxt->deadline_ns, ktime_to_ns(
+			drawctxt->cmdqueue[drawctxt->cmdqueue_head]->deadline));
+}
+
 static inline void _pop_cmdbatch(struct adreno_context *drawctxt)
 {
 	drawctxt->cmdqueue_head = CMDQUEUE_NEXT(drawctxt->cmdqueue_head,
 		ADRENO_CONTEXT_CMDQUEUE_SIZE);
 	drawctxt->queued--;
+	_update_context_deadline(drawctxt);
 }
 /**
  * Removes all expired marker and sync cmdbatches from
@@ -511,6 +531,7 @@ static inline int adreno_dispatcher_requeue_cmdbatch(
 
 	/* Reset the command queue head to reflect the newly requeued change */
 	drawctxt->cmdqueue_head = prev;
+	_update_context_deadline(drawctxt);
 	spin_unlock(&drawctxt->lock);
 	return 0;
 }
@@ -692,6 +713,32 @@ static int sendcmd(struct adreno_device *adreno_dev,
 	return 0;
 }
 
+/**
+ * _account_queue_wait() - Record how long a command batch waited to be sent
+ * @drawctxt: Pointer to the adreno context the command batch came from
+ * @queue_time: Time at which the command batch was queued
+ * @deadline: Time by which the command batch should have been submitted
+ *
+ * Only called from the dispatcher with the dispatcher mutex held
+ */
+static void _account_queue_wait(struct adreno_context *drawctxt,
+		ktime_t queue_time, ktime_t deadline)
+{
+	ktime_t now = ktime_get();
+	s64 us = ktime_us_delta(now, queue_time);
+	unsigned int bucket = 0;
+
+	if (us >= (1 << ADRENO_QUEUE_WAIT_SHIFT))
+		bucket = min_t(unsigned int,
+			fls64(us >> ADRENO_QUEUE_WAIT_SHIFT),
+			ADRENO_QUEUE_WAIT_BUCKETS - 1);
+
+	drawctxt->queue_wait[bucket]++;
+
+	if (ktime_after(now, deadline))
+		drawctxt->deadline_misses++;
+}
+
 /**
  * dispatcher_context_sendcmds() - Send commands from a context to the GPU
  * @adreno_dev: Pointer to the adreno device struct
@@ -710,6 +757,7 @@ static int dispatcher_context_sendcmds(struct adreno_device *adreno_dev,
 	int ret = 0;
 	int inflight = _cmdqueue_inflight(dispatch_q);
 	unsigned int timestamp;
+	ktime_t queue_time, deadline;
 
 	if (dispatch_q->inflight >= inflight) {
 		expire_markers(drawctxt);
@@ -754,6 +802,8 @@ static int dispatcher_context_sendcmds(struct adreno_device *adreno_dev,
 		}
 
 		timestamp = cmdbatch->timestamp;
+		queue_time = cmdbatch->queue_time;
+		deadline = cmdbatch->deadline;
 
 		ret = sendcmd(adreno_dev, cmdbatch);
 
@@ -781,6 +831,7 @@ static int dispatcher_context_sendcmds(struct adreno_device *adreno_dev,
 		}
 
 		drawctxt->submitted_timestamp = timestamp;
+		_account_queue_wait(drawctxt, queue_time, deadline);
 
 		count++;
 	}
@@ -800,6 +851,39 @@ static int dispatcher_context_sendcmds(struct adreno_device *adreno_dev,
 	return ret;
 }
 
+/**
+ * _next_pending_context() - Pick the next context to dispatch from
+ * @dispatcher: Pointer to the adreno dispatcher struct
+ *
+ * The pending list is sorted by context priority. Within the highest
+ * priority level pick the context whose oldest command batch has the
+ * earliest deadline, so that contexts with a short frame deadline get
+ * ahead of throughput contexts of the same priority. Higher priority
+ * contexts still run on their own ringbuffer and preempt lower ones.
+ * Must be called with the plist_lock held.
+ */
+static struct adreno_context *_next_pending_context(
+		struct adreno_dispatcher *dispatcher)
+{
+	struct adreno_context *drawctxt, *next = NULL;
+
+	plist_for_each_entry(drawctxt, &dispatcher->pending, pending) {
+		if (next == NULL) {
+			next = drawctxt;
+			continue;
+		}
+
+		if (drawctxt->pending.prio != next->pending.prio)
+			break;
+
+		if (READ_ONCE(drawctxt->deadline_ns) <
+				READ_ONCE(next->deadline_ns))
+			next = drawctxt;
+	}
+
+	return next;
+}
+
 /**
  * _adreno_dispatcher_issuecmds() - Issue commmands from pending contexts
  * @adreno_dev: Pointer to the adreno device struct
@@ -839,8 +923,7 @@ static void _adreno_dispatcher_issuecmds(struct adreno_device *adreno_dev)
 		}
 
 		/* Get the next entry on the list */
-		drawctxt = plist_first_entry(&dispatcher->pending,
-			struct adreno_context, pending);
+		drawctxt = _next_pending_context(dispatcher);
 
 		plist_del(&drawctxt->pending, &dispatcher->pending);
 
@@ -1119,10 +1202,17 @@ int adreno_dispatcher_queue_cmd(struct adreno_device *adreno_dev,
 	else
 		cmdbatch->fault_policy = adreno_dev->ft_policy;
 
+	/* Stamp the command with the deadline by which it should be sent */
+	cmdbatch->queue_time = ktime_get();
+	cmdbatch->deadline = ktime_add_us(cmdbatch->queue_time,
+		drawctxt->deadline_us ? drawctxt->deadline_us :
+		_context_deadline * USEC_PER_MSEC);
+
 	/* Put the command into the queue */
 	drawctxt->cmdqueue[drawctxt->cmdqueue_tail] = cmdbatch;
 	drawctxt->cmdqueue_tail = (drawctxt->cmdqueue_tail + 1) %
 		ADRENO_CONTEXT_CMDQUEUE_SIZE;
+	_update_context_deadline(drawctxt);
 
 	/*
 	 * If this is a real command then we need to force any markers queued
@@ -2350,6 +2440,7 @@ static DISPATCHER_UINT_ATTR(context_burst_count, 0644, 0,
 static DISPATCHER_UINT_ATTR(cmdbatch_timeout, 0644, 0,
 	adreno_cmdbatch_timeout);
 static DISPATCHER_UINT_ATTR(context_queue_wait, 0644, 0, _context_queue_wait);
+static DISPATCHER_UINT_ATTR(context_deadline, 0644, 0, _context_deadline);
 static DISPATCHER_UINT_ATTR(fault_detect_interval, 0644, 0,
 	_fault_timer_interval);
 static DISPATCHER_UINT_ATTR(fault_throttle_time, 0644, 0,
@@ -2370,6 +2461,7 @@ static struct attribute *dispatcher_attrs[] = {
 	&dispatcher_attr_context_burst_count.attr,
 	&dispatcher_attr_cmdbatch_timeout.attr,
 	&dispatcher_attr_context_queue_wait.attr,
+	&dispatcher_attr_context_deadline.attr,
 	&dispatcher_attr_fault_detect_interval.attr,
 	&dispatcher_attr_fault_throttle_time.attr,
 	&dispatcher_attr_fault_throttle_burst.attr,
@@ -21,6 +21,13 @@ struct adreno_context_type {
 #define ADRENO_CONTEXT_CMDQUEUE_SIZE 128
 #define SUBMIT_RETIRE_TICKS_SIZE 7
 
+/*
+ * Queue wait histogram: bucket 0 counts waits below 64us, each following
+ * bucket doubles the upper bound and the last one collects everything else
+ */
+#define ADRENO_QUEUE_WAIT_BUCKETS 12
+#define ADRENO_QUEUE_WAIT_SHIFT 6
+
 struct kgsl_device;
 struct adreno_device;
 struct kgsl_device_private;
@@ -51,6 +58,11 @@ struct kgsl_context;
  *		 be written.
  * @active_node: Linkage for nodes in active_list
  * @active_time: Time when this context last seen
+ * @deadline_us: Frame deadline declared by userspace, 0 for the default
+ * @deadline_ns: Deadline of the command batch at the head of the cmdqueue,
+ *		 written under @lock but read locklessly by the dispatcher
+ * @deadline_misses: Number of command batches submitted after their deadline
+ * @queue_wait: Histogram of the time command batches spent in the cmdqueue
  */
 struct adreno_context {
 	struct kgsl_context base;
@@ -79,6 +91,11 @@ struct adreno_context {
 
 	struct list_head active_node;
 	unsigned long active_time;
+
+	unsigned int deadline_us;
+	u64 deadline_ns;
+	unsigned int deadline_misses;
+	unsigned int queue_wait[ADRENO_QUEUE_WAIT_BUCKETS];
 };
 
 /* Flag definitions for flag field in adreno_context */
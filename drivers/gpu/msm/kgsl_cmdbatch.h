@@ -49,6 +49,8 @@
  * @global_ts: The ringbuffer timestamp corresponding to this cmdbatch
  * @timeout_jiffies: For a syncpoint cmdbatch the jiffies at which the
  * timer will expire
+ * @queue_time: Time at which the cmdbatch was queued to its context
+ * @deadline: Time by which the dispatcher should have submitted the cmdbatch
  * This structure defines an atomic batch of command buffers issued from
  * userspace.
  */
@@ -74,6 +76,8 @@ struct kgsl_cmdbatch {
 	uint64_t submit_ticks;
 	unsigned int global_ts;
 	unsigned long timeout_jiffies;
+	ktime_t queue_time;
+	ktime_t deadline;
 };
 
 /**
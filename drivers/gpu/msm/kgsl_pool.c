@@ -16,6 +16,9 @@
 #include <linux/slab.h>
 #include <linux/highmem.h>
 #include <linux/version.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/rcupdate.h>
 
 #include "kgsl.h"
 #include "kgsl_device.h"
@@ -30,30 +33,65 @@
 /* Set the max pool size to 8192 pages */
 static unsigned int kgsl_pool_max_pages = KGSL_POOL_MAX_PAGES;
 
+/**
+ * struct kgsl_page_pool - pool of pages of a single order
+ * @pool_order: Order of the pages in this pool
+ * @page_count: Number of zeroed pages, ready to be handed out
+ * @dirty_count: Number of freed pages that still have to be zeroed
+ * @reserved: Number of zeroed pages the refill worker keeps in the pool
+ * @list_lock: Lock protecting the page lists and counts
+ * @page_list: List of zeroed pages
+ * @dirty_list: List of pages waiting to be zeroed by the refill worker
+ * @hits: Number of allocations served from the pool
+ * @misses: Number of allocations that fell back to the system
+ * @alloc_ns: Total time spent in kgsl_pool_alloc_page() for this pool
+ * @alloc_ns_max: Longest time spent in kgsl_pool_alloc_page()
+ * @kobj: sysfs directory for the pool statistics
+ */
 struct kgsl_page_pool {
 	unsigned int pool_order;
 	int page_count;
+	int dirty_count;
+	unsigned int reserved;
 	spinlock_t list_lock;
 	struct list_head page_list;
+	struct list_head dirty_list;
+	atomic_long_t hits;
+	atomic_long_t misses;
+	atomic64_t alloc_ns;
+	atomic64_t alloc_ns_max;
+	struct kobject *kobj;
 };
 
+#define KGSL_POOL_INIT(_i, _order, _reserved) \
+	{ \
+		.pool_order = _order, \
+		.reserved = _reserved, \
+		.list_lock = __SPIN_LOCK_UNLOCKED(kgsl_pools[_i].list_lock), \
+		.page_list = LIST_HEAD_INIT(kgsl_pools[_i].page_list), \
+		.dirty_list = LIST_HEAD_INIT(kgsl_pools[_i].dirty_list), \
+	}
+
+/*
+ * The 64K and 1M pools keep a few zeroed chunks in reserve so that large
+ * allocations can be served with contiguous chunks without waiting for
+ * the page allocator. The reserve can be tuned from sysfs.
+ */
 static struct kgsl_page_pool kgsl_pools[] = {
-	{
-		.pool_order = 0,
-		.list_lock = __SPIN_LOCK_UNLOCKED(kgsl_pools[0].list_lock),
-		.page_list = LIST_HEAD_INIT(kgsl_pools[0].page_list),
-	},
+	KGSL_POOL_INIT(0, 0, 0),
 #ifndef CONFIG_ALLOC_BUFFERS_IN_4K_CHUNKS
-	{
-		.pool_order = 4,
-		.list_lock = __SPIN_LOCK_UNLOCKED(kgsl_pools[1].list_lock),
-		.page_list = LIST_HEAD_INIT(kgsl_pools[1].page_list),
-	},
+	KGSL_POOL_INIT(1, 4, 32),
+	KGSL_POOL_INIT(2, 8, 4),
 #endif
 };
 
 #define KGSL_NUM_POOLS ARRAY_SIZE(kgsl_pools)
 
+/* RCU protected so that the free path can't queue work on it after exit */
+static struct workqueue_struct __rcu *kgsl_pool_wq;
+static struct work_struct kgsl_pool_refill_work;
+static struct kobject *kgsl_pool_kobj;
+
 /* Returns KGSL pool corresponding to input page order*/
 static struct kgsl_page_pool *
 _kgsl_get_pool_from_order(unsigned int order)
@@ -68,33 +106,56 @@ _kgsl_get_pool_from_order(unsigned int order)
 	return NULL;
 }
 
-/* Add a page to specified pool */
+/* Add a page to the zeroed or the dirty list of the specified pool */
 static void
-_kgsl_pool_add_page(struct kgsl_page_pool *pool, struct page *p)
+_kgsl_pool_add_page(struct kgsl_page_pool *pool, struct page *p, bool zeroed)
 {
 	spin_lock(&pool->list_lock);
-	list_add_tail(&p->lru, &pool->page_list);
-	pool->page_count++;
+	if (zeroed) {
+		list_add_tail(&p->lru, &pool->page_list);
+		pool->page_count++;
+	} else {
+		list_add_tail(&p->lru, &pool->dirty_list);
+		pool->dirty_count++;
+	}
 	spin_unlock(&pool->list_lock);
 }
 
-/* Returns a page from specified pool */
+/* Returns a page from the zeroed or the dirty list of specified pool */
 static struct page *
-_kgsl_pool_get_page(struct kgsl_page_pool *pool)
+_kgsl_pool_get_page(struct kgsl_page_pool *pool, bool zeroed)
 {
 	struct page *p = NULL;
 
 	spin_lock(&pool->list_lock);
-	if (pool->page_count) {
+	if (zeroed && pool->page_count) {
 		p = list_first_entry(&pool->page_list, struct page, lru);
 		pool->page_count--;
 		list_del(&p->lru);
+	} else if (!zeroed && pool->dirty_count) {
+		p = list_first_entry(&pool->dirty_list, struct page, lru);
+		pool->dirty_count--;
+		list_del(&p->lru);
 	}
 	spin_unlock(&pool->list_lock);
 
 	return p;
 }
 
+/* Zero a (possibly compound) page and flush it out of the CPU caches */
+static void kgsl_pool_zero_page(struct page *page, unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++) {
+		void *ptr = kmap_atomic(nth_page(page, i));
+
+		memset(ptr, 0, PAGE_SIZE);
+		dmac_flush_range(ptr, ptr + PAGE_SIZE);
+		kunmap_atomic(ptr);
+	}
+}
+
 /* Returns the number of pages in specified pool */
 static int
 kgsl_pool_size(struct kgsl_page_pool *kgsl_pool)
@@ -102,7 +163,8 @@ kgsl_pool_size(struct kgsl_page_pool *kgsl_pool)
 	int size;
 
 	spin_lock(&kgsl_pool->list_lock);
-	size = kgsl_pool->page_count * (1 << kgsl_pool->pool_order);
+	size = (kgsl_pool->page_count + kgsl_pool->dirty_count) *
+		(1 << kgsl_pool->pool_order);
 	spin_unlock(&kgsl_pool->list_lock);
 
 	return size;
@@ -133,7 +195,11 @@ _kgsl_pool_shrink(struct kgsl_page_pool *pool, int num_pages)
 		return pcount;
 
 	for (j = 0; j < num_pages >> pool->pool_order; j++) {
-		struct page *page = _kgsl_pool_get_page(pool);
+		/* Release the pages that haven't been zeroed yet first */
+		struct page *page = _kgsl_pool_get_page(pool, false);
+
+		if (page == NULL)
+			page = _kgsl_pool_get_page(pool, true);
 
 		if (page != NULL) {
 			__free_pages(page, pool->pool_order);
@@ -186,6 +252,64 @@ kgsl_pool_reduce(unsigned int target_pages)
 	return pcount;
 }
 
+/* Returns true if the pool is below its reserve and there is room left */
+static bool _kgsl_pool_needs_refill(struct kgsl_page_pool *pool)
+{
+	bool ret;
+
+	spin_lock(&pool->list_lock);
+	ret = pool->page_count < pool->reserved;
+	spin_unlock(&pool->list_lock);
+
+	return ret && (kgsl_pool_size_total() + (1 << pool->pool_order) <=
+			kgsl_pool_max_pages);
+}
+
+static void kgsl_pool_kick_refill(void)
+{
+	struct workqueue_struct *wq;
+
+	rcu_read_lock();
+	wq = rcu_dereference(kgsl_pool_wq);
+	if (wq != NULL)
+		queue_work(wq, &kgsl_pool_refill_work);
+	rcu_read_unlock();
+}
+
+/*
+ * Zero the pages that were freed back to the pools and top up each pool to
+ * its reserve, so that allocations don't have to pay for either on the
+ * caller's thread. The refill never tries hard to get memory; under
+ * memory pressure it simply gives up and leaves the pools to the shrinker.
+ */
+static void kgsl_pool_refill_worker(struct work_struct *work)
+{
+	int i;
+
+	for (i = 0; i < KGSL_NUM_POOLS; i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+		unsigned int order = pool->pool_order;
+		struct page *page;
+
+		while ((page = _kgsl_pool_get_page(pool, false)) != NULL) {
+			kgsl_pool_zero_page(page, order);
+			_kgsl_pool_add_page(pool, page, true);
+			cond_resched();
+		}
+
+		while (_kgsl_pool_needs_refill(pool)) {
+			page = alloc_pages(kgsl_gfp_mask(order) | __GFP_NORETRY |
+					__GFP_NOWARN, order);
+			if (page == NULL)
+				break;
+
+			kgsl_pool_zero_page(page, order);
+			_kgsl_pool_add_page(pool, page, true);
+			cond_resched();
+		}
+	}
+}
+
 /**
  * kgsl_pool_free_sgt() - Free scatter-gather list
  * @sgt: pointer of the sg list
@@ -249,23 +373,43 @@ void kgsl_pool_free_pages(struct page **pages, unsigned int pcount)
 	}
 }
 
+/* Record the time spent in kgsl_pool_alloc_page() for the pool stats */
+static void kgsl_pool_account_alloc(struct kgsl_page_pool *pool,
+		ktime_t start)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	s64 max = atomic64_read(&pool->alloc_ns_max);
+	s64 old;
+
+	atomic64_add(ns, &pool->alloc_ns);
+	while (ns > max) {
+		old = atomic64_cmpxchg(&pool->alloc_ns_max, max, ns);
+		if (old == max)
+			break;
+		max = old;
+	}
+}
+
 /**
  * kgsl_pool_alloc_page() - Allocate a page of requested size
  * @page_size: Size of the page to be allocated
  * @pages: pointer to hold list of pages, should be big enough to hold
  * requested page
  * @len: Length of array pages.
+ * @zeroed: Set to true if the page is already zeroed and flushed, otherwise
+ * the caller is responsible for zeroing it before it is exposed
  *
  * Return total page count on success and negative value on failure
  */
 int kgsl_pool_alloc_page(int page_size, struct page **pages,
-					unsigned int pages_len)
+					unsigned int pages_len, bool *zeroed)
 {
 	int j;
 	int pcount = 0;
 	struct kgsl_page_pool *pool;
 	struct page *page = NULL;
 	struct page *p = NULL;
+	ktime_t start = ktime_get();
 
 	if ((pages == NULL) || pages_len < (page_size >> PAGE_SHIFT))
 		return -EINVAL;
@@ -275,7 +419,13 @@ int kgsl_pool_alloc_page(int page_size, struct page **pages,
 	if (pool == NULL)
 		return -EINVAL;
 
-	page = _kgsl_pool_get_page(pool);
+	*zeroed = true;
+	page = _kgsl_pool_get_page(pool, true);
+
+	if (page == NULL) {
+		*zeroed = false;
+		page = _kgsl_pool_get_page(pool, false);
+	}
 
 	/* Allocate a new page if not allocated from pool */
 	if (page == NULL) {
@@ -286,14 +436,23 @@ int kgsl_pool_alloc_page(int page_size, struct page **pages,
 
 		if (!page)
 			return -ENOMEM;
+
+		atomic_long_inc(&pool->misses);
+	} else {
+		atomic_long_inc(&pool->hits);
 	}
 
+	if (_kgsl_pool_needs_refill(pool))
+		kgsl_pool_kick_refill();
+
 	for (j = 0; j < (page_size >> PAGE_SHIFT); j++) {
 		p = nth_page(page, j);
 		pages[pcount] = p;
 		pcount++;
 	}
 
+	kgsl_pool_account_alloc(pool, start);
+
 	return pcount;
 }
 
@@ -310,7 +469,9 @@ void kgsl_pool_free_page(struct page *page)
 	if (kgsl_pool_size_total() < kgsl_pool_max_pages) {
 		pool = _kgsl_get_pool_from_order(page_order);
 		if (pool != NULL) {
-			_kgsl_pool_add_page(pool, page);
+			/* The refill worker zeroes the page off this thread */
+			_kgsl_pool_add_page(pool, page, false);
+			kgsl_pool_kick_refill();
 			return;
 		}
 	}
@@ -352,18 +513,205 @@ static struct shrinker kgsl_pool_shrinker = {
 	.batch = 0,
 };
 
+/* sysfs interface for the pool statistics */
+
+static struct kgsl_page_pool *kgsl_pool_from_kobj(struct kobject *kobj)
+{
+	int i;
+
+	for (i = 0; i < KGSL_NUM_POOLS; i++) {
+		if (kgsl_pools[i].kobj == kobj)
+			return &kgsl_pools[i];
+	}
+
+	return NULL;
+}
+
+static ssize_t kgsl_pool_stat_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	struct kgsl_page_pool *pool = kgsl_pool_from_kobj(kobj);
+	uint64_t val = 0;
+
+	if (pool == NULL)
+		return -ENODEV;
+
+	if (!strcmp(attr->attr.name, "page_count")) {
+		spin_lock(&pool->list_lock);
+		val = pool->page_count + pool->dirty_count;
+		spin_unlock(&pool->list_lock);
+	} else if (!strcmp(attr->attr.name, "zeroed_count")) {
+		spin_lock(&pool->list_lock);
+		val = pool->page_count;
+		spin_unlock(&pool->list_lock);
+	} else if (!strcmp(attr->attr.name, "hits"))
+		val = atomic_long_read(&pool->hits);
+	else if (!strcmp(attr->attr.name, "misses"))
+		val = atomic_long_read(&pool->misses);
+	else if (!strcmp(attr->attr.name, "alloc_latency_ns")) {
+		uint64_t allocs = atomic_long_read(&pool->hits) +
+			atomic_long_read(&pool->misses);
+
+		val = allocs ? div64_u64(atomic64_read(&pool->alloc_ns),
+				allocs) : 0;
+	} else if (!strcmp(attr->attr.name, "alloc_latency_max_ns"))
+		val = atomic64_read(&pool->alloc_ns_max);
+
+	return snprintf(buf, PAGE_SIZE, "%llu\n", val);
+}
+
+static ssize_t kgsl_pool_reserved_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	struct kgsl_page_pool *pool = kgsl_pool_from_kobj(kobj);
+
+	if (pool == NULL)
+		return -ENODEV;
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", pool->reserved);
+}
+
+static ssize_t kgsl_pool_reserved_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct kgsl_page_pool *pool = kgsl_pool_from_kobj(kobj);
+	unsigned int val = 0;
+	int ret;
+
+	if (pool == NULL)
+		return -ENODEV;
+
+	ret = kgsl_sysfs_store(buf, &val);
+	if (ret)
+		return ret;
+
+	/* The reserve can't exceed what the pools are allowed to hold */
+	pool->reserved = min_t(unsigned int, val,
+			kgsl_pool_max_pages >> pool->pool_order);
+
+	if (_kgsl_pool_needs_refill(pool))
+		kgsl_pool_kick_refill();
+
+	return count;
+}
+
+static struct kobj_attribute kgsl_pool_attr_page_count =
+	__ATTR(page_count, 0444, kgsl_pool_stat_show, NULL);
+static struct kobj_attribute kgsl_pool_attr_zeroed_count =
+	__ATTR(zeroed_count, 0444, kgsl_pool_stat_show, NULL);
+static struct kobj_attribute kgsl_pool_attr_hits =
+	__ATTR(hits, 0444, kgsl_pool_stat_show, NULL);
+static struct kobj_attribute kgsl_pool_attr_misses =
+	__ATTR(misses, 0444, kgsl_pool_stat_show, NULL);
+static struct kobj_attribute kgsl_pool_attr_alloc_latency_ns =
+	__ATTR(alloc_latency_ns, 0444, kgsl_pool_stat_show, NULL);
+static struct kobj_attribute kgsl_pool_attr_alloc_latency_max_ns =
+	__ATTR(alloc_latency_max_ns, 0444, kgsl_pool_stat_show, NULL);
+static struct kobj_attribute kgsl_pool_attr_reserved =
+	__ATTR(reserved, 0644, kgsl_pool_reserved_show,
+		kgsl_pool_reserved_store);
+
+static struct attribute *kgsl_pool_attrs[] = {
+	&kgsl_pool_attr_page_count.attr,
+	&kgsl_pool_attr_zeroed_count.attr,
+	&kgsl_pool_attr_hits.attr,
+	&kgsl_pool_attr_misses.attr,
+	&kgsl_pool_attr_alloc_latency_ns.attr,
+	&kgsl_pool_attr_alloc_latency_max_ns.attr,
+	&kgsl_pool_attr_reserved.attr,
+	NULL,
+};
+
+static const struct attribute_group kgsl_pool_attr_group = {
+	.attrs = kgsl_pool_attrs,
+};
+
+/*
+ * Create /sys/class/kgsl/kgsl/page_pools/<size>k/ for each pool. Failures
+ * only cost us the statistics, so they are not fatal.
+ */
+static void kgsl_pool_init_sysfs(void)
+{
+	int i;
+
+	kgsl_pool_kobj = kobject_create_and_add("page_pools",
+			&kgsl_driver.virtdev.kobj);
+	if (kgsl_pool_kobj == NULL)
+		return;
+
+	for (i = 0; i < KGSL_NUM_POOLS; i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+		char name[16];
+
+		snprintf(name, sizeof(name), "%luk",
+			(PAGE_SIZE << pool->pool_order) >> 10);
+
+		pool->kobj = kobject_create_and_add(name, kgsl_pool_kobj);
+		if (pool->kobj == NULL)
+			continue;
+
+		if (sysfs_create_group(pool->kobj, &kgsl_pool_attr_group)) {
+			kobject_put(pool->kobj);
+			pool->kobj = NULL;
+		}
+	}
+}
+
+static void kgsl_pool_uninit_sysfs(void)
+{
+	int i;
+
+	for (i = 0; i < KGSL_NUM_POOLS; i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+
+		if (pool->kobj == NULL)
+			continue;
+
+		sysfs_remove_group(pool->kobj, &kgsl_pool_attr_group);
+		kobject_put(pool->kobj);
+		pool->kobj = NULL;
+	}
+
+	kobject_put(kgsl_pool_kobj);
+	kgsl_pool_kobj = NULL;
+}
+
 void kgsl_init_page_pools(void)
 {
 	/* Initialize shrinker */
 	register_shrinker(&kgsl_pool_shrinker);
+
+	INIT_WORK(&kgsl_pool_refill_work, kgsl_pool_refill_worker);
+	rcu_assign_pointer(kgsl_pool_wq, alloc_workqueue("kgsl-pool",
+		WQ_UNBOUND | WQ_FREEZABLE, 1));
+
+	kgsl_pool_init_sysfs();
+
+	/* Fill the reserved pools in the background */
+	kgsl_pool_kick_refill();
 }
 
 void kgsl_exit_page_pools(void)
 {
+	struct workqueue_struct *wq;
+
+	kgsl_pool_uninit_sysfs();
+
+	/*
+	 * Stop the refill worker before draining the pools. Once the grace
+	 * period has passed no free path can still be queueing work on the
+	 * workqueue, so destroying it flushes the last refill.
+	 */
+	wq = rcu_dereference_protected(kgsl_pool_wq, 1);
+	if (wq != NULL) {
+		RCU_INIT_POINTER(kgsl_pool_wq, NULL);
+		synchronize_rcu();
+		destroy_workqueue(wq);
+	}
+
 	/* Release all pages in pools, if any.*/
 	kgsl_pool_reduce(0);
 
 	/* Unregister shrinker */
 	unregister_shrinker(&kgsl_pool_shrinker);
 }
-
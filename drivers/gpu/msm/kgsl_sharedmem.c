@@ -616,6 +616,9 @@ EXPORT_SYMBOL(kgsl_cache_range_op);
 #ifndef CONFIG_ALLOC_BUFFERS_IN_4K_CHUNKS
 static inline int get_page_size(size_t size, unsigned int align)
 {
+	if (align >= ilog2(SZ_1M) && size >= SZ_1M)
+		return SZ_1M;
+
 	return (align >= ilog2(SZ_64K) && size >= SZ_64K)
 					? SZ_64K : PAGE_SIZE;
 }
@@ -682,7 +685,7 @@ kgsl_sharedmem_page_alloc_user(struct kgsl_memdesc *memdesc,
 {
 	int ret = 0;
 	unsigned int j, page_size, len_alloc;
-	unsigned int pcount = 0;
+	unsigned int pcount = 0, zcount = 0;
 	size_t len;
 	unsigned int align;
 
@@ -730,17 +733,19 @@ kgsl_sharedmem_page_alloc_user(struct kgsl_memdesc *memdesc,
 
 	while (len > 0) {
 		int page_count;
+		bool zeroed;
 
 		/* don't waste space at the end of the allocation*/
 		if (len < page_size)
-			page_size = PAGE_SIZE;
+			page_size = get_page_size(len, align);
 
 		page_count = kgsl_pool_alloc_page(page_size,
 					memdesc->pages + pcount,
-					len_alloc - pcount);
+					len_alloc - pcount, &zeroed);
 		if (page_count <= 0) {
+			/* Step down to the next smaller chunk size */
 			if (page_size != PAGE_SIZE) {
-				page_size = PAGE_SIZE;
+				page_size = get_page_size(page_size >> 1, align);
 				continue;
 			}
 
@@ -760,6 +765,18 @@ kgsl_sharedmem_page_alloc_user(struct kgsl_memdesc *memdesc,
 			goto done;
 		}
 
+		/*
+		 * Pages that come out of the pools pre-zeroed don't need to be
+		 * zeroed again. Zero the run of pages allocated before this one
+		 * in a single batch, and start a new run after it.
+		 */
+		if (zeroed) {
+			if (!(memdesc->flags & KGSL_MEMFLAGS_SECURE))
+				kgsl_zero_pages(memdesc->pages + zcount,
+					pcount - zcount);
+			zcount = pcount + page_count;
+		}
+
 		pcount += page_count;
 		len -= page_size;
 		memdesc->size += page_size;
@@ -822,9 +839,9 @@ kgsl_sharedmem_page_alloc_user(struct kgsl_memdesc *memdesc,
 		&kgsl_driver.stats.page_alloc_max);
 
 	/*
-	 * Zero out the pages.
+	 * Zero out the pages that didn't come pre-zeroed from the pools.
 	 */
-	kgsl_zero_pages(memdesc->pages, pcount);
+	kgsl_zero_pages(memdesc->pages + zcount, pcount - zcount);
 
 done:
 	if (ret) {
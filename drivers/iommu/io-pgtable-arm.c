@@ -500,6 +500,22 @@ static int arm_lpae_map_sg(struct io_pgtable_ops *ops, unsigned long iova,
 		if (!IS_ALIGNED(s->offset, min_pagesz))
 			goto out_err;
 
+		/*
+		 * Fold physically contiguous entries into a single range so
+		 * that block mappings can be used across sg boundaries and
+		 * the tables are only walked once per contiguous chunk.
+		 */
+		while (i + 1 < nents && IS_ALIGNED(size, min_pagesz)) {
+			struct scatterlist *next = sg_next(s);
+
+			if (page_to_phys(sg_page(next)) + next->offset !=
+			    phys + size)
+				break;
+			size += next->length;
+			s = next;
+			i++;
+		}
+
 		while (size) {
 			size_t pgsize = iommu_pgsize(
 				data->iop.cfg.pgsize_bitmap, iova | phys, size);
@@ -712,10 +728,17 @@ static size_t arm_lpae_unmap(struct io_pgtable_ops *ops, unsigned long iova,
 		size_t ret, size_to_unmap, remaining;
 
 		remaining = (size - unmapped);
-		size_to_unmap = remaining < SZ_2M
-			? remaining
-			: iommu_pgsize(data->iop.cfg.pgsize_bitmap, iova,
-								remaining);
+		if (remaining < SZ_2M)
+			size_to_unmap = remaining;
+		else if (!IS_ALIGNED(iova, SZ_2M))
+			/*
+			 * Clear the unaligned head up to the next 2M
+			 * boundary in one go rather than page by page.
+			 */
+			size_to_unmap = SZ_2M - (iova & (SZ_2M - 1));
+		else
+			size_to_unmap = iommu_pgsize(
+				data->iop.cfg.pgsize_bitmap, iova, remaining);
 		ret = __arm_lpae_unmap(data, iova, size_to_unmap, lvl, ptep,
 				       NULL);
 		if (ret == 0)
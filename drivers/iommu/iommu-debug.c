@@ -486,26 +486,37 @@ struct iommu_debug_device {
 	struct list_head list;
 };
 
+/*
+ * With @contig set, the chunks are laid out back to back across a single
+ * 2M allocation (wrapping around at the end of it), which is what a large
+ * ion buffer backed by high-order pages looks like to map_sg.  Otherwise
+ * every chunk points at the same page.
+ */
 static int iommu_debug_build_phoney_sg_table(struct device *dev,
 					     struct sg_table *table,
 					     unsigned long total_size,
-					     unsigned long chunk_size)
+					     unsigned long chunk_size,
+					     bool contig)
 {
 	unsigned long nents = total_size / chunk_size;
+	unsigned long alloc_size = contig ? SZ_2M : chunk_size;
+	unsigned long chunks_per_alloc = alloc_size / chunk_size;
 	struct scatterlist *sg;
 	int i;
 	struct page *page;
 
 	BUG_ON(!IS_ALIGNED(total_size, PAGE_SIZE));
 	BUG_ON(!IS_ALIGNED(total_size, chunk_size));
+	BUG_ON(!IS_ALIGNED(alloc_size, chunk_size));
 	BUG_ON(sg_alloc_table(table, nents, GFP_KERNEL));
-	page = alloc_pages(GFP_KERNEL, get_order(chunk_size));
+	page = alloc_pages(GFP_KERNEL, get_order(alloc_size));
 	if (!page)
 		goto free_table;
 
-	/* all the same page... why not. */
 	for_each_sg(table->sgl, sg, table->nents, i)
-		sg_set_page(sg, page, chunk_size, 0);
+		sg_set_page(sg, nth_page(page, (i % chunks_per_alloc) *
+					 (chunk_size >> PAGE_SHIFT)),
+			    chunk_size, 0);
 
 	return 0;
 
@@ -516,9 +527,11 @@ free_table:
 
 static void iommu_debug_destroy_phoney_sg_table(struct device *dev,
 						struct sg_table *table,
-						unsigned long chunk_size)
+						unsigned long chunk_size,
+						bool contig)
 {
-	__free_pages(sg_page(table->sgl), get_order(chunk_size));
+	__free_pages(sg_page(table->sgl),
+		     get_order(contig ? SZ_2M : chunk_size));
 	sg_free_table(table);
 }
 
@@ -562,6 +575,78 @@ static int nr_iters_get(void *data, u64 *val)
 DEFINE_SIMPLE_ATTRIBUTE(iommu_debug_nr_iters_ops,
 			nr_iters_get, nr_iters_set, "%llu\n");
 
+static int iommu_debug_profile_map_sg(struct seq_file *s,
+				      struct iommu_domain *domain,
+				      struct device *dev, const size_t sizes[],
+				      unsigned long iova, bool contig)
+{
+	const size_t *sz;
+
+	for (sz = sizes; *sz; ++sz) {
+		size_t size = *sz;
+		size_t unmapped;
+		u64 map_elapsed_ns = 0, unmap_elapsed_ns = 0;
+		u64 map_elapsed_us = 0, unmap_elapsed_us = 0;
+		u32 map_elapsed_rem = 0, unmap_elapsed_rem = 0;
+		struct timespec tbefore, tafter, diff;
+		struct sg_table table;
+		unsigned long chunk_size = SZ_4K;
+		int i;
+
+		if (iommu_debug_build_phoney_sg_table(dev, &table, size,
+						      chunk_size, contig)) {
+			seq_puts(s,
+				"couldn't build phoney sg table! bailing...\n");
+			return -ENOMEM;
+		}
+
+		for (i = 0; i < iters_per_op; ++i) {
+			getnstimeofday(&tbefore);
+			if (iommu_map_sg(domain, iova, table.sgl, table.nents,
+					 IOMMU_READ | IOMMU_WRITE) != size) {
+				seq_puts(s, "Failed to map_sg\n");
+				goto next;
+			}
+			getnstimeofday(&tafter);
+			diff = timespec_sub(tafter, tbefore);
+			map_elapsed_ns += timespec_to_ns(&diff);
+
+			getnstimeofday(&tbefore);
+			unmapped = iommu_unmap(domain, iova, size);
+			if (unmapped != size) {
+				seq_printf(s,
+					   "Only unmapped %zx instead of %zx\n",
+					   unmapped, size);
+				goto next;
+			}
+			getnstimeofday(&tafter);
+			diff = timespec_sub(tafter, tbefore);
+			unmap_elapsed_ns += timespec_to_ns(&diff);
+		}
+
+		map_elapsed_ns = div_u64_rem(map_elapsed_ns, iters_per_op,
+				&map_elapsed_rem);
+		unmap_elapsed_ns = div_u64_rem(unmap_elapsed_ns, iters_per_op,
+				&unmap_elapsed_rem);
+
+		map_elapsed_us = div_u64_rem(map_elapsed_ns, 1000,
+						&map_elapsed_rem);
+		unmap_elapsed_us = div_u64_rem(unmap_elapsed_ns, 1000,
+						&unmap_elapsed_rem);
+
+		seq_printf(s, "%8s %12lld.%03d us %9lld.%03d us\n",
+			_size_to_string(size),
+			map_elapsed_us, map_elapsed_rem,
+			unmap_elapsed_us, unmap_elapsed_rem);
+
+next:
+		iommu_debug_destroy_phoney_sg_table(dev, &table, chunk_size,
+						    contig);
+	}
+
+	return 0;
+}
+
 static void iommu_debug_device_profiling(struct seq_file *s, struct device *dev,
 					 enum iommu_attr attrs[],
 					 void *attr_values[], int nattrs,
@@ -659,66 +744,18 @@ static void iommu_debug_device_profiling(struct seq_file *s, struct device *dev,
 
 	seq_putc(s, '\n');
 	seq_printf(s, "%8s %19s %16s\n", "size", "iommu_map_sg", "iommu_unmap");
-	for (sz = sizes; *sz; ++sz) {
-		size_t size = *sz;
-		size_t unmapped;
-		u64 map_elapsed_ns = 0, unmap_elapsed_ns = 0;
-		u64 map_elapsed_us = 0, unmap_elapsed_us = 0;
-		u32 map_elapsed_rem = 0, unmap_elapsed_rem = 0;
-		struct timespec tbefore, tafter, diff;
-		struct sg_table table;
-		unsigned long chunk_size = SZ_4K;
-		int i;
-
-		if (iommu_debug_build_phoney_sg_table(dev, &table, size,
-						      chunk_size)) {
-			seq_puts(s,
-				"couldn't build phoney sg table! bailing...\n");
-			goto out_detach;
-		}
-
-		for (i = 0; i < iters_per_op; ++i) {
-			getnstimeofday(&tbefore);
-			if (iommu_map_sg(domain, iova, table.sgl, table.nents,
-					 IOMMU_READ | IOMMU_WRITE) != size) {
-				seq_puts(s, "Failed to map_sg\n");
-				goto next;
-			}
-			getnstimeofday(&tafter);
-			diff = timespec_sub(tafter, tbefore);
-			map_elapsed_ns += timespec_to_ns(&diff);
-
-			getnstimeofday(&tbefore);
-			unmapped = iommu_unmap(domain, iova, size);
-			if (unmapped != size) {
-				seq_printf(s,
-					   "Only unmapped %zx instead of %zx\n",
-					   unmapped, size);
-				goto next;
-			}
-			getnstimeofday(&tafter);
-			diff = timespec_sub(tafter, tbefore);
-			unmap_elapsed_ns += timespec_to_ns(&diff);
-		}
-
-		map_elapsed_ns = div_u64_rem(map_elapsed_ns, iters_per_op,
-				&map_elapsed_rem);
-		unmap_elapsed_ns = div_u64_rem(unmap_elapsed_ns, iters_per_op,
-				&unmap_elapsed_rem);
-
-		map_elapsed_us = div_u64_rem(map_elapsed_ns, 1000,
-						&map_elapsed_rem);
-		unmap_elapsed_us = div_u64_rem(unmap_elapsed_ns, 1000,
-						&unmap_elapsed_rem);
-
-		seq_printf(s, "%8s %12lld.%03d us %9lld.%03d us\n",
-			_size_to_string(size),
-			map_elapsed_us, map_elapsed_rem,
-			unmap_elapsed_us, unmap_elapsed_rem);
+	if (iommu_debug_profile_map_sg(s, domain, dev, sizes, iova, false))
+		goto out_detach;
 
-next:
-		iommu_debug_destroy_phoney_sg_table(dev, &table, chunk_size);
-	}
+	/*
+	 * Same again with physically contiguous chunks at a 2M aligned
+	 * iova, so that map_sg can coalesce the chunks into block mappings
+	 * the way it would for a large ion buffer.
+	 */
+	seq_putc(s, '\n');
+	seq_printf(s, "%8s %19s %16s\n", "size", "map_sg (contig)",
+		   "iommu_unmap");
+	iommu_debug_profile_map_sg(s, domain, dev, sizes, SZ_2M, true);
 
 out_detach:
 	iommu_detach_device(domain, dev);
@@ -18,6 +18,16 @@
  */
 
 #include <linux/iova.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+
+static void init_iova_rcaches(struct iova_domain *iovad);
+static void free_iova_rcaches(struct iova_domain *iovad);
+static void free_cached_iovas(struct iova_domain *iovad);
+static struct iova *iova_rcache_get(struct iova_domain *iovad,
+				    unsigned long size,
+				    unsigned long limit_pfn);
+static bool iova_rcache_insert(struct iova_domain *iovad, struct iova *iova);
 
 void
 init_iova_domain(struct iova_domain *iovad, unsigned long pfn_32bit)
@@ -26,6 +36,7 @@ init_iova_domain(struct iova_domain *iovad, unsigned long pfn_32bit)
 	iovad->rbroot = RB_ROOT;
 	iovad->cached32_node = NULL;
 	iovad->dma_32bit_pfn = pfn_32bit;
+	init_iova_rcaches(iovad);
 }
 
 static struct rb_node *
@@ -205,7 +216,8 @@ iova_insert_rbtree(struct rb_root *root, struct iova *iova)
  * This function allocates an iova in the range limit_pfn to IOVA_START_PFN
  * looking from limit_pfn instead from IOVA_START_PFN. If the size_aligned
  * flag is set then the allocated address iova->pfn_lo will be naturally
- * aligned on roundup_power_of_two(size).
+ * aligned on roundup_power_of_two(size). Size aligned ranges are first
+ * looked up in the per-cpu caches of recently freed ranges.
  */
 struct iova *
 alloc_iova(struct iova_domain *iovad, unsigned long size,
@@ -213,22 +225,36 @@ alloc_iova(struct iova_domain *iovad, unsigned long size,
 	bool size_aligned)
 {
 	struct iova *new_iova;
+	bool flushed_rcache = false;
 	int ret;
 
-	new_iova = alloc_iova_mem();
-	if (!new_iova)
-		return NULL;
-
 	/* If size aligned is set then round the size to
 	 * to next power of two.
 	 */
-	if (size_aligned)
+	if (size_aligned) {
 		size = __roundup_pow_of_two(size);
 
+		new_iova = iova_rcache_get(iovad, size, limit_pfn);
+		if (new_iova)
+			return new_iova;
+	}
+
+	new_iova = alloc_iova_mem();
+	if (!new_iova)
+		return NULL;
+	new_iova->cached = false;
+
+retry:
 	ret = __alloc_and_insert_iova_range(iovad, size, limit_pfn,
 			new_iova, size_aligned);
 
 	if (ret) {
+		/* Try replenishing the space with the cached ranges */
+		if (!flushed_rcache) {
+			flushed_rcache = true;
+			free_cached_iovas(iovad);
+			goto retry;
+		}
 		free_iova_mem(new_iova);
 		return NULL;
 	}
@@ -241,7 +267,8 @@ alloc_iova(struct iova_domain *iovad, unsigned long size,
  * @iovad: - iova domain in question.
  * @pfn: - page frame number
  * This function finds and returns an iova belonging to the
- * given doamin which matches the given pfn.
+ * given doamin which matches the given pfn. Freed ranges which are held
+ * by the range caches are not returned.
  */
 struct iova *find_iova(struct iova_domain *iovad, unsigned long pfn)
 {
@@ -257,6 +284,8 @@ struct iova *find_iova(struct iova_domain *iovad, unsigned long pfn)
 		/* If pfn falls within iova's range, return iova */
 		if ((pfn >= iova->pfn_lo) && (pfn <= iova->pfn_hi)) {
 			spin_unlock_irqrestore(&iovad->iova_rbtree_lock, flags);
+			if (ACCESS_ONCE(iova->cached))
+				return NULL;
 			/* We are not holding the lock while this iova
 			 * is referenced by the caller as the same thread
 			 * which called this function also calls __free_iova()
@@ -280,13 +309,21 @@ struct iova *find_iova(struct iova_domain *iovad, unsigned long pfn)
  * __free_iova - frees the given iova
  * @iovad: iova domain in question.
  * @iova: iova in question.
- * Frees the given iova belonging to the giving domain
+ * Frees the given iova belonging to the giving domain. Small size aligned
+ * ranges are kept in the per-cpu caches for reuse.
  */
 void
 __free_iova(struct iova_domain *iovad, struct iova *iova)
 {
 	unsigned long flags;
 
+	/* already freed into a range cache */
+	if (WARN_ON_ONCE(ACCESS_ONCE(iova->cached)))
+		return;
+
+	if (iova_rcache_insert(iovad, iova))
+		return;
+
 	spin_lock_irqsave(&iovad->iova_rbtree_lock, flags);
 	__cached_rbnode_delete_update(iovad, iova);
 	rb_erase(&iova->node, &iovad->rbroot);
@@ -320,6 +357,9 @@ void put_iova_domain(struct iova_domain *iovad)
 	struct rb_node *node;
 	unsigned long flags;
 
+	/* the cached iovas are freed with the rbtree below */
+	free_iova_rcaches(iovad);
+
 	spin_lock_irqsave(&iovad->iova_rbtree_lock, flags);
 	node = rb_first(&iovad->rbroot);
 	while (node) {
@@ -351,6 +391,7 @@ alloc_and_init_iova(unsigned long pfn_lo, unsigned long pfn_hi)
 	if (iova) {
 		iova->pfn_lo = pfn_lo;
 		iova->pfn_hi = pfn_hi;
+		iova->cached = false;
 	}
 
 	return iova;
@@ -396,6 +437,9 @@ reserve_iova(struct iova_domain *iovad,
 	struct iova *iova;
 	unsigned int overlap = 0;
 
+	/* a cached range must not be merged into the reserved one */
+	free_cached_iovas(iovad);
+
 	spin_lock_irqsave(&iovad->iova_rbtree_lock, flags);
 	for (node = rb_first(&iovad->rbroot); node; node = rb_next(node)) {
 		if (__is_range_overlap(node, pfn_lo, pfn_hi)) {
@@ -433,6 +477,9 @@ copy_reserved_iova(struct iova_domain *from, struct iova_domain *to)
 	unsigned long flags;
 	struct rb_node *node;
 
+	/* the cached ranges are free, don't reserve them in @to */
+	free_cached_iovas(from);
+
 	spin_lock_irqsave(&from->iova_rbtree_lock, flags);
 	for (node = rb_first(&from->rbroot); node; node = rb_next(node)) {
 		struct iova *iova = container_of(node, struct iova, node);
@@ -485,3 +532,313 @@ error:
 		free_iova_mem(prev);
 	return NULL;
 }
+
+/*
+ * Magazine caches for IOVA ranges. For an introduction to magazines,
+ * see the USENIX 2001 paper "Magazines and Vmem: Extending the Slab
+ * Allocator to Many CPUs and Arbitrary Resources" by Bonwick and Adams.
+ * For simplicity, we use a static magazine size and don't implement the
+ * dynamic size tuning described in the paper.
+ */
+
+#define IOVA_MAG_SIZE 128
+
+struct iova_magazine {
+	unsigned long size;
+	struct iova *iovas[IOVA_MAG_SIZE];
+};
+
+struct iova_cpu_rcache {
+	spinlock_t lock;
+	struct iova_magazine *loaded;
+	struct iova_magazine *prev;
+};
+
+static struct iova_magazine *iova_magazine_alloc(gfp_t flags)
+{
+	return kzalloc(sizeof(struct iova_magazine), flags);
+}
+
+static void iova_magazine_free(struct iova_magazine *mag)
+{
+	kfree(mag);
+}
+
+/* Give the cached ranges of @mag back to the rbtree */
+static void
+iova_magazine_free_iovas(struct iova_magazine *mag, struct iova_domain *iovad)
+{
+	unsigned long flags;
+	int i;
+
+	if (!mag)
+		return;
+
+	spin_lock_irqsave(&iovad->iova_rbtree_lock, flags);
+	for (i = 0 ; i < mag->size; ++i) {
+		struct iova *iova = mag->iovas[i];
+
+		__cached_rbnode_delete_update(iovad, iova);
+		rb_erase(&iova->node, &iovad->rbroot);
+		free_iova_mem(iova);
+	}
+	spin_unlock_irqrestore(&iovad->iova_rbtree_lock, flags);
+
+	mag->size = 0;
+}
+
+static bool iova_magazine_full(struct iova_magazine *mag)
+{
+	return mag->size == IOVA_MAG_SIZE;
+}
+
+static bool iova_magazine_empty(struct iova_magazine *mag)
+{
+	return !mag || mag->size == 0;
+}
+
+static struct iova *iova_magazine_pop(struct iova_magazine *mag,
+				      unsigned long limit_pfn)
+{
+	struct iova *iova;
+
+	BUG_ON(iova_magazine_empty(mag));
+
+	iova = mag->iovas[mag->size - 1];
+	if (iova->pfn_hi > limit_pfn)
+		return NULL;
+
+	mag->size--;
+	ACCESS_ONCE(iova->cached) = false;
+	return iova;
+}
+
+static void iova_magazine_push(struct iova_magazine *mag, struct iova *iova)
+{
+	BUG_ON(iova_magazine_full(mag));
+
+	ACCESS_ONCE(iova->cached) = true;
+	mag->iovas[mag->size++] = iova;
+}
+
+static void init_iova_rcaches(struct iova_domain *iovad)
+{
+	struct iova_cpu_rcache *cpu_rcache;
+	struct iova_rcache *rcache;
+	unsigned int cpu;
+	int i;
+
+	for (i = 0; i < IOVA_RANGE_CACHE_MAX_SIZE; ++i) {
+		rcache = &iovad->rcaches[i];
+		spin_lock_init(&rcache->lock);
+		rcache->depot_size = 0;
+		/* without the per-cpu caches, this size just isn't cached */
+		rcache->cpu_rcaches = alloc_percpu(struct iova_cpu_rcache);
+		if (!rcache->cpu_rcaches)
+			continue;
+		for_each_possible_cpu(cpu) {
+			cpu_rcache = per_cpu_ptr(rcache->cpu_rcaches, cpu);
+			spin_lock_init(&cpu_rcache->lock);
+			cpu_rcache->loaded = NULL;
+			cpu_rcache->prev = NULL;
+		}
+	}
+}
+
+/*
+ * Try inserting the IOVA range 'iova' into 'rcache', and return true on
+ * success.  Can fail if rcache is full and we can't free space, and
+ * __free_iova() will then return the IOVA range to the rbtree instead.
+ */
+static bool __iova_rcache_insert(struct iova_domain *iovad,
+				 struct iova_rcache *rcache,
+				 struct iova *iova)
+{
+	struct iova_magazine *mag_to_free = NULL;
+	struct iova_cpu_rcache *cpu_rcache;
+	bool can_insert = false;
+	unsigned long flags;
+
+	cpu_rcache = get_cpu_ptr(rcache->cpu_rcaches);
+	spin_lock_irqsave(&cpu_rcache->lock, flags);
+
+	if (cpu_rcache->loaded && !iova_magazine_full(cpu_rcache->loaded)) {
+		can_insert = true;
+	} else if (cpu_rcache->prev && !iova_magazine_full(cpu_rcache->prev)) {
+		swap(cpu_rcache->prev, cpu_rcache->loaded);
+		can_insert = true;
+	} else {
+		struct iova_magazine *new_mag = iova_magazine_alloc(GFP_ATOMIC);
+
+		if (new_mag) {
+			if (!cpu_rcache->prev) {
+				cpu_rcache->prev = cpu_rcache->loaded;
+			} else {
+				/* both magazines are full */
+				spin_lock(&rcache->lock);
+				if (rcache->depot_size < MAX_GLOBAL_MAGS)
+					rcache->depot[rcache->depot_size++] =
+							cpu_rcache->loaded;
+				else
+					mag_to_free = cpu_rcache->loaded;
+				spin_unlock(&rcache->lock);
+			}
+
+			cpu_rcache->loaded = new_mag;
+			can_insert = true;
+		}
+	}
+
+	if (can_insert)
+		iova_magazine_push(cpu_rcache->loaded, iova);
+
+	spin_unlock_irqrestore(&cpu_rcache->lock, flags);
+	put_cpu_ptr(rcache->cpu_rcaches);
+
+	if (mag_to_free) {
+		iova_magazine_free_iovas(mag_to_free, iovad);
+		iova_magazine_free(mag_to_free);
+	}
+
+	return can_insert;
+}
+
+static bool iova_rcache_insert(struct iova_domain *iovad, struct iova *iova)
+{
+	unsigned long size = iova_size(iova);
+	unsigned int log_size = order_base_2(size);
+
+	/* only cache the ranges alloc_iova() can hand out for size_aligned */
+	if (log_size >= IOVA_RANGE_CACHE_MAX_SIZE || !is_power_of_2(size) ||
+	    (iova->pfn_lo & (size - 1)))
+		return false;
+
+	if (!iovad->rcaches[log_size].cpu_rcaches)
+		return false;
+
+	return __iova_rcache_insert(iovad, &iovad->rcaches[log_size], iova);
+}
+
+/*
+ * Caller wants to allocate a new IOVA range from 'rcache'.  If we can
+ * satisfy the request, return a matching non-NULL range and remove
+ * it from the 'rcache'.
+ */
+static struct iova *__iova_rcache_get(struct iova_rcache *rcache,
+				      unsigned long limit_pfn)
+{
+	struct iova_cpu_rcache *cpu_rcache;
+	struct iova *iova = NULL;
+	bool has_iova = false;
+	unsigned long flags;
+
+	cpu_rcache = get_cpu_ptr(rcache->cpu_rcaches);
+	spin_lock_irqsave(&cpu_rcache->lock, flags);
+
+	if (!iova_magazine_empty(cpu_rcache->loaded)) {
+		has_iova = true;
+	} else if (!iova_magazine_empty(cpu_rcache->prev)) {
+		swap(cpu_rcache->prev, cpu_rcache->loaded);
+		has_iova = true;
+	} else {
+		spin_lock(&rcache->lock);
+		if (rcache->depot_size > 0) {
+			iova_magazine_free(cpu_rcache->loaded);
+			cpu_rcache->loaded = rcache->depot[--rcache->depot_size];
+			has_iova = true;
+		}
+		spin_unlock(&rcache->lock);
+	}
+
+	if (has_iova)
+		iova = iova_magazine_pop(cpu_rcache->loaded, limit_pfn);
+
+	spin_unlock_irqrestore(&cpu_rcache->lock, flags);
+	put_cpu_ptr(rcache->cpu_rcaches);
+
+	return iova;
+}
+
+/*
+ * Try to satisfy IOVA allocation range from rcache.  Fail if requested
+ * size is too big or the DMA limit we are given isn't satisfied by the
+ * top element in the magazine.
+ */
+static struct iova *iova_rcache_get(struct iova_domain *iovad,
+				    unsigned long size,
+				    unsigned long limit_pfn)
+{
+	unsigned int log_size = order_base_2(size);
+
+	if (log_size >= IOVA_RANGE_CACHE_MAX_SIZE)
+		return NULL;
+
+	if (!iovad->rcaches[log_size].cpu_rcaches)
+		return NULL;
+
+	return __iova_rcache_get(&iovad->rcaches[log_size], limit_pfn);
+}
+
+/*
+ * Give all the cached ranges of the domain back to the rbtree.
+ */
+static void free_cached_iovas(struct iova_domain *iovad)
+{
+	struct iova_cpu_rcache *cpu_rcache;
+	struct iova_rcache *rcache;
+	unsigned long flags;
+	unsigned int cpu;
+	int i, j;
+
+	for (i = 0; i < IOVA_RANGE_CACHE_MAX_SIZE; ++i) {
+		rcache = &iovad->rcaches[i];
+		if (!rcache->cpu_rcaches)
+			continue;
+
+		for_each_possible_cpu(cpu) {
+			cpu_rcache = per_cpu_ptr(rcache->cpu_rcaches, cpu);
+			spin_lock_irqsave(&cpu_rcache->lock, flags);
+			iova_magazine_free_iovas(cpu_rcache->loaded, iovad);
+			iova_magazine_free_iovas(cpu_rcache->prev, iovad);
+			spin_unlock_irqrestore(&cpu_rcache->lock, flags);
+		}
+
+		spin_lock_irqsave(&rcache->lock, flags);
+		for (j = 0; j < rcache->depot_size; ++j) {
+			iova_magazine_free_iovas(rcache->depot[j], iovad);
+			iova_magazine_free(rcache->depot[j]);
+		}
+		rcache->depot_size = 0;
+		spin_unlock_irqrestore(&rcache->lock, flags);
+	}
+}
+
+/*
+ * Free the magazines of the domain. The cached iovas are still in the
+ * rbtree and are freed along with it.
+ */
+static void free_iova_rcaches(struct iova_domain *iovad)
+{
+	struct iova_cpu_rcache *cpu_rcache;
+	struct iova_rcache *rcache;
+	unsigned int cpu;
+	int i, j;
+
+	for (i = 0; i < IOVA_RANGE_CACHE_MAX_SIZE; ++i) {
+		rcache = &iovad->rcaches[i];
+		if (!rcache->cpu_rcaches)
+			continue;
+
+		for_each_possible_cpu(cpu) {
+			cpu_rcache = per_cpu_ptr(rcache->cpu_rcaches, cpu);
+			iova_magazine_free(cpu_rcache->loaded);
+			iova_magazine_free(cpu_rcache->prev);
+		}
+		free_percpu(rcache->cpu_rcaches);
+		rcache->cpu_rcaches = NULL;
+
+		for (j = 0; j < rcache->depot_size; ++j)
+			iova_magazine_free(rcache->depot[j]);
+		rcache->depot_size = 0;
+	}
+}
@@ -0,0 +1,157 @@
+/*
+ * iova allocator throughput benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Modelled after ring_buffer_benchmark.c: one thread is bound to each
+ * online CPU, and all of them map and unmap size aligned ranges of 1 to
+ * IOVA_BENCH_MAX_PAGES pages in the same iova domain for RUN_TIME seconds,
+ * keeping IOVA_BENCH_BATCH of them live at a time, like a driver with a
+ * queue of DMA buffers. Each thread then reports its throughput and sleeps
+ * for SLEEP_TIME seconds.
+ */
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/iova.h>
+#include <linux/dma_remapping.h>
+
+/* run time and sleep time in seconds */
+#define RUN_TIME	10
+#define SLEEP_TIME	10
+
+#define IOVA_BENCH_BATCH	16
+#define IOVA_BENCH_MAX_PAGES	8
+
+static struct iova_domain iova_bench_domain;
+static unsigned long iova_bench_32bit_pfn;
+static struct task_struct **workers;
+static int nr_workers;
+
+static void iova_bench_run(int cpu)
+{
+	struct iova *iovas[IOVA_BENCH_BATCH] = { NULL };
+	unsigned long ops = 0, failed = 0;
+	ktime_t start, end;
+	s64 ns;
+	int i;
+
+	start = ktime_get();
+	end = ktime_add_ns(start, (u64)RUN_TIME * NSEC_PER_SEC);
+
+	for (;;) {
+		i = ops % IOVA_BENCH_BATCH;
+		if (iovas[i])
+			__free_iova(&iova_bench_domain, iovas[i]);
+
+		iovas[i] = alloc_iova(&iova_bench_domain,
+				      1 << (ops % ilog2(IOVA_BENCH_MAX_PAGES * 2)),
+				      iova_bench_32bit_pfn, true);
+		if (!iovas[i])
+			failed++;
+		ops++;
+
+		/* check the time and give others a chance every 1000 ops */
+		if (!(ops % 1000)) {
+			if (kthread_should_stop() ||
+			    !ktime_before(ktime_get(), end))
+				break;
+			cond_resched();
+		}
+	}
+
+	for (i = 0; i < IOVA_BENCH_BATCH; i++)
+		if (iovas[i])
+			__free_iova(&iova_bench_domain, iovas[i]);
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	pr_info("iova_benchmark: cpu %d: %lu map+unmap in %lld ms, %lld ns/op, %lu failed\n",
+		cpu, ops, ns / NSEC_PER_MSEC, ops ? div64_s64(ns, ops) : 0,
+		failed);
+}
+
+static int iova_bench_thread(void *arg)
+{
+	int cpu = (long)arg;
+
+	while (!kthread_should_stop()) {
+		iova_bench_run(cpu);
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule_timeout(HZ * SLEEP_TIME);
+		__set_current_state(TASK_RUNNING);
+	}
+
+	return 0;
+}
+
+static void iova_bench_stop(void)
+{
+	int i;
+
+	for (i = 0; i < nr_workers; i++)
+		kthread_stop(workers[i]);
+	nr_workers = 0;
+}
+
+static int __init iova_benchmark_init(void)
+{
+	struct task_struct *worker;
+	int cpu, i;
+	int ret;
+
+	/* the iova structs come from the intel-iommu cache */
+	if (!intel_iommu_enabled) {
+		pr_info("iova_benchmark: intel-iommu is not enabled\n");
+		return 0;
+	}
+
+	iova_bench_32bit_pfn = DMA_BIT_MASK(32) >> PAGE_SHIFT;
+	init_iova_domain(&iova_bench_domain, iova_bench_32bit_pfn);
+
+	workers = kcalloc(nr_cpu_ids, sizeof(*workers), GFP_KERNEL);
+	if (!workers) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		worker = kthread_create(iova_bench_thread, (void *)(long)cpu,
+					"iova_bench/%d", cpu);
+		if (IS_ERR(worker)) {
+			put_online_cpus();
+			ret = PTR_ERR(worker);
+			goto out_stop;
+		}
+
+		kthread_bind(worker, cpu);
+		workers[nr_workers++] = worker;
+	}
+	put_online_cpus();
+
+	for (i = 0; i < nr_workers; i++)
+		wake_up_process(workers[i]);
+
+	return 0;
+
+out_stop:
+	iova_bench_stop();
+	kfree(workers);
+	workers = NULL;
+out_free:
+	put_iova_domain(&iova_bench_domain);
+	return ret;
+}
+late_initcall(iova_benchmark_init);
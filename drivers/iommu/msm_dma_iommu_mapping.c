@@ -12,10 +12,15 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/kref.h>
 #include <linux/slab.h>
-#include <linux/rbtree.h>
+#include <linux/hashtable.h>
+#include <linux/rcupdate.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/iommu.h>
 #include <linux/err.h>
 
 #include <linux/msm_dma_iommu_mapping.h>
@@ -23,6 +28,7 @@
 /**
  * struct msm_iommu_map - represents a mapping of an ion buffer to an iommu
  * @lnode - list node to exist in the buffer's list of iommu mappings
+ * @lru - node in the global LRU of lazily unmapped mappings
  * @dev - Device this is mapped to. Used as key
  * @sgl - The scatterlist for this mapping
  * @nents - Number of entries in sgl
@@ -36,7 +42,7 @@
  */
 struct msm_iommu_map {
 	struct list_head lnode;
-	struct rb_node node;
+	struct list_head lru;
 	struct device *dev;
 	struct scatterlist sgl;
 	unsigned int nents;
@@ -45,63 +51,82 @@ struct msm_iommu_map {
 	struct kref ref;
 };
 
+/**
+ * struct msm_iommu_meta - the iommu mappings of one ion buffer
+ * @hnode - node in msm_iommu_meta_hash, keyed on @buffer
+ * @iommu_maps - list of msm_iommu_map, protected by @lock
+ * @ref - for reference counting this meta
+ * @lock - serializes map/unmap of this buffer
+ * @buffer - the ion buffer (dma_buf->priv) this meta describes
+ * @rcu - for freeing this meta after a grace period
+ *
+ * Lookups walk msm_iommu_meta_hash under RCU and only succeed if they can
+ * take a reference, so different buffers never contend on a common lock.
+ * Insertion and removal from the hash are serialized by
+ * msm_iommu_meta_lock.
+ */
 struct msm_iommu_meta {
-	struct rb_node node;
+	struct hlist_node hnode;
 	struct list_head iommu_maps;
 	struct kref ref;
 	struct mutex lock;
 	void *buffer;
+	struct rcu_head rcu;
 };
 
-static struct rb_root iommu_root;
-static DEFINE_MUTEX(msm_iommu_map_mutex);
+#define MSM_IOMMU_META_HASH_BITS 8
+
+static DEFINE_HASHTABLE(msm_iommu_meta_hash, MSM_IOMMU_META_HASH_BITS);
+static DEFINE_SPINLOCK(msm_iommu_meta_lock);
+
+/*
+ * Mappings kept alive only for lazy unmapping sit on this list in least
+ * recently used order. Once there are more than lazy_map_limit of them the
+ * oldest idle one is really unmapped.
+ */
+static LIST_HEAD(msm_iommu_lru);
+static DEFINE_SPINLOCK(msm_iommu_lru_lock);
+static unsigned int msm_iommu_lru_count;
+
+static unsigned int lazy_map_limit = 1024;
+module_param(lazy_map_limit, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(lazy_map_limit,
+		 "Max lazily unmapped buffers kept mapped, 0 for no limit");
+
+static atomic_t lazy_map_hits = ATOMIC_INIT(0);
+static atomic_t lazy_map_misses = ATOMIC_INIT(0);
+static atomic_t lazy_map_evictions = ATOMIC_INIT(0);
+static atomic_t lazy_map_cached = ATOMIC_INIT(0);
 
-static void msm_iommu_meta_add(struct msm_iommu_meta *meta)
+static struct dentry *msm_dma_iommu_mapping_top;
+
+static struct msm_iommu_meta *__msm_iommu_meta_lookup(void *buffer)
 {
-	struct rb_root *root = &iommu_root;
-	struct rb_node **p = &root->rb_node;
-	struct rb_node *parent = NULL;
 	struct msm_iommu_meta *entry;
 
-	while (*p) {
-		parent = *p;
-		entry = rb_entry(parent, struct msm_iommu_meta, node);
-
-		if (meta->buffer < entry->buffer) {
-			p = &(*p)->rb_left;
-		} else if (meta->buffer > entry->buffer) {
-			p = &(*p)->rb_right;
-		} else {
-			pr_err("%s: dma_buf %p already exists\n", __func__,
-				entry->buffer);
-			BUG();
-		}
+	hash_for_each_possible_rcu(msm_iommu_meta_hash, entry, hnode,
+				   (unsigned long)buffer) {
+		if (entry->buffer == buffer &&
+		    kref_get_unless_zero(&entry->ref))
+			return entry;
 	}
 
-	rb_link_node(&meta->node, parent, p);
-	rb_insert_color(&meta->node, root);
+	return NULL;
 }
 
+/*
+ * Returns the meta of @buffer with a reference held, or NULL. A meta whose
+ * last reference is already gone is treated as absent.
+ */
 static struct msm_iommu_meta *msm_iommu_meta_lookup(void *buffer)
 {
-	struct rb_root *root = &iommu_root;
-	struct rb_node **p = &root->rb_node;
-	struct rb_node *parent = NULL;
-	struct msm_iommu_meta *entry = NULL;
-
-	while (*p) {
-		parent = *p;
-		entry = rb_entry(parent, struct msm_iommu_meta, node);
-
-		if (buffer < entry->buffer)
-			p = &(*p)->rb_left;
-		else if (buffer > entry->buffer)
-			p = &(*p)->rb_right;
-		else
-			return entry;
-	}
+	struct msm_iommu_meta *entry;
 
-	return NULL;
+	rcu_read_lock();
+	entry = __msm_iommu_meta_lookup(buffer);
+	rcu_read_unlock();
+
+	return entry;
 }
 
 static void msm_iommu_add(struct msm_iommu_meta *meta,
@@ -117,6 +142,7 @@ static void msm_iommu_add(struct msm_iommu_meta *meta,
 		}
 	}
 	INIT_LIST_HEAD(&iommu->lnode);
+	INIT_LIST_HEAD(&iommu->lru);
 	list_add(&iommu->lnode, &meta->iommu_maps);
 }
 
@@ -134,9 +160,14 @@ static struct msm_iommu_map *msm_iommu_lookup(struct msm_iommu_meta *meta,
 	return NULL;
 }
 
-static struct msm_iommu_meta *msm_iommu_meta_create(struct dma_buf *dma_buf)
+/*
+ * Create the meta of @dma_buf, unless another mapper raced us to it in which
+ * case that one is returned with a reference held and @created is false.
+ */
+static struct msm_iommu_meta *msm_iommu_meta_create(struct dma_buf *dma_buf,
+						    bool *created)
 {
-	struct msm_iommu_meta *meta;
+	struct msm_iommu_meta *meta, *entry;
 
 	meta = kzalloc(sizeof(*meta), GFP_KERNEL);
 
@@ -147,13 +178,114 @@ static struct msm_iommu_meta *msm_iommu_meta_create(struct dma_buf *dma_buf)
 	meta->buffer = dma_buf->priv;
 	kref_init(&meta->ref);
 	mutex_init(&meta->lock);
-	msm_iommu_meta_add(meta);
 
+	spin_lock(&msm_iommu_meta_lock);
+	entry = __msm_iommu_meta_lookup(meta->buffer);
+	if (entry) {
+		spin_unlock(&msm_iommu_meta_lock);
+		kfree(meta);
+		*created = false;
+		return entry;
+	}
+	hash_add_rcu(msm_iommu_meta_hash, &meta->hnode,
+		     (unsigned long)meta->buffer);
+	spin_unlock(&msm_iommu_meta_lock);
+
+	*created = true;
 	return meta;
 }
 
 static void msm_iommu_meta_put(struct msm_iommu_meta *meta);
 
+static void msm_iommu_lru_add(struct msm_iommu_map *iommu_map)
+{
+	spin_lock(&msm_iommu_lru_lock);
+	list_add_tail(&iommu_map->lru, &msm_iommu_lru);
+	msm_iommu_lru_count++;
+	spin_unlock(&msm_iommu_lru_lock);
+	atomic_inc(&lazy_map_cached);
+}
+
+static void msm_iommu_lru_touch(struct msm_iommu_map *iommu_map)
+{
+	spin_lock(&msm_iommu_lru_lock);
+	if (!list_empty(&iommu_map->lru))
+		list_move_tail(&iommu_map->lru, &msm_iommu_lru);
+	spin_unlock(&msm_iommu_lru_lock);
+}
+
+static void msm_iommu_lru_del(struct msm_iommu_map *iommu_map)
+{
+	bool cached;
+
+	spin_lock(&msm_iommu_lru_lock);
+	cached = !list_empty(&iommu_map->lru);
+	if (cached) {
+		list_del_init(&iommu_map->lru);
+		msm_iommu_lru_count--;
+	}
+	spin_unlock(&msm_iommu_lru_lock);
+
+	if (cached)
+		atomic_dec(&lazy_map_cached);
+}
+
+static void msm_iommu_map_release(struct kref *kref);
+
+/*
+ * Drop the lazy unmap reference of the least recently used mapping that
+ * nobody is using anymore, if there are more than lazy_map_limit of them.
+ * A mapping on the LRU holds only the lazy reference when its refcount is
+ * one, and that count only changes under its meta's lock, so the check is
+ * stable once the lock is held. Busy metas are skipped rather than waited
+ * for since we cannot sleep under msm_iommu_lru_lock.
+ */
+static void msm_iommu_lru_evict(void)
+{
+	struct msm_iommu_map *iommu_map, *victim = NULL;
+	struct msm_iommu_meta *meta = NULL;
+	unsigned int limit = ACCESS_ONCE(lazy_map_limit);
+
+	if (!limit)
+		return;
+
+	rcu_read_lock();
+	spin_lock(&msm_iommu_lru_lock);
+	if (msm_iommu_lru_count <= limit)
+		goto out_unlock;
+
+	list_for_each_entry(iommu_map, &msm_iommu_lru, lru) {
+		meta = iommu_map->meta;
+
+		if (atomic_read(&iommu_map->ref.refcount) != 1)
+			continue;
+		if (!mutex_trylock(&meta->lock))
+			continue;
+		if (atomic_read(&iommu_map->ref.refcount) != 1 ||
+		    !kref_get_unless_zero(&meta->ref)) {
+			mutex_unlock(&meta->lock);
+			continue;
+		}
+
+		list_del_init(&iommu_map->lru);
+		msm_iommu_lru_count--;
+		victim = iommu_map;
+		break;
+	}
+out_unlock:
+	spin_unlock(&msm_iommu_lru_lock);
+	rcu_read_unlock();
+
+	if (!victim)
+		return;
+
+	atomic_dec(&lazy_map_cached);
+	atomic_inc(&lazy_map_evictions);
+	kref_put(&victim->ref, msm_iommu_map_release);
+	mutex_unlock(&meta->lock);
+	msm_iommu_meta_put(meta);
+}
+
 static inline int __msm_dma_map_sg(struct device *dev, struct scatterlist *sg,
 				   int nents, enum dma_data_direction dir,
 				   struct dma_buf *dma_buf,
@@ -163,29 +295,24 @@ static inline int __msm_dma_map_sg(struct device *dev, struct scatterlist *sg,
 	struct msm_iommu_meta *iommu_meta = NULL;
 	int ret = 0;
 	bool extra_meta_ref_taken = false;
+	bool created;
 	int late_unmap = !dma_get_attr(DMA_ATTR_NO_DELAYED_UNMAP, attrs);
 
-	mutex_lock(&msm_iommu_map_mutex);
 	iommu_meta = msm_iommu_meta_lookup(dma_buf->priv);
 
 	if (!iommu_meta) {
-		iommu_meta = msm_iommu_meta_create(dma_buf);
+		iommu_meta = msm_iommu_meta_create(dma_buf, &created);
 
 		if (IS_ERR(iommu_meta)) {
-			mutex_unlock(&msm_iommu_map_mutex);
 			ret = PTR_ERR(iommu_meta);
 			goto out;
 		}
-		if (late_unmap) {
+		if (created && late_unmap) {
 			kref_get(&iommu_meta->ref);
 			extra_meta_ref_taken = true;
 		}
-	} else {
-		kref_get(&iommu_meta->ref);
 	}
 
-	mutex_unlock(&msm_iommu_map_mutex);
-
 	mutex_lock(&iommu_meta->lock);
 	iommu_map = msm_iommu_lookup(iommu_meta, dev);
 	if (!iommu_map) {
@@ -208,14 +335,21 @@ static inline int __msm_dma_map_sg(struct device *dev, struct scatterlist *sg,
 		iommu_map->meta = iommu_meta;
 		iommu_map->sgl.dma_address = sg->dma_address;
 		iommu_map->sgl.dma_length = sg->dma_length;
+		iommu_map->nents = nents;
+		iommu_map->dir = dir;
 		iommu_map->dev = dev;
 		msm_iommu_add(iommu_meta, iommu_map);
+		if (late_unmap)
+			msm_iommu_lru_add(iommu_map);
+		atomic_inc(&lazy_map_misses);
 
 	} else {
 		sg->dma_address = iommu_map->sgl.dma_address;
 		sg->dma_length = iommu_map->sgl.dma_length;
 
 		kref_get(&iommu_map->ref);
+		msm_iommu_lru_touch(iommu_map);
+		atomic_inc(&lazy_map_hits);
 		/*
 		 * Need to do cache operations here based on "dir" in the
 		 * future if we go with coherent mappings.
@@ -223,6 +357,9 @@ static inline int __msm_dma_map_sg(struct device *dev, struct scatterlist *sg,
 		ret = nents;
 	}
 	mutex_unlock(&iommu_meta->lock);
+
+	if (late_unmap)
+		msm_iommu_lru_evict();
 	return ret;
 
 out_unlock:
@@ -272,23 +409,29 @@ static void msm_iommu_meta_destroy(struct kref *kref)
 {
 	struct msm_iommu_meta *meta = container_of(kref, struct msm_iommu_meta,
 						ref);
+	struct msm_iommu_map *iommu_map;
 
 	if (!list_empty(&meta->iommu_maps)) {
 		WARN(1, "%s: DMA Buffer %p being destroyed with outstanding iommu mappins!\n", __func__,
 			meta->buffer);
+		/* the LRU must not point at this meta once it is freed */
+		list_for_each_entry(iommu_map, &meta->iommu_maps, lnode)
+			msm_iommu_lru_del(iommu_map);
 	}
-	rb_erase(&meta->node, &iommu_root);
-	kfree(meta);
+
+	spin_lock(&msm_iommu_meta_lock);
+	hash_del_rcu(&meta->hnode);
+	spin_unlock(&msm_iommu_meta_lock);
+	kfree_rcu(meta, rcu);
 }
 
 static void msm_iommu_meta_put(struct msm_iommu_meta *meta)
 {
 	/*
-	 * Need to lock here to prevent race against map/unmap
+	 * Lookups only take a reference while it is non-zero, so the meta
+	 * can be unhashed after the final put without a lock around it.
 	 */
-	mutex_lock(&msm_iommu_map_mutex);
 	kref_put(&meta->ref, msm_iommu_meta_destroy);
-	mutex_unlock(&msm_iommu_map_mutex);
 }
 
 static void msm_iommu_map_release(struct kref *kref)
@@ -297,6 +440,7 @@ static void msm_iommu_map_release(struct kref *kref)
 						ref);
 
 	list_del(&map->lnode);
+	msm_iommu_lru_del(map);
 	dma_unmap_sg(map->dev, &map->sgl, map->nents, map->dir);
 	kfree(map);
 }
@@ -307,15 +451,12 @@ void msm_dma_unmap_sg(struct device *dev, struct scatterlist *sgl, int nents,
 	struct msm_iommu_map *iommu_map;
 	struct msm_iommu_meta *meta;
 
-	mutex_lock(&msm_iommu_map_mutex);
 	meta = msm_iommu_meta_lookup(dma_buf->priv);
 	if (!meta) {
 		WARN(1, "%s: (%p) was never mapped\n", __func__, dma_buf);
-		mutex_unlock(&msm_iommu_map_mutex);
 		goto out;
 
 	}
-	mutex_unlock(&msm_iommu_map_mutex);
 
 	mutex_lock(&meta->lock);
 	iommu_map = msm_iommu_lookup(meta, dev);
@@ -324,6 +465,7 @@ void msm_dma_unmap_sg(struct device *dev, struct scatterlist *sgl, int nents,
 		WARN(1, "%s: (%p) was never mapped for device  %p\n", __func__,
 				dma_buf, dev);
 		mutex_unlock(&meta->lock);
+		msm_iommu_meta_put(meta);
 		goto out;
 	}
 
@@ -338,6 +480,8 @@ void msm_dma_unmap_sg(struct device *dev, struct scatterlist *sgl, int nents,
 	kref_put(&iommu_map->ref, msm_iommu_map_release);
 	mutex_unlock(&meta->lock);
 
+	/* drop the lookup reference and the one taken at map time */
+	msm_iommu_meta_put(meta);
 	msm_iommu_meta_put(meta);
 
 out:
@@ -353,15 +497,12 @@ void msm_dma_buf_freed(void *buffer)
 	struct msm_iommu_map *iommu_map_next;
 	struct msm_iommu_meta *meta;
 
-	mutex_lock(&msm_iommu_map_mutex);
 	meta = msm_iommu_meta_lookup(buffer);
 	if (!meta) {
 		/* Already unmapped (assuming no late unmapping) */
-		mutex_unlock(&msm_iommu_map_mutex);
 		goto out;
 
 	}
-	mutex_unlock(&msm_iommu_map_mutex);
 
 	mutex_lock(&meta->lock);
 
@@ -372,14 +513,59 @@ void msm_dma_buf_freed(void *buffer)
 	if (!list_empty(&meta->iommu_maps)) {
 		WARN(1, "%s: DMA Buffer %p being destroyed with outstanding iommu mappins!\n", __func__,
 			meta->buffer);
+		/*
+		 * The meta is freed below, so the leftover maps must leave the
+		 * LRU and stop pointing at its list before it goes.
+		 */
+		list_for_each_entry_safe(iommu_map, iommu_map_next,
+					 &meta->iommu_maps, lnode) {
+			msm_iommu_lru_del(iommu_map);
+			list_del_init(&iommu_map->lnode);
+		}
 	}
 
 	INIT_LIST_HEAD(&meta->iommu_maps);
 	mutex_unlock(&meta->lock);
 
+	/* drop the lookup reference and the lazy unmap one */
+	msm_iommu_meta_put(meta);
 	msm_iommu_meta_put(meta);
 out:
 	return;
 
 }
 
+static int msm_dma_iommu_mapping_init(void)
+{
+	msm_dma_iommu_mapping_top = debugfs_create_dir("msm_dma_iommu_mapping",
+						       iommu_debugfs_top);
+	if (!msm_dma_iommu_mapping_top)
+		return -ENODEV;
+
+	if (!debugfs_create_atomic_t("lazy_map_hits", 0400,
+				     msm_dma_iommu_mapping_top,
+				     &lazy_map_hits) ||
+	    !debugfs_create_atomic_t("lazy_map_misses", 0400,
+				     msm_dma_iommu_mapping_top,
+				     &lazy_map_misses) ||
+	    !debugfs_create_atomic_t("lazy_map_evictions", 0400,
+				     msm_dma_iommu_mapping_top,
+				     &lazy_map_evictions) ||
+	    !debugfs_create_atomic_t("lazy_map_cached", 0400,
+				     msm_dma_iommu_mapping_top,
+				     &lazy_map_cached)) {
+		debugfs_remove_recursive(msm_dma_iommu_mapping_top);
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
+static void msm_dma_iommu_mapping_exit(void)
+{
+	debugfs_remove_recursive(msm_dma_iommu_mapping_top);
+}
+
+module_init(msm_dma_iommu_mapping_init);
+module_exit(msm_dma_iommu_mapping_exit);
+
@@ -23,6 +23,7 @@
 #include <linux/atomic.h>
 #include <linux/scatterlist.h>
 #include <linux/rbtree.h>
+#include <linux/percpu.h>
 #include <asm/page.h>
 #include <asm/unaligned.h>
 #include <crypto/hash.h>
@@ -112,7 +113,19 @@ struct iv_tcw_private {
  * and encrypts / decrypts at the same time.
  */
 enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID,
-	     DM_CRYPT_SAME_CPU, DM_CRYPT_NO_OFFLOAD };
+	     DM_CRYPT_SAME_CPU, DM_CRYPT_NO_OFFLOAD,
+	     DM_CRYPT_PCPU_PAGES };
+
+/*
+ * Per-CPU stash of write bounce pages, preallocated when the
+ * "percpu_bounce_pages" feature is set, enough for one 256KB write.
+ */
+#define DM_CRYPT_PCPU_NR_PAGES	64
+
+struct crypt_page_cache {
+	unsigned int nr;
+	struct page *pages[DM_CRYPT_PCPU_NR_PAGES];
+};
 
 /*
  * The fields in here must be read only after initialization.
@@ -127,6 +140,7 @@ struct crypt_config {
 	 */
 	mempool_t *req_pool;
 	mempool_t *page_pool;
+	struct crypt_page_cache __percpu *page_cache;
 	struct bio_set *bs;
 	struct mutex bio_alloc_lock;
 
@@ -953,6 +967,85 @@ static int crypt_convert(struct crypt_config *cc,
 
 static void crypt_free_buffer_pages(struct crypt_config *cc, struct bio *clone);
 
+static struct page *crypt_page_cache_get(struct crypt_config *cc)
+{
+	struct crypt_page_cache *pc;
+	struct page *page = NULL;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pc = this_cpu_ptr(cc->page_cache);
+	if (pc->nr)
+		page = pc->pages[--pc->nr];
+	local_irq_restore(flags);
+
+	return page;
+}
+
+/*
+ * Bounce pages are freed from bio completion, so the stash is protected by
+ * disabling interrupts. The mempool reserve is topped up first so that a
+ * writer sleeping in mempool_alloc() cannot be starved by pages parked on
+ * other CPUs.
+ */
+static bool crypt_page_cache_put(struct crypt_config *cc, struct page *page)
+{
+	struct crypt_page_cache *pc;
+	unsigned long flags;
+	bool cached = false;
+
+	if (cc->page_pool->curr_nr < cc->page_pool->min_nr)
+		return false;
+
+	local_irq_save(flags);
+	pc = this_cpu_ptr(cc->page_cache);
+	if (pc->nr < DM_CRYPT_PCPU_NR_PAGES) {
+		pc->pages[pc->nr++] = page;
+		cached = true;
+	}
+	local_irq_restore(flags);
+
+	return cached;
+}
+
+static int crypt_page_cache_create(struct crypt_config *cc)
+{
+	struct crypt_page_cache *pc;
+	struct page *page;
+	int cpu;
+
+	cc->page_cache = alloc_percpu(struct crypt_page_cache);
+	if (!cc->page_cache)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		pc = per_cpu_ptr(cc->page_cache, cpu);
+		while (pc->nr < DM_CRYPT_PCPU_NR_PAGES) {
+			page = alloc_page(GFP_KERNEL | __GFP_HIGHMEM);
+			if (!page)
+				return -ENOMEM;
+			pc->pages[pc->nr++] = page;
+		}
+	}
+
+	return 0;
+}
+
+static void crypt_page_cache_destroy(struct crypt_config *cc)
+{
+	struct crypt_page_cache *pc;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		pc = per_cpu_ptr(cc->page_cache, cpu);
+		while (pc->nr)
+			__free_page(pc->pages[--pc->nr]);
+	}
+
+	free_percpu(cc->page_cache);
+	cc->page_cache = NULL;
+}
+
 /*
  * Generate a new unfragmented bio with the given size
  * This should never violate the device limitations
@@ -992,7 +1085,11 @@ retry:
 	remaining_size = size;
 
 	for (i = 0; i < nr_iovecs; i++) {
-		page = mempool_alloc(cc->page_pool, gfp_mask);
+		page = NULL;
+		if (cc->page_cache)
+			page = crypt_page_cache_get(cc);
+		if (!page)
+			page = mempool_alloc(cc->page_pool, gfp_mask);
 		if (!page) {
 			crypt_free_buffer_pages(cc, clone);
 			bio_put(clone);
@@ -1026,7 +1123,9 @@ static void crypt_free_buffer_pages(struct crypt_config *cc, struct bio *clone)
 
 	bio_for_each_segment_all(bv, clone, i) {
 		BUG_ON(!bv->bv_page);
-		mempool_free(bv->bv_page, cc->page_pool);
+		if (!cc->page_cache ||
+		    !crypt_page_cache_put(cc, bv->bv_page))
+			mempool_free(bv->bv_page, cc->page_pool);
 		bv->bv_page = NULL;
 	}
 }
@@ -1525,6 +1624,8 @@ static void crypt_dtr(struct dm_target *ti)
 	if (cc->bs)
 		bioset_free(cc->bs);
 
+	if (cc->page_cache)
+		crypt_page_cache_destroy(cc);
 	if (cc->page_pool)
 		mempool_destroy(cc->page_pool);
 	if (cc->req_pool)
@@ -1720,7 +1821,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	char dummy;
 
 	static struct dm_arg _args[] = {
-		{0, 3, "Invalid number of feature args"},
+		{0, 4, "Invalid number of feature args"},
 	};
 
 	if (argc < 5) {
@@ -1833,6 +1934,9 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 			else if (!strcasecmp(opt_string, "submit_from_crypt_cpus"))
 				set_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
 
+			else if (!strcasecmp(opt_string, "percpu_bounce_pages"))
+				set_bit(DM_CRYPT_PCPU_PAGES, &cc->flags);
+
 			else {
 				ti->error = "Invalid feature arguments";
 				goto bad;
@@ -1841,6 +1945,12 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	}
 
 	ret = -ENOMEM;
+	if (test_bit(DM_CRYPT_PCPU_PAGES, &cc->flags) &&
+	    crypt_page_cache_create(cc)) {
+		ti->error = "Cannot allocate per-cpu bounce pages";
+		goto bad;
+	}
+
 	cc->io_queue = alloc_workqueue("kcryptd_io",
 				       WQ_HIGHPRI |
 				       WQ_MEM_RECLAIM,
@@ -1940,6 +2050,7 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 		num_feature_args += !!ti->num_discard_bios;
 		num_feature_args += test_bit(DM_CRYPT_SAME_CPU, &cc->flags);
 		num_feature_args += test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
+		num_feature_args += test_bit(DM_CRYPT_PCPU_PAGES, &cc->flags);
 		if (num_feature_args) {
 			DMEMIT(" %d", num_feature_args);
 			if (ti->num_discard_bios)
@@ -1948,6 +2059,8 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 				DMEMIT(" same_cpu_crypt");
 			if (test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags))
 				DMEMIT(" submit_from_crypt_cpus");
+			if (test_bit(DM_CRYPT_PCPU_PAGES, &cc->flags))
+				DMEMIT(" percpu_bounce_pages");
 		}
 
 		break;
@@ -2045,7 +2158,7 @@ static int crypt_iterate_devices(struct dm_target *ti,
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version = {1, 14, 0},
+	.version = {1, 15, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
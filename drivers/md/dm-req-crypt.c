@@ -26,6 +26,8 @@
 #include <linux/scatterlist.h>
 #include <linux/device-mapper.h>
 #include <linux/printk.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
 
 #include <asm/page.h>
 #include <asm/unaligned.h>
@@ -88,6 +90,15 @@ static struct crypto_ablkcipher *tfm;
 static unsigned int encryption_mode;
 static struct ice_crypto_setting *ice_settings;
 
+/* per direction request latency, from map to completion, in us */
+struct req_crypt_lat_stats {
+	u64 count;
+	u64 total_us;
+	u64 max_us;
+};
+static struct req_crypt_lat_stats req_crypt_stats[2];
+static DEFINE_SPINLOCK(req_crypt_stats_lock);
+
 unsigned int num_engines;
 unsigned int num_engines_fde, fde_cursor;
 unsigned int num_engines_pfe, pfe_cursor;
@@ -100,7 +111,8 @@ struct req_dm_crypt_io {
 	struct request *cloned_request;
 	int error;
 	atomic_t pending;
-	struct timespec start_time;
+	ktime_t start_time;
+	int cpu;
 	bool should_encrypt;
 	bool should_decrypt;
 	u32 key_id;
@@ -189,6 +201,23 @@ static  bool req_crypt_should_deccrypt(struct req_dm_crypt_io *req)
 	return should_deccrypt;
 }
 
+static void req_crypt_account_latency(struct req_dm_crypt_io *io)
+{
+	struct req_crypt_lat_stats *stats;
+	unsigned long flags;
+	u64 us;
+
+	us = ktime_us_delta(ktime_get(), io->start_time);
+	stats = &req_crypt_stats[rq_data_dir(io->cloned_request)];
+
+	spin_lock_irqsave(&req_crypt_stats_lock, flags);
+	stats->count++;
+	stats->total_us += us;
+	if (us > stats->max_us)
+		stats->max_us = us;
+	spin_unlock_irqrestore(&req_crypt_stats_lock, flags);
+}
+
 static void req_crypt_inc_pending(struct req_dm_crypt_io *io)
 {
 	atomic_inc(&io->pending);
@@ -259,6 +288,7 @@ static void req_crypt_dec_pending_decrypt(struct req_dm_crypt_io *io)
 	}
 
 	/* Should never get here if io or Clone is NULL */
+	req_crypt_account_latency(io);
 	dm_end_request(clone, error);
 	atomic_dec(&io->pending);
 	mempool_free(io, req_io_pool);
@@ -443,6 +473,7 @@ static void req_cryptd_crypt_read_plain(struct req_dm_crypt_io *io)
 
 	clone = io->cloned_request;
 
+	req_crypt_account_latency(io);
 	dm_end_request(clone, error);
 	mempool_free(io, req_io_pool);
 }
@@ -804,10 +835,18 @@ static void req_cryptd_split_req_queue(struct req_dm_split_req_io *io)
 	queue_work(req_crypt_split_io_queue, &io->work);
 }
 
+/*
+ * req_crypt_queue is per-CPU: writes are queued from req_crypt_map() and
+ * so run on the submitting CPU, reads are sent back to the CPU that mapped
+ * them so their decryption runs where the data is going to be consumed.
+ */
 static void req_cryptd_queue_crypt(struct req_dm_crypt_io *io)
 {
 	INIT_WORK(&io->work, req_cryptd_crypt);
-	queue_work(req_crypt_queue, &io->work);
+	if (cpu_online(io->cpu))
+		queue_work_on(io->cpu, req_crypt_queue, &io->work);
+	else
+		queue_work(req_crypt_queue, &io->work);
 }
 
 /*
@@ -872,6 +911,7 @@ static int req_crypt_endio(struct dm_target *ti, struct request *clone,
 
 	/* If it is for ICE, free up req_io and return */
 	if (encryption_mode == DM_REQ_CRYPT_ENCRYPTION_MODE_TRANSPARENT) {
+		req_crypt_account_latency(req_io);
 		mempool_free(req_io, req_io_pool);
 		err = error;
 		goto submit_request;
@@ -885,6 +925,7 @@ static int req_crypt_endio(struct dm_target *ti, struct request *clone,
 			} else
 				bvec.bv_page = NULL;
 		}
+		req_crypt_account_latency(req_io);
 		mempool_free(req_io, req_io_pool);
 		goto submit_request;
 	} else if (rq_data_dir(clone) == READ) {
@@ -932,6 +973,8 @@ static int req_crypt_map(struct dm_target *ti, struct request *clone,
 	req_io->cloned_request = clone;
 	map_context->ptr = req_io;
 	atomic_set(&req_io->pending, 0);
+	req_io->start_time = ktime_get();
+	req_io->cpu = smp_processor_id();
 
 	if (rq_data_dir(clone) == WRITE)
 		req_io->should_encrypt = req_crypt_should_encrypt(req_io);
@@ -1147,7 +1190,6 @@ static int configure_qcrypto(void)
 		goto exit_err;
 
 	req_crypt_queue = alloc_workqueue("req_cryptd",
-					WQ_UNBOUND |
 					WQ_CPU_INTENSIVE |
 					WQ_MEM_RECLAIM,
 					0);
@@ -1313,6 +1355,36 @@ ctr_exit:
 	return err;
 }
 
+static void req_crypt_status(struct dm_target *ti, status_type_t type,
+			     unsigned status_flags, char *result,
+			     unsigned maxlen)
+{
+	struct req_crypt_lat_stats stats[2];
+	unsigned long flags;
+	unsigned sz = 0;
+	int i;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		spin_lock_irqsave(&req_crypt_stats_lock, flags);
+		memcpy(stats, req_crypt_stats, sizeof(stats));
+		spin_unlock_irqrestore(&req_crypt_stats_lock, flags);
+
+		/* <count> <avg_us> <max_us> for reads, then for writes */
+		for (i = READ; i <= WRITE; i++)
+			DMEMIT("%s%llu %llu %llu", i == READ ? "" : " ",
+			       stats[i].count,
+			       stats[i].count ?
+				div64_u64(stats[i].total_us, stats[i].count) :
+				0, stats[i].max_us);
+		break;
+
+	case STATUSTYPE_TABLE:
+		result[0] = '\0';
+		break;
+	}
+}
+
 static int req_crypt_iterate_devices(struct dm_target *ti,
 				 iterate_devices_callout_fn fn, void *data)
 {
@@ -1332,12 +1404,13 @@ EXPORT_SYMBOL(set_qcrypto_func_dm);
 
 static struct target_type req_crypt_target = {
 	.name   = "req-crypt",
-	.version = {1, 0, 0},
+	.version = {1, 1, 0},
 	.module = THIS_MODULE,
 	.ctr    = req_crypt_ctr,
 	.dtr    = req_crypt_dtr,
 	.map_rq = req_crypt_map,
 	.rq_end_io = req_crypt_endio,
+	.status = req_crypt_status,
 	.iterate_devices = req_crypt_iterate_devices,
 };
 
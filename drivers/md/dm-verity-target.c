@@ -12,6 +12,11 @@
  * hash device. Setting this greatly improves performance when data and hash
  * are on the same disk on different partitions on devices with poor random
  * access behavior.
+ *
+ * In the file "/sys/module/dm_verity/parameters/parallel_blocks" you can set
+ * the smallest number of data blocks hashed by one CPU. The data blocks of
+ * bios with at least twice as many blocks are hashed on several CPUs.
+ * Setting it to 0 disables parallel hashing.
  */
 
 #include "dm-verity.h"
@@ -19,6 +24,7 @@
 
 #include <linux/module.h>
 #include <linux/reboot.h>
+#include <linux/vmalloc.h>
 
 #define DM_MSG_PREFIX			"verity"
 
@@ -32,13 +38,20 @@
 #define DM_VERITY_OPT_LOGGING		"ignore_corruption"
 #define DM_VERITY_OPT_RESTART		"restart_on_corruption"
 #define DM_VERITY_OPT_IGN_ZEROES	"ignore_zero_blocks"
+#define DM_VERITY_OPT_HASH_ONCE		"check_hash_at_most_once"
+
+#define DM_VERITY_DEFAULT_PARALLEL_BLOCKS	64
 
-#define DM_VERITY_OPTS_MAX		(2 + DM_VERITY_OPTS_FEC)
+#define DM_VERITY_OPTS_MAX		(3 + DM_VERITY_OPTS_FEC)
 #define DM_VERITY_MEMORY_DUMP
 static unsigned dm_verity_prefetch_cluster = DM_VERITY_DEFAULT_PREFETCH_SIZE;
 
 module_param_named(prefetch_cluster, dm_verity_prefetch_cluster, uint, S_IRUGO | S_IWUSR);
 
+static unsigned dm_verity_parallel_blocks = DM_VERITY_DEFAULT_PARALLEL_BLOCKS;
+
+module_param_named(parallel_blocks, dm_verity_parallel_blocks, uint, S_IRUGO | S_IWUSR);
+
 struct dm_verity_prefetch_work {
 	struct work_struct work;
 	struct dm_verity *v;
@@ -62,6 +75,50 @@ struct buffer_aux {
 	int hash_verified;
 };
 
+/*
+ * State shared by the works hashing the data blocks of one bio in parallel.
+ * The expected digests are looked up in the hash tree up front, so that the
+ * works only hash data. The blocks which don't match are verified again by
+ * verity_verify_block(), which handles FEC and corruption reporting.
+ */
+struct dm_verity_parallel {
+	struct dm_verity_io *io;
+	atomic_t pending;
+	struct completion done;
+	unsigned long *zero_blocks;
+	unsigned long *failed_blocks;
+	u8 *want_digests;
+};
+
+struct dm_verity_hash_work {
+	struct work_struct work;
+	struct dm_verity_parallel *p;
+	struct bvec_iter iter;	/* data of the first block */
+	unsigned start;		/* first block, relative to io->block */
+	unsigned n_blocks;
+
+	/*
+	 * Two variably-size fields follow this struct, the first one at
+	 * CRYPTO_MINALIGN:
+	 *
+	 * u8 hash_desc[v->shash_descsize];
+	 * u8 real_digest[v->digest_size];
+	 */
+};
+
+#define DM_VERITY_PARALLEL_HDR_SIZE \
+	ALIGN(sizeof(struct dm_verity_parallel), CRYPTO_MINALIGN)
+#define DM_VERITY_HASH_WORK_HDR_SIZE \
+	ALIGN(sizeof(struct dm_verity_hash_work), CRYPTO_MINALIGN)
+
+static inline struct dm_verity_hash_work *
+verity_parallel_work(struct dm_verity_parallel *p, unsigned c,
+		     size_t work_size)
+{
+	return (struct dm_verity_hash_work *)
+		((u8 *)p + DM_VERITY_PARALLEL_HDR_SIZE + c * work_size);
+}
+
 /*
  * Initialize struct buffer_aux for a freshly created buffer.
  */
@@ -333,6 +390,14 @@ static int verity_verify_level(struct dm_verity *v, struct dm_verity_io *io,
 
 	aux = dm_bufio_get_aux_data(buf);
 
+	/*
+	 * The block was verified before it was evicted from dm-bufio, so
+	 * don't walk the tree up to the root again.
+	 */
+	if (!aux->hash_verified && v->verified_hash_blocks &&
+	    test_bit(hash_block - v->hash_start, v->verified_hash_blocks))
+		aux->hash_verified = 1;
+
 	if (!aux->hash_verified) {
 		if (skip_unverified) {
 			r = 1;
@@ -375,6 +440,10 @@ static int verity_verify_level(struct dm_verity *v, struct dm_verity_io *io,
 				goto release_ret_r;
 			}
 		}
+
+		if (aux->hash_verified && v->verified_hash_blocks)
+			set_bit(hash_block - v->hash_start,
+				v->verified_hash_blocks);
 	}
 
 	data += offset;
@@ -476,109 +545,275 @@ static int verity_bv_zero(struct dm_verity *v, struct dm_verity_io *io,
 }
 
 /*
- * Verify one "dm_verity_io" structure.
+ * Verify the data block "block" of one "dm_verity_io" structure, which
+ * starts at io->iter. io->iter is advanced past the block.
  */
-static int verity_verify_io(struct dm_verity_io *io)
+static int verity_verify_block(struct dm_verity_io *io, sector_t block)
 {
 	bool is_zero;
 	struct dm_verity *v = io->v;
 	struct bvec_iter start;
+	struct shash_desc *desc = verity_io_hash_desc(v, io);
+	int r;
 #ifdef DM_VERITY_MEMORY_DUMP
 	struct bvec_iter prev_iter;
 	unsigned todo;
 	struct bio *bio;
 #endif // DM_VERITY_MEMORY_DUMP
 
-	unsigned b;
+	r = verity_hash_for_block(v, io, block, verity_io_want_digest(v, io),
+				  &is_zero);
+	if (unlikely(r < 0))
+		return r;
 
-	for (b = 0; b < io->n_blocks; b++) {
-		int r;
-		struct shash_desc *desc = verity_io_hash_desc(v, io);
+	if (is_zero) {
+		/*
+		 * If we expect a zero block, don't validate, just
+		 * return zeros.
+		 */
+		return verity_for_bv_block(v, io, &io->iter, verity_bv_zero);
+	}
 
-		r = verity_hash_for_block(v, io, io->block + b,
-					  verity_io_want_digest(v, io),
-					  &is_zero);
-		if (unlikely(r < 0))
-			return r;
+	r = verity_hash_init(v, desc);
+	if (unlikely(r < 0))
+		return r;
 
-		if (is_zero) {
-			/*
-			 * If we expect a zero block, don't validate, just
-			 * return zeros.
-			 */
-			r = verity_for_bv_block(v, io, &io->iter,
-						verity_bv_zero);
-			if (unlikely(r < 0))
-				return r;
+	start = io->iter;
+#ifdef DM_VERITY_MEMORY_DUMP
+	prev_iter = io->iter;
+#endif // DM_VERITY_MEMORY_DUMP
 
-			continue;
-		}
+	r = verity_for_bv_block(v, io, &io->iter, verity_bv_hash_update);
+	if (unlikely(r < 0))
+		return r;
 
-		r = verity_hash_init(v, desc);
-		if (unlikely(r < 0))
-			return r;
+	r = verity_hash_final(v, desc, verity_io_real_digest(v, io));
+	if (unlikely(r < 0))
+		return r;
 
-		start = io->iter;
+	if (likely(memcmp(verity_io_real_digest(v, io),
+			  verity_io_want_digest(v, io), v->digest_size) == 0))
+		return 0;
+	else if (verity_fec_decode(v, io, DM_VERITY_BLOCK_TYPE_DATA,
+				   block, NULL, &start) == 0)
+		return 0;
+	else{
 #ifdef DM_VERITY_MEMORY_DUMP
-		prev_iter = io->iter;
+		DMERR("data block %lu is corrupted", (long unsigned int)block);
+		DMERR("iter->sector(%lu), size(%ul), idx(%ul), bvec_done(%ul)",
+			(long unsigned int)(prev_iter.bi_sector), prev_iter.bi_size,
+			prev_iter.bi_idx, prev_iter.bi_bvec_done);
+		DMERR("io : %p, v : %p", io, v);
+
+		verity_print_dump("salt", DUMP_PREFIX_OFFSET,
+						v->salt, v->salt_size);
+		verity_print_dump("result", DUMP_PREFIX_OFFSET,
+						verity_io_real_digest(v, io), v->digest_size);
+		verity_print_dump("io_want_digest", DUMP_PREFIX_OFFSET,
+						verity_io_want_digest(v, io), v->digest_size);
+
+		todo = 1 << v->data_dev_block_bits;
+		bio = dm_bio_from_per_bio_data(io, v->ti->per_bio_data_size);
+		do {
+			u8 *page;
+			unsigned len;
+			struct bio_vec bv = bio_iter_iovec(bio, prev_iter);
+
+			page = kmap_atomic(bv.bv_page);
+			len = bv.bv_len;
+			if (likely(len >= todo))
+				len = todo;
+
+			DMERR("page : %p, pfn : %p", (void *)bv.bv_page, (void *)page_to_pfn(bv.bv_page));
+
+			verity_print_dump("block", DUMP_PREFIX_ADDRESS,
+							page + bv.bv_offset, len);
+			kunmap_atomic(page);
+
+			bio_advance_iter(bio, &prev_iter, len);
+			todo -= len;
+		} while (todo);
 #endif // DM_VERITY_MEMORY_DUMP
+		if (verity_handle_err(v, DM_VERITY_BLOCK_TYPE_DATA, block))
+			return -EIO;
+	}
 
-		r = verity_for_bv_block(v, io, &io->iter, verity_bv_hash_update);
-		if (unlikely(r < 0))
-			return r;
+	return 0;
+}
 
-		r = verity_hash_final(v, desc, verity_io_real_digest(v, io));
-		if (unlikely(r < 0))
-			return r;
+/*
+ * Hash the data blocks of one parallel chunk and compare them with the
+ * digests looked up by verity_verify_io_parallel().
+ */
+static void verity_hash_chunk(struct dm_verity_hash_work *hw)
+{
+	struct dm_verity_parallel *p = hw->p;
+	struct dm_verity_io *io = p->io;
+	struct dm_verity *v = io->v;
+	struct bio *bio = dm_bio_from_per_bio_data(io, v->ti->per_bio_data_size);
+	struct shash_desc *desc = (struct shash_desc *)
+		((u8 *)hw + DM_VERITY_HASH_WORK_HDR_SIZE);
+	u8 *real_digest = (u8 *)desc + v->shash_descsize;
+	struct bvec_iter iter = hw->iter;
+	unsigned b;
 
-		if (likely(memcmp(verity_io_real_digest(v, io),
-				  verity_io_want_digest(v, io), v->digest_size) == 0))
-			continue;
-		else if (verity_fec_decode(v, io, DM_VERITY_BLOCK_TYPE_DATA,
-					   io->block + b, NULL, &start) == 0)
+	for (b = hw->start; b < hw->start + hw->n_blocks; b++) {
+		unsigned todo = 1 << v->data_dev_block_bits;
+		int r;
+
+		if (test_bit(b, p->zero_blocks)) {
+			if (verity_for_bv_block(v, io, &iter, verity_bv_zero))
+				set_bit(b, p->failed_blocks);
 			continue;
-		else{
-#ifdef DM_VERITY_MEMORY_DUMP
-			DMERR("data block %lu is corrupted", (long unsigned int)(io->block + b));
-			DMERR("iter->sector(%lu), size(%ul), idx(%ul), bvec_done(%ul)",
-				(long unsigned int)(prev_iter.bi_sector), prev_iter.bi_size,
-				prev_iter.bi_idx, prev_iter.bi_bvec_done);
-			DMERR("io : %p, v : %p", io, v);
+		}
 
-			verity_print_dump("salt", DUMP_PREFIX_OFFSET,
-							v->salt, v->salt_size);
-			verity_print_dump("result", DUMP_PREFIX_OFFSET,
-							verity_io_real_digest(v, io), v->digest_size);
-			verity_print_dump("io_want_digest", DUMP_PREFIX_OFFSET,
-							verity_io_want_digest(v, io), v->digest_size);
+		r = verity_hash_init(v, desc);
 
-			todo = 1 << v->data_dev_block_bits;
-			bio = dm_bio_from_per_bio_data(io, v->ti->per_bio_data_size);
-			do {
-				u8 *page;
-				unsigned len;
-				struct bio_vec bv = bio_iter_iovec(bio, prev_iter);
+		while (todo) {
+			u8 *page;
+			unsigned len;
+			struct bio_vec bv = bio_iter_iovec(bio, iter);
 
+			len = min(bv.bv_len, todo);
+			if (likely(!r)) {
 				page = kmap_atomic(bv.bv_page);
-				len = bv.bv_len;
-				if (likely(len >= todo))
-					len = todo;
+				r = verity_hash_update(v, desc,
+						       page + bv.bv_offset, len);
+				kunmap_atomic(page);
+			}
 
-				DMERR("page : %p, pfn : %p", (void *)bv.bv_page, (void *)page_to_pfn(bv.bv_page));
+			bio_advance_iter(bio, &iter, len);
+			todo -= len;
+		}
 
-				verity_print_dump("block", DUMP_PREFIX_ADDRESS,
-								page + bv.bv_offset, len);
-				kunmap_atomic(page);
+		if (likely(!r))
+			r = verity_hash_final(v, desc, real_digest);
 
-				bio_advance_iter(bio, &prev_iter, len);
-				todo -= len;
-			} while (todo);
-#endif // DM_VERITY_MEMORY_DUMP
-			if (verity_handle_err(v, DM_VERITY_BLOCK_TYPE_DATA,
-						   io->block + b))
-				return -EIO;
+		if (unlikely(r < 0) ||
+		    memcmp(real_digest, p->want_digests + b * v->digest_size,
+			   v->digest_size))
+			set_bit(b, p->failed_blocks);
+	}
+
+	if (atomic_dec_and_test(&p->pending))
+		complete(&p->done);
+}
+
+static void verity_hash_work(struct work_struct *w)
+{
+	verity_hash_chunk(container_of(w, struct dm_verity_hash_work, work));
+}
+
+/*
+ * Verify one "dm_verity_io" structure, hashing its data blocks on
+ * "n_chunks" CPUs. "*no_mem" is set, and nothing is verified, only when
+ * the parallel state can't be allocated; the caller then verifies serially.
+ */
+static int verity_verify_io_parallel(struct dm_verity_io *io, unsigned n_chunks,
+				     bool *no_mem)
+{
+	struct dm_verity *v = io->v;
+	struct bio *bio = dm_bio_from_per_bio_data(io, v->ti->per_bio_data_size);
+	struct dm_verity_parallel *p;
+	struct dm_verity_hash_work *hw;
+	struct bvec_iter iter;
+	size_t work_size, bitmap_size;
+	unsigned chunk_blocks, b, c;
+	bool is_zero;
+	int r = 0;
+
+	chunk_blocks = DIV_ROUND_UP(io->n_blocks, n_chunks);
+	n_chunks = DIV_ROUND_UP(io->n_blocks, chunk_blocks);
+
+	work_size = ALIGN(DM_VERITY_HASH_WORK_HDR_SIZE +
+			  v->shash_descsize + v->digest_size,
+			  CRYPTO_MINALIGN);
+	bitmap_size = BITS_TO_LONGS(io->n_blocks) * sizeof(unsigned long);
+
+	*no_mem = false;
+	p = kzalloc(DM_VERITY_PARALLEL_HDR_SIZE + n_chunks * work_size +
+		    bitmap_size * 2 + io->n_blocks * v->digest_size,
+		    GFP_NOIO | __GFP_NORETRY | __GFP_NOMEMALLOC | __GFP_NOWARN);
+	if (!p) {
+		*no_mem = true;
+		return -ENOMEM;
+	}
+
+	p->io = io;
+	p->zero_blocks = (unsigned long *)verity_parallel_work(p, n_chunks,
+							       work_size);
+	p->failed_blocks = (unsigned long *)((u8 *)p->zero_blocks + bitmap_size);
+	p->want_digests = (u8 *)p->failed_blocks + bitmap_size;
+	atomic_set(&p->pending, n_chunks);
+	init_completion(&p->done);
+
+	/* walking the hash tree is cheap, it stays serial */
+	for (b = 0; b < io->n_blocks; b++) {
+		r = verity_hash_for_block(v, io, io->block + b,
+					  p->want_digests + b * v->digest_size,
+					  &is_zero);
+		if (unlikely(r < 0))
+			goto out;
+		if (is_zero)
+			__set_bit(b, p->zero_blocks);
+	}
+
+	iter = io->iter;
+	for (c = 0; c < n_chunks; c++) {
+		hw = verity_parallel_work(p, c, work_size);
+		hw->p = p;
+		hw->iter = iter;
+		hw->start = c * chunk_blocks;
+		hw->n_blocks = min(chunk_blocks, io->n_blocks - hw->start);
+		bio_advance_iter(bio, &iter, hw->n_blocks << v->data_dev_block_bits);
+
+		/* the first chunk is hashed by this work */
+		if (c) {
+			INIT_WORK(&hw->work, verity_hash_work);
+			queue_work(v->hash_wq, &hw->work);
 		}
 	}
+	verity_hash_chunk(verity_parallel_work(p, 0, work_size));
+	wait_for_completion(&p->done);
+
+	iter = io->iter;
+	for_each_set_bit(b, p->failed_blocks, io->n_blocks) {
+		io->iter = iter;
+		bio_advance_iter(bio, &io->iter, b << v->data_dev_block_bits);
+		r = verity_verify_block(io, io->block + b);
+		if (unlikely(r < 0))
+			break;
+	}
+out:
+	kfree(p);
+	return r;
+}
+
+/*
+ * Verify one "dm_verity_io" structure.
+ */
+static int verity_verify_io(struct dm_verity_io *io)
+{
+	struct dm_verity *v = io->v;
+	unsigned min_blocks = ACCESS_ONCE(dm_verity_parallel_blocks);
+	unsigned b;
+	bool no_mem;
+	int r;
+
+	if (min_blocks && io->n_blocks >= 2 * min_blocks &&
+	    num_online_cpus() > 1) {
+		r = verity_verify_io_parallel(io,
+			min(num_online_cpus(), io->n_blocks / min_blocks),
+			&no_mem);
+		if (!no_mem)
+			return r;
+	}
+
+	for (b = 0; b < io->n_blocks; b++) {
+		r = verity_verify_block(io, io->block + b);
+		if (unlikely(r < 0))
+			return r;
+	}
 
 	return 0;
 }
@@ -763,6 +998,8 @@ void verity_status(struct dm_target *ti, status_type_t type,
 			args += DM_VERITY_OPTS_FEC;
 		if (v->zero_digest)
 			args++;
+		if (v->verified_hash_blocks)
+			args++;
 		if (!args)
 			return;
 		DMEMIT(" %u", args);
@@ -781,6 +1018,8 @@ void verity_status(struct dm_target *ti, status_type_t type,
 		}
 		if (v->zero_digest)
 			DMEMIT(" " DM_VERITY_OPT_IGN_ZEROES);
+		if (v->verified_hash_blocks)
+			DMEMIT(" " DM_VERITY_OPT_HASH_ONCE);
 		sz = verity_fec_status_table(v, sz, result, maxlen);
 		break;
 	}
@@ -843,6 +1082,11 @@ void verity_dtr(struct dm_target *ti)
 	if (v->verify_wq)
 		destroy_workqueue(v->verify_wq);
 
+	if (v->hash_wq)
+		destroy_workqueue(v->hash_wq);
+
+	vfree(v->verified_hash_blocks);
+
 	if (v->bufio)
 		dm_bufio_client_destroy(v->bufio);
 
@@ -935,6 +1179,10 @@ static int verity_parse_opt_args(struct dm_arg_set *as, struct dm_verity *v)
 			}
 			continue;
 
+		} else if (!strcasecmp(arg_name, DM_VERITY_OPT_HASH_ONCE)) {
+			v->hash_at_most_once = true;
+			continue;
+
 		} else if (verity_is_fec_opt_arg(arg_name)) {
 			r = verity_fec_parse_opt_args(as, v, &argc, arg_name);
 			if (r)
@@ -1174,6 +1422,17 @@ int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		goto bad;
 	}
 
+	if (v->hash_at_most_once) {
+		v->verified_hash_blocks =
+			vzalloc(BITS_TO_LONGS(v->hash_blocks - v->hash_start) *
+				sizeof(unsigned long));
+		if (!v->verified_hash_blocks) {
+			ti->error = "Cannot allocate verified hash blocks bitmap";
+			r = -ENOMEM;
+			goto bad;
+		}
+	}
+
 	/* WQ_UNBOUND greatly improves performance when running on ramdisk */
 	v->verify_wq = alloc_workqueue("kverityd",
 				       WQ_HIGHPRI | WQ_MEM_RECLAIM | WQ_UNBOUND,
@@ -1184,6 +1443,15 @@ int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		goto bad;
 	}
 
+	v->hash_wq = alloc_workqueue("kverityd_hash",
+				     WQ_HIGHPRI | WQ_MEM_RECLAIM | WQ_UNBOUND,
+				     num_online_cpus());
+	if (!v->hash_wq) {
+		ti->error = "Cannot allocate hashing workqueue";
+		r = -ENOMEM;
+		goto bad;
+	}
+
 	ti->per_bio_data_size = sizeof(struct dm_verity_io) +
 				v->shash_descsize + v->digest_size * 2;
 
@@ -1204,7 +1472,7 @@ bad:
 
 static struct target_type verity_target = {
 	.name		= "verity",
-	.version	= {1, 3, 0},
+	.version	= {1, 4, 0},
 	.module		= THIS_MODULE,
 	.ctr		= verity_ctr,
 	.dtr		= verity_dtr,
@@ -55,9 +55,14 @@ struct dm_verity {
 	unsigned shash_descsize;/* the size of temporary space for crypto */
 	int hash_failed;	/* set to 1 if hash of any block failed */
 	enum verity_mode mode;	/* mode for handling verification errors */
+	bool hash_at_most_once;	/* don't recheck evicted hash blocks */
 	unsigned corrupted_errs;/* Number of errors for corrupted blocks */
 
 	struct workqueue_struct *verify_wq;
+	struct workqueue_struct *hash_wq;	/* parallel data hashing */
+
+	/* hash blocks verified once, if check_hash_at_most_once is set */
+	unsigned long *verified_hash_blocks;
 
 	/* starting blocks for each tree level. 0 is the lowest level. */
 	sector_t hash_level_block[DM_VERITY_MAX_LEVELS];
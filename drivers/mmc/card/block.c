@@ -92,6 +92,11 @@ MODULE_ALIAS("mmc:block");
 		if (stats->enabled)					\
 			stats->pack_stop_reason[reason]++;		\
 	} while (0)
+#define MMC_BLK_UPDATE_PACK_DECISION(stats, decision)			\
+	do {								\
+		if (stats->enabled)					\
+			stats->pack_decisions[decision]++;		\
+	} while (0)
 
 #define MAX_RETRIES 5
 #define PCKD_TRGR_INIT_MEAN_POTEN	17
@@ -99,6 +104,9 @@ MODULE_ALIAS("mmc:block");
 #define PCKD_TRGR_URGENT_PENALTY	2
 #define PCKD_TRGR_LOWER_BOUND		5
 #define PCKD_TRGR_PRECISION_MULTIPLIER	100
+#define PCKD_EWMA_SHIFT			3
+#define PCKD_SLOWER_MARGIN_SHIFT	3
+#define PCKD_PROBE_INTERVAL		16
 
 static struct mmc_cmdq_req *mmc_cmdq_prep_dcmd(
 		struct mmc_queue_req *mqrq, struct mmc_queue *mq);
@@ -2400,11 +2408,98 @@ void mmc_blk_init_packed_statistics(struct mmc_card *card)
 	       sizeof(*card->wr_pack_stats.packing_events));
 	memset(&card->wr_pack_stats.pack_stop_reason, 0,
 		sizeof(card->wr_pack_stats.pack_stop_reason));
+	memset(&card->wr_pack_stats.pack_decisions, 0,
+		sizeof(card->wr_pack_stats.pack_decisions));
 	card->wr_pack_stats.enabled = true;
 	spin_unlock(&card->wr_pack_stats.lock);
 }
 EXPORT_SYMBOL(mmc_blk_init_packed_statistics);
 
+/*
+ * Decide whether building a packed list around @req is worth it. The trigger
+ * above only says that writes are streaming; this looks at the request
+ * itself, at what is queued behind it and at how packed writes have
+ * actually been performing against single ones.
+ */
+static enum mmc_pack_decisions mmc_blk_pack_decision(struct mmc_queue *mq,
+						     struct request *req)
+{
+	struct mmc_queue_req *prev = mq->mqrq_prev;
+	u32 single = mq->wr_ns_per_sect[0];
+	u32 packed = mq->wr_ns_per_sect[1];
+	int queued;
+
+	if (!mq->pack_adaptive)
+		return PACK_DECISION_PACK;
+
+	if (blk_rq_sectors(req) >= mq->pack_large_sectors)
+		return PACK_DECISION_LARGE_REQ;
+
+	/*
+	 * Allocated requests minus @req and whatever is still in flight.
+	 * Read without the queue_lock; a stale value costs one decision.
+	 */
+	queued = mq->queue->nr_rqs[BLK_RW_SYNC] +
+		 mq->queue->nr_rqs[BLK_RW_ASYNC] - 1;
+	if (prev->req)
+		queued -= mmc_packed_cmd(prev->cmd_type) ?
+			  prev->packed->nr_entries : 1;
+	if (queued < 1)
+		return PACK_DECISION_SHALLOW_QUEUE;
+
+	/*
+	 * Packed writes that cost more than 1/8 extra per sector than single
+	 * writes are not paying off on this card. Fall back to single
+	 * writes, but still pack every PCKD_PROBE_INTERVAL-th time so the
+	 * packed estimate follows the card.
+	 */
+	if (single && packed > single + (single >> PCKD_SLOWER_MARGIN_SHIFT)) {
+		if (++mq->pack_skipped < PCKD_PROBE_INTERVAL)
+			return PACK_DECISION_SLOWER;
+		mq->pack_skipped = 0;
+		return PACK_DECISION_PROBE;
+	}
+
+	return PACK_DECISION_PACK;
+}
+
+/*
+ * Feed the service time of a completed write into the single or packed
+ * per-sector estimate used by mmc_blk_pack_decision().
+ */
+static void mmc_blk_pack_account(struct mmc_queue *mq,
+				 struct mmc_queue_req *mq_rq)
+{
+	unsigned int sectors;
+	u32 *ewma, sample;
+	s64 ns;
+
+	if (!mq->pack_adaptive || rq_data_dir(mq_rq->req) != WRITE)
+		return;
+
+	if (mmc_packed_cmd(mq_rq->cmd_type)) {
+		sectors = mq_rq->packed->blocks;
+		ewma = &mq->wr_ns_per_sect[1];
+	} else {
+		sectors = blk_rq_sectors(mq_rq->req);
+		/* large writes are never packed, so don't compare against them */
+		if (sectors >= mq->pack_large_sectors)
+			return;
+		ewma = &mq->wr_ns_per_sect[0];
+	}
+
+	if (!sectors)
+		return;
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), mq_rq->issue_time));
+	sample = min_t(s64, div_s64(ns, sectors), U32_MAX);
+	if (*ewma)
+		*ewma = *ewma - (*ewma >> PCKD_EWMA_SHIFT) +
+			(sample >> PCKD_EWMA_SHIFT);
+	else
+		*ewma = sample;
+}
+
 static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 {
 	struct request_queue *q = mq->queue;
@@ -2419,6 +2514,7 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 	u8 max_packed_rw = 0;
 	u8 reqs = 0;
 	struct mmc_wr_pack_stats *stats = &card->wr_pack_stats;
+	enum mmc_pack_decisions decision;
 
 	if (!(md->flags & MMC_BLK_PACKED_CMD))
 		goto no_packed;
@@ -2444,6 +2540,14 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 	if (cur->cmd_flags & REQ_FUA)
 		goto no_packed;
 
+	decision = mmc_blk_pack_decision(mq, cur);
+	if (decision != PACK_DECISION_PACK && decision != PACK_DECISION_PROBE) {
+		spin_lock(&stats->lock);
+		MMC_BLK_UPDATE_PACK_DECISION(stats, decision);
+		spin_unlock(&stats->lock);
+		goto no_packed;
+	}
+
 	mmc_blk_clear_packed(mqrq);
 
 	max_blk_count = min(card->host->max_blk_count,
@@ -2461,6 +2565,7 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 	}
 
 	spin_lock(&stats->lock);
+	MMC_BLK_UPDATE_PACK_DECISION(stats, decision);
 	do {
 		if (reqs >= max_packed_rw - 1) {
 			put_back = false;
@@ -3364,6 +3469,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 							    card, mq);
 			else
 				mmc_blk_rw_rq_prep(mq->mqrq_cur, card, 0, mq);
+			mq->mqrq_cur->issue_time = ktime_get();
 			areq = &mq->mqrq_cur->mmc_active;
 		} else
 			areq = NULL;
@@ -3388,6 +3494,9 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 			 */
 			mmc_blk_reset_success(md, type);
 
+			if (status == MMC_BLK_SUCCESS)
+				mmc_blk_pack_account(mq, mq_rq);
+
 			if (mmc_packed_cmd(mq_rq->cmd_type)) {
 				ret = mmc_blk_end_packed_req(mq_rq);
 				break;
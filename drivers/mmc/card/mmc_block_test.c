@@ -1489,6 +1489,8 @@ static int run_packed_test(struct test_iosched *tios)
 		return -EINVAL;
 	}
 	mmc_blk_init_packed_statistics(mq->card);
+	/* the expected statistics assume the static trigger only */
+	mq->pack_adaptive = false;
 
 	if (tios->test_info.testcase !=
 		TEST_PACK_MIX_PACKED_NO_PACKED_PACKED) {
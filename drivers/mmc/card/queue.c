@@ -35,6 +35,8 @@
  * manage to keep the high write throughput.
  */
 #define DEFAULT_NUM_REQS_TO_START_PACK 17
+/* writes of 256KB or more gain nothing from sharing a packed command */
+#define DEFAULT_PACK_LARGE_SECTORS 512
 
 /*
  * Prepare a MMC request. This just filters out odd stuff.
@@ -59,57 +61,72 @@ static int mmc_prep_request(struct request_queue *q, struct request *req)
 	return BLKPREP_OK;
 }
 
-static struct request *mmc_peek_request(struct mmc_queue *mq)
+static inline bool mmc_cmdq_can_issue(struct mmc_host *host)
 {
-	struct request_queue *q = mq->queue;
-	mq->cmdq_req_peeked = NULL;
+	struct mmc_card *card = host->card;
 
-	spin_lock_irq(q->queue_lock);
-	if (!blk_queue_stopped(q))
-		mq->cmdq_req_peeked = blk_peek_request(q);
-	spin_unlock_irq(q->queue_lock);
+	if (!card->part_curr && !mmc_card_suspended(card) &&
+	    (mmc_host_halt(host) || mmc_host_cq_disable(host)))
+		return false;
 
-	return mq->cmdq_req_peeked;
+	return !test_bit(CMDQ_STATE_ERR, &host->cmdq_ctx.curr_state);
 }
 
-static bool mmc_check_blk_queue_start_tag(struct request_queue *q,
-					  struct request *req)
+/*
+ * Peek the next request and, if it can be issued, start its tag, all under a
+ * single queue_lock round trip. The block layer tag doubles as the CMDQ task
+ * slot, so a successful start means the request owns a free slot.
+ */
+static bool mmc_cmdq_fetch_request(struct mmc_host *host,
+				   struct mmc_queue *mq)
 {
-	int ret;
+	struct request_queue *q = mq->queue;
+	struct request *req;
+	bool fetched = false;
+
+	mq->cmdq_req_peeked = NULL;
+
+	/* don't take the queue_lock at all while halted or in error */
+	if (!mmc_cmdq_can_issue(host))
+		return false;
 
 	spin_lock_irq(q->queue_lock);
-	ret = blk_queue_start_tag(q, req);
+	if (blk_queue_stopped(q))
+		goto out;
+
+	req = blk_peek_request(q);
+	if (!req)
+		goto out;
+	mq->cmdq_req_peeked = req;
+
+	if ((req->cmd_flags & (REQ_FLUSH | REQ_DISCARD)) &&
+	    test_bit(CMDQ_STATE_DCMD_ACTIVE, &host->cmdq_ctx.curr_state))
+		goto out;
+
+	fetched = !blk_queue_start_tag(q, req);
+out:
 	spin_unlock_irq(q->queue_lock);
 
-	return !!ret;
+	return fetched;
 }
 
 static inline void mmc_cmdq_ready_wait(struct mmc_host *host,
 					struct mmc_queue *mq)
 {
 	struct mmc_cmdq_context_info *ctx = &host->cmdq_ctx;
-	struct request_queue *q = mq->queue;
 
 	/*
 	 * Wait until all of the following conditions are true:
-	 * 1. There is a request pending in the block layer queue
+	 * 1. cmdq state should be unhalted.
+	 * 2. cmdq state shouldn't be in error state.
+	 * 3. There is a request pending in the block layer queue
 	 *    to be processed.
-	 * 2. If the peeked request is flush/discard then there shouldn't
+	 * 4. If the peeked request is flush/discard then there shouldn't
 	 *    be any other direct command active.
-	 * 3. cmdq state should be unhalted.
-	 * 4. cmdq state shouldn't be in error state.
 	 * 5. free tag available to process the new request.
 	 */
 	wait_event(ctx->wait, kthread_should_stop()
-		|| (mmc_peek_request(mq) &&
-		!((mq->cmdq_req_peeked->cmd_flags & (REQ_FLUSH | REQ_DISCARD))
-		  && test_bit(CMDQ_STATE_DCMD_ACTIVE, &ctx->curr_state))
-		&& !(!host->card->part_curr && !mmc_card_suspended(host->card)
-		     && mmc_host_halt(host))
-		&& !(!host->card->part_curr && mmc_host_cq_disable(host) &&
-			!mmc_card_suspended(host->card))
-		&& !test_bit(CMDQ_STATE_ERR, &ctx->curr_state)
-		&& !mmc_check_blk_queue_start_tag(q, mq->cmdq_req_peeked)));
+		|| mmc_cmdq_fetch_request(host, mq));
 }
 
 static int mmc_cmdq_thread(void *d)
@@ -302,6 +319,13 @@ void mmc_cmdq_setup_queue(struct mmc_queue *mq, struct mmc_card *card)
 		limit = *mmc_dev(host)->dma_mask;
 
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, mq->queue);
+	queue_flag_clear_unlocked(QUEUE_FLAG_ADD_RANDOM, mq->queue);
+	/*
+	 * Run the completion softirq on (a cache sibling of) the CPU that
+	 * submitted the request, so the issuer's request and bio state stays
+	 * cache hot. rq_affinity=2 forces the exact submitting CPU.
+	 */
+	queue_flag_set_unlocked(QUEUE_FLAG_SAME_COMP, mq->queue);
 	if (mmc_can_erase(card))
 		mmc_queue_setup_discard(mq->queue, card);
 
@@ -375,6 +399,8 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	mq->num_wr_reqs_to_start_packing =
 		min_t(int, (int)card->ext_csd.max_packed_writes,
 		     DEFAULT_NUM_REQS_TO_START_PACK);
+	mq->pack_adaptive = true;
+	mq->pack_large_sectors = DEFAULT_PACK_LARGE_SECTORS;
 
 	blk_queue_prep_rq(mq->queue, mmc_prep_request);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, mq->queue);
@@ -619,6 +645,12 @@ enum blk_eh_timer_return mmc_cmdq_rq_timed_out(struct request *req)
 	return mq->cmdq_req_timed_out(req);
 }
 
+/*
+ * The CMDQ queue is still a legacy request_fn queue fed by mmc_cmdq_thread.
+ * Block layer tags are used as CMDQ task slots, and halt, reset and error
+ * recovery rely on blk_queue_find_tag(), blk_queue_invalidate_tags() and
+ * blk_stop_queue()/blk_start_queue(), which have no blk-mq equivalent here.
+ */
 int mmc_cmdq_init(struct mmc_queue *mq, struct mmc_card *card)
 {
 	int i, ret = 0;
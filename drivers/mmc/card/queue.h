@@ -42,6 +42,7 @@ struct mmc_queue_req {
 	enum mmc_packed_type	cmd_type;
 	struct mmc_packed	*packed;
 	struct mmc_cmdq_req	cmdq_req;
+	ktime_t			issue_time;
 };
 
 struct mmc_queue {
@@ -68,6 +69,11 @@ struct mmc_queue {
 	int			num_of_potential_packed_wr_reqs;
 	int			num_wr_reqs_to_start_packing;
 	bool			no_pack_for_random;
+	bool			pack_adaptive;
+	unsigned int		pack_large_sectors;
+	unsigned int		pack_skipped;
+	/* write service time in ns per sector, [0] single, [1] packed */
+	u32			wr_ns_per_sect[2];
 	struct work_struct	cmdq_err_work;
 
 	struct completion	cmdq_pending_req_done;
@@ -765,6 +765,14 @@ static int mmc_wr_pack_stats_open(struct inode *inode, struct file *filp)
 }
 
 #define TEMP_BUF_SIZE 256
+static const char * const mmc_pack_decision_names[MAX_PACK_DECISIONS] = {
+	[PACK_DECISION_PACK]		= "packing attempted",
+	[PACK_DECISION_LARGE_REQ]	= "not packed, large request",
+	[PACK_DECISION_SHALLOW_QUEUE]	= "not packed, nothing queued",
+	[PACK_DECISION_SLOWER]		= "not packed, packing slower",
+	[PACK_DECISION_PROBE]		= "packing attempted to re-measure",
+};
+
 static ssize_t mmc_wr_pack_stats_read(struct file *filp, char __user *ubuf,
 				size_t cnt, loff_t *ppos)
 {
@@ -895,6 +903,21 @@ static ssize_t mmc_wr_pack_stats_read(struct file *filp, char __user *ubuf,
 		strlcat(ubuf, temp_buf, cnt);
 	}
 
+	snprintf(temp_buf, TEMP_BUF_SIZE,
+		 "%s: adaptive packing decisions:\n",
+		 mmc_hostname(card->host));
+	strlcat(ubuf, temp_buf, cnt);
+
+	for (i = 0; i < MAX_PACK_DECISIONS; i++) {
+		if (!pack_stats->pack_decisions[i])
+			continue;
+		snprintf(temp_buf, TEMP_BUF_SIZE, "%s: %d times: %s\n",
+			 mmc_hostname(card->host),
+			 pack_stats->pack_decisions[i],
+			 mmc_pack_decision_names[i]);
+		strlcat(ubuf, temp_buf, cnt);
+	}
+
 	spin_unlock(&pack_stats->lock);
 
 	kfree(temp_buf);
@@ -532,6 +532,13 @@ static int ufsdbg_tag_stats_show(struct seq_file *file, void *data)
 		}
 		seq_puts(file, "\n");
 	}
+
+	seq_puts(file, "\nRequests completed per interrupt\n");
+	for (i = 0; i < UFS_INTR_BATCH_BUCKETS - 1; i++)
+		seq_printf(file, " %d-%d\t%llu\n", 1 << i, (2 << i) - 1,
+			   ufs_stats->intr_batch_stats[i]);
+	seq_printf(file, " %d+\t%llu\n", 1 << i,
+		   ufs_stats->intr_batch_stats[i]);
 	spin_unlock_irqrestore(hba->host->host_lock, flags);
 
 	if (is_tag_empty)
@@ -575,6 +582,8 @@ static ssize_t ufsdbg_tag_stats_write(struct file *filp,
 		memset(hba->ufs_stats.tag_stats[0], 0,
 			sizeof(**hba->ufs_stats.tag_stats) *
 			TS_NUM_STATS * hba->nutrs);
+		memset(ufs_stats->intr_batch_stats, 0,
+			sizeof(ufs_stats->intr_batch_stats));
 
 		/* initialize current queue depth */
 		ufs_stats->q_depth = 0;
@@ -1391,6 +1400,69 @@ static const struct file_operations ufsdbg_req_stats_desc = {
 	.write		= ufsdbg_req_stats_write,
 };
 
+static int ufsdbg_pm_policy_show(struct seq_file *file, void *data)
+{
+	struct ufs_hba *hba = (struct ufs_hba *)file->private;
+	struct ufs_pm_policy *policy = &hba->pm_policy;
+	static const char * const names[UFS_PM_DECISION_MAX] = {
+		[UFS_PM_GATE_EARLY]		= "gate early",
+		[UFS_PM_GATE_DEFAULT]		= "gate after delay",
+		[UFS_PM_HIBERN8_EARLY]		= "hibern8 early",
+		[UFS_PM_HIBERN8_DEFAULT]	= "hibern8 after delay",
+		[UFS_PM_MISPREDICT]		= "early but idle too short",
+	};
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(hba->host->host_lock, flags);
+	seq_printf(file, "enabled: %d\n", policy->is_enabled);
+	seq_printf(file, "predicted idle (us): %u\n",
+		   policy->predicted_idle_us);
+	seq_printf(file, "clock ungate latency (us): %u\n",
+		   policy->gate_exit_us);
+	seq_printf(file, "hibern8 exit latency (us): %u\n",
+		   policy->hibern8_exit_us);
+	for (i = 0; i < UFS_PM_DECISION_MAX; i++)
+		seq_printf(file, "%s: %u\n", names[i], policy->decisions[i]);
+	spin_unlock_irqrestore(hba->host->host_lock, flags);
+
+	return 0;
+}
+
+static int ufsdbg_pm_policy_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ufsdbg_pm_policy_show, inode->i_private);
+}
+
+/* writing 0 or 1 disables or enables the policy and clears the counters */
+static ssize_t ufsdbg_pm_policy_write(struct file *filp,
+		const char __user *ubuf, size_t cnt, loff_t *ppos)
+{
+	struct ufs_hba *hba = filp->f_mapping->host->i_private;
+	unsigned long flags;
+	int val;
+	int ret;
+
+	ret = kstrtoint_from_user(ubuf, cnt, 0, &val);
+	if (ret) {
+		dev_err(hba->dev, "%s: Invalid argument\n", __func__);
+		return ret;
+	}
+
+	spin_lock_irqsave(hba->host->host_lock, flags);
+	hba->pm_policy.is_enabled = !!val;
+	memset(hba->pm_policy.decisions, 0,
+	       sizeof(hba->pm_policy.decisions));
+	spin_unlock_irqrestore(hba->host->host_lock, flags);
+
+	return cnt;
+}
+
+static const struct file_operations ufsdbg_pm_policy_desc = {
+	.open		= ufsdbg_pm_policy_open,
+	.read		= seq_read,
+	.write		= ufsdbg_pm_policy_write,
+};
 
 static int ufsdbg_reset_controller_show(struct seq_file *file, void *data)
 {
@@ -1624,6 +1696,17 @@ void ufsdbg_add_debugfs(struct ufs_hba *hba)
 		goto err;
 	}
 
+	hba->debugfs_files.pm_policy =
+		debugfs_create_file("pm_policy", S_IRUSR | S_IWUSR,
+			hba->debugfs_files.stats_folder, hba,
+			&ufsdbg_pm_policy_desc);
+	if (!hba->debugfs_files.pm_policy) {
+		dev_err(hba->dev,
+			"%s:  failed create pm_policy debugfs entry\n",
+			__func__);
+		goto err;
+	}
+
 	hba->debugfs_files.reset_controller =
 		debugfs_create_file("reset_controller", S_IRUSR | S_IWUSR,
 			hba->debugfs_files.debugfs_root, hba,
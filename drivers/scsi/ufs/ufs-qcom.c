@@ -1271,6 +1271,8 @@ static void ufs_qcom_set_caps(struct ufs_hba *hba)
 		hba->caps |= UFSHCD_CAP_CLK_SCALING;
 	}
 	hba->caps |= UFSHCD_CAP_AUTO_BKOPS_SUSPEND;
+	/* UFSHCD_QUIRK_BROKEN_INTR_AGGR still rules out the broken revision */
+	hba->caps |= UFSHCD_CAP_INTR_AGGR;
 
 	if (host->hw_ver.major >= 0x2) {
 		if (!host->disable_lpm)
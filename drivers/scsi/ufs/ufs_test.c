@@ -61,6 +61,9 @@
 		(LONG_TEST_SIZE_INTEGER(x) * 10))
 /* translation mask from sectors to block */
 #define SECTOR_TO_BLOCK_MASK 0x7
+/* read latency test: large writes queued ahead of small reads */
+#define READ_LATENCY_NUM_WRITES	16
+#define READ_LATENCY_NUM_READS	16
 
 #define TEST_OPS(test_name, upper_case_name)				\
 static int ufs_test_ ## test_name ## _show(struct seq_file *file,	\
@@ -98,6 +101,7 @@ enum ufs_test_testcases {
 
 	UFS_TEST_PARALLEL_READ_AND_WRITE,
 	UFS_TEST_LUN_DEPTH,
+	UFS_TEST_READ_LATENCY,
 
 	NUM_TESTS,
 };
@@ -111,8 +115,14 @@ enum ufs_test_stage {
 
 	UFS_TEST_LUN_DEPTH_TEST_RUNNING,
 	UFS_TEST_LUN_DEPTH_DONE_ISSUING_REQ,
+
+	UFS_TEST_READ_LATENCY_FIFO,
+	UFS_TEST_READ_LATENCY_ROW,
 };
 
+/* read latency test stages, FIFO dispatch then read-first dispatch */
+#define READ_LATENCY_STAGES	2
+
 /* device test */
 static struct blk_dev_test_type *ufs_bdt;
 
@@ -151,6 +161,12 @@ struct ufs_test_data {
 	/* total number of requests to be submitted in long test */
 	u32 long_test_num_reqs;
 
+	/* read latency test, per stage */
+	ktime_t read_lat_start;
+	u64 read_lat_us[READ_LATENCY_STAGES];
+	u64 read_lat_max_us[READ_LATENCY_STAGES];
+	unsigned int read_lat_count[READ_LATENCY_STAGES];
+
 	struct test_iosched *test_iosched;
 };
 
@@ -254,6 +270,8 @@ static char *ufs_test_get_test_case_str(int testcase)
 		return "UFS parallel read and write test";
 	case UFS_TEST_LUN_DEPTH:
 		return "UFS LUN depth test";
+	case UFS_TEST_READ_LATENCY:
+		return "UFS read latency under write test";
 	}
 	return "Unknown test";
 }
@@ -441,6 +459,17 @@ static int ufs_test_show(struct seq_file *file, int test_case)
 		 "The test will test for each iteration once only reads and "
 		 "once only writes.\n";
 		break;
+	case UFS_TEST_READ_LATENCY:
+		test_description = "\nufs_test_read_latency\n"
+		 "=========\n"
+		 "Description:\n"
+		 "This test compares the latency of small reads queued behind "
+		 "a backlog of large writes under two dispatch orders.\n"
+		 "First all requests are dispatched in FIFO order, as with "
+		 "noop/deadline. Then the same load is issued with the reads "
+		 "dispatched ahead of the writes, as the ROW scheduler does.\n"
+		 "The average and max read latency of each stage are printed.\n";
+		break;
 	default:
 		test_description = "Unknown test";
 	}
@@ -1279,6 +1308,120 @@ static int ufs_test_run_data_integrity_test(struct test_iosched *test_iosched)
 	return ret;
 }
 
+static void read_latency_end_io_fn(struct request *rq, int err)
+{
+	struct test_iosched *test_iosched = rq->q->elevator->elevator_data;
+	struct ufs_test_data *utd = test_iosched->blk_dev_test_data;
+	int stage = utd->test_stage - UFS_TEST_READ_LATENCY_FIFO;
+	u64 us;
+
+	if (rq_data_dir(rq) == READ) {
+		us = ktime_us_delta(ktime_get(), utd->read_lat_start);
+		utd->read_lat_us[stage] += us;
+		utd->read_lat_max_us[stage] =
+			max(utd->read_lat_max_us[stage], us);
+		utd->read_lat_count[stage]++;
+	}
+
+	long_test_free_end_io_fn(rq, err);
+}
+
+static int ufs_test_read_latency_stage(struct test_iosched *test_iosched,
+				       bool reads_first)
+{
+	struct ufs_test_data *utd = test_iosched->blk_dev_test_data;
+	struct test_request *test_rq;
+	u32 sector = test_iosched->start_sector;
+	int i, ret;
+
+	for (i = 0; i < READ_LATENCY_NUM_WRITES; i++) {
+		ret = test_iosched_add_wr_rd_test_req(test_iosched, 0, WRITE,
+			sector, TEST_MAX_BIOS_PER_REQ, TEST_PATTERN_5A,
+			read_latency_end_io_fn);
+		if (ret) {
+			pr_err("%s: failed to add a write request", __func__);
+			return ret;
+		}
+		sector += TEST_MAX_BIOS_PER_REQ * (TEST_BIO_SIZE / SECTOR_SIZE);
+	}
+
+	/* the reads hit the LBAs the writes above are going to */
+	sector = test_iosched->start_sector;
+	for (i = 0; i < READ_LATENCY_NUM_READS; i++) {
+		if (!reads_first) {
+			ret = test_iosched_add_wr_rd_test_req(test_iosched, 0,
+				READ, sector, 1, TEST_PATTERN_5A,
+				read_latency_end_io_fn);
+			if (ret) {
+				pr_err("%s: failed to add a read request",
+					__func__);
+				return ret;
+			}
+		} else {
+			test_rq = test_iosched_create_test_req(test_iosched, 0,
+				READ, sector, 1, TEST_PATTERN_5A,
+				read_latency_end_io_fn);
+			if (!test_rq) {
+				pr_err("%s: failed to create a read request",
+					__func__);
+				return -ENODEV;
+			}
+			test_iosched_add_urgent_req(test_iosched, test_rq);
+		}
+		sector += TEST_MAX_BIOS_PER_REQ * (TEST_BIO_SIZE / SECTOR_SIZE);
+	}
+
+	utd->read_lat_start = ktime_get();
+	blk_post_runtime_resume(test_iosched->req_q, 0);
+
+	return 0;
+}
+
+static int ufs_test_run_read_latency_test(struct test_iosched *test_iosched)
+{
+	struct ufs_test_data *utd = test_iosched->blk_dev_test_data;
+	int ret;
+
+	utd->queue_complete = false;
+	memset(utd->read_lat_us, 0, sizeof(utd->read_lat_us));
+	memset(utd->read_lat_max_us, 0, sizeof(utd->read_lat_max_us));
+	memset(utd->read_lat_count, 0, sizeof(utd->read_lat_count));
+
+	pr_info("%s: FIFO stage, first req_id=%d", __func__,
+		test_iosched->wr_rd_next_req_id);
+	utd->test_stage = UFS_TEST_READ_LATENCY_FIFO;
+	ret = ufs_test_read_latency_stage(test_iosched, false);
+	if (ret)
+		return ret;
+
+	wait_event(utd->wait_q, utd->queue_complete);
+
+	pr_info("%s: reads first stage, first req_id=%d", __func__,
+		test_iosched->wr_rd_next_req_id);
+	utd->test_stage = UFS_TEST_READ_LATENCY_ROW;
+	return ufs_test_read_latency_stage(test_iosched, true);
+}
+
+static int ufs_test_read_latency_post(struct test_iosched *test_iosched)
+{
+	struct ufs_test_data *utd = test_iosched->blk_dev_test_data;
+	static const char * const names[READ_LATENCY_STAGES] = {
+		"FIFO", "reads first",
+	};
+	int i;
+
+	for (i = 0; i < READ_LATENCY_STAGES; i++) {
+		if (!utd->read_lat_count[i])
+			continue;
+		pr_info("%s: %s: %u reads, avg %llu us, max %llu us\n",
+			__func__, names[i], utd->read_lat_count[i],
+			div_u64(utd->read_lat_us[i], utd->read_lat_count[i]),
+			utd->read_lat_max_us[i]);
+	}
+
+	return ufs_test_post(test_iosched);
+}
+
 static ssize_t ufs_test_write(struct file *file, const char __user *buf,
 			size_t count, loff_t *ppos, int test_case)
 {
@@ -1357,6 +1500,12 @@ static ssize_t ufs_test_write(struct file *file, const char __user *buf,
 	case UFS_TEST_LUN_DEPTH:
 		utd->test_info.run_test_fn = ufs_test_run_lun_depth_test;
 		break;
+	case UFS_TEST_READ_LATENCY:
+		utd->test_info.run_test_fn = ufs_test_run_read_latency_test;
+		utd->test_info.post_test_fn = ufs_test_read_latency_post;
+		utd->test_info.check_test_completion_fn =
+			ufs_data_integrity_completion;
+		break;
 	default:
 		pr_err("%s: Unknown test-case: %d", __func__, test_case);
 		WARN_ON(true);
@@ -1394,6 +1543,7 @@ TEST_OPS(long_sequential_write, LONG_SEQUENTIAL_WRITE);
 TEST_OPS(long_sequential_mixed, LONG_SEQUENTIAL_MIXED);
 TEST_OPS(parallel_read_and_write, PARALLEL_READ_AND_WRITE);
 TEST_OPS(lun_depth, LUN_DEPTH);
+TEST_OPS(read_latency, READ_LATENCY);
 
 static void ufs_test_debugfs_cleanup(struct test_iosched *test_iosched)
 {
@@ -1462,6 +1612,9 @@ static int ufs_test_debugfs_init(struct ufs_test_data *utd)
 	if (ret)
 		goto exit_err;
 	add_test(utd, lun_depth, LUN_DEPTH);
+	if (ret)
+		goto exit_err;
+	ret = add_test(utd, read_latency, READ_LATENCY);
 	if (ret)
 		goto exit_err;
 
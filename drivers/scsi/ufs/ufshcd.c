@@ -105,6 +105,15 @@ static void ufshcd_update_tag_stats_completion(struct ufs_hba *hba,
 		hba->ufs_stats.q_depth--;
 }
 
+static void ufshcd_update_intr_batch_stats(struct ufs_hba *hba, int nr)
+{
+	if (!hba->ufs_stats.enabled || !nr)
+		return;
+
+	hba->ufs_stats.intr_batch_stats[min_t(int, ilog2(nr),
+					UFS_INTR_BATCH_BUCKETS - 1)]++;
+}
+
 static void update_req_stats(struct ufs_hba *hba, struct ufshcd_lrb *lrbp)
 {
 	int rq_type;
@@ -154,6 +163,10 @@ static inline void ufshcd_update_tag_stats_completion(struct ufs_hba *hba,
 {
 }
 
+static inline void ufshcd_update_intr_batch_stats(struct ufs_hba *hba, int nr)
+{
+}
+
 static inline void ufshcd_update_error_stats(struct ufs_hba *hba, int type)
 {
 }
@@ -208,6 +221,8 @@ void ufshcd_update_query_stats(struct ufs_hba *hba,
 
 /* Interrupt aggregation default timeout, unit: 40us */
 #define INT_AGGR_DEF_TO	0x02
+/* Interrupt aggregation timeout used while the queue is shallow */
+#define INT_AGGR_MIN_TO	0x01
 
 /* default value of auto suspend is 3 seconds */
 #define UFSHCD_AUTO_SUSPEND_DELAY_MS 3000 /* millisecs */
@@ -985,12 +1000,40 @@ ufshcd_reset_intr_aggr(struct ufs_hba *hba)
 static inline void
 ufshcd_config_intr_aggr(struct ufs_hba *hba, u8 cnt, u8 tmout)
 {
+	hba->intr_aggr_cnt = cnt;
+	hba->intr_aggr_tmout = tmout;
 	ufshcd_writel(hba, INT_AGGR_ENABLE | INT_AGGR_PARAM_WRITE |
 		      INT_AGGR_COUNTER_THLD_VAL(cnt) |
 		      INT_AGGR_TIMEOUT_VAL(tmout),
 		      REG_UTP_TRANSFER_REQ_INT_AGG_CONTROL);
 }
 
+/**
+ * ufshcd_tune_intr_aggr - Adapt interrupt aggregation to the queue depth
+ * @hba: per adapter instance
+ * @nr_outstanding: transfer requests outstanding on this interrupt
+ *
+ * Raise the interrupt once about half of the usual queue depth has
+ * completed, so that the device still has work queued while the
+ * completions are handled, and wait less for stragglers when the queue
+ * is shallow. The register is only rewritten when the values change.
+ * Host lock must be held.
+ */
+static void ufshcd_tune_intr_aggr(struct ufs_hba *hba, int nr_outstanding)
+{
+	int qd, cnt;
+	u8 tmout;
+
+	hba->intr_aggr_qd = hba->intr_aggr_qd - (hba->intr_aggr_qd >> 2) +
+			    (nr_outstanding << 2);
+	qd = hba->intr_aggr_qd >> 4;
+
+	cnt = clamp(qd / 2, 1, hba->nutrs - 1);
+	tmout = qd < 4 ? INT_AGGR_MIN_TO : INT_AGGR_DEF_TO;
+	if (cnt != hba->intr_aggr_cnt || tmout != hba->intr_aggr_tmout)
+		ufshcd_config_intr_aggr(hba, cnt, tmout);
+}
+
 /**
  * ufshcd_disable_intr_aggr - Disables interrupt aggregation.
  * @hba: per adapter instance
@@ -1179,10 +1222,78 @@ static int ufshcd_scale_clks(struct ufs_hba *hba, bool scale_up)
 	return ret;
 }
 
+/* an idle period has to last this many exit latencies to pay one back */
+#define UFS_PM_BREAK_EVEN_FACTOR	4
+/* a new sample weighs 1/2^UFS_PM_AVG_SHIFT in the moving averages */
+#define UFS_PM_AVG_SHIFT		2
+#define UFS_PM_EARLY_DELAY_MS		1
+
+static void ufshcd_pm_policy_avg(u32 *avg, s64 sample_us)
+{
+	u32 sample = clamp_t(s64, sample_us, 0, U32_MAX);
+
+	if (*avg)
+		*avg = *avg - (*avg >> UFS_PM_AVG_SHIFT) +
+			(sample >> UFS_PM_AVG_SHIFT);
+	else
+		*avg = sample;
+}
+
+/* host lock must be held before calling this */
+static void ufshcd_pm_policy_idle_end(struct ufs_hba *hba)
+{
+	struct ufs_pm_policy *policy = &hba->pm_policy;
+	s64 idle_us;
+
+	if (!ktime_to_ns(policy->idle_start))
+		return;
+
+	idle_us = ktime_us_delta(ktime_get(), policy->idle_start);
+	policy->idle_start = ktime_set(0, 0);
+	ufshcd_pm_policy_avg(&policy->predicted_idle_us, idle_us);
+
+	if (policy->early_break_even_us &&
+	    idle_us < policy->early_break_even_us)
+		policy->decisions[UFS_PM_MISPREDICT]++;
+	policy->early_break_even_us = 0;
+}
+
+/*
+ * Called when the host goes idle, returns after how many ms to enter the
+ * low power state whose exit costs @exit_us: right away if the predicted
+ * idle period pays that exit back, otherwise the configured @delay_ms.
+ * Host lock must be held before calling this.
+ */
+static unsigned long ufshcd_pm_policy_delay(struct ufs_hba *hba,
+		unsigned long delay_ms, u32 exit_us,
+		enum ufs_pm_policy_decision early,
+		enum ufs_pm_policy_decision dflt)
+{
+	struct ufs_pm_policy *policy = &hba->pm_policy;
+	u32 break_even_us = exit_us * UFS_PM_BREAK_EVEN_FACTOR;
+
+	if (!ktime_to_ns(policy->idle_start))
+		policy->idle_start = ktime_get();
+
+	/* no exit latency measured yet, the fixed delay gets us one */
+	if (!policy->is_enabled || !exit_us ||
+	    delay_ms <= UFS_PM_EARLY_DELAY_MS ||
+	    policy->predicted_idle_us < break_even_us) {
+		policy->decisions[dflt]++;
+		return delay_ms;
+	}
+
+	policy->decisions[early]++;
+	policy->early_break_even_us = max(policy->early_break_even_us,
+					  break_even_us);
+	return UFS_PM_EARLY_DELAY_MS;
+}
+
 static void ufshcd_ungate_work(struct work_struct *work)
 {
 	int ret;
 	unsigned long flags;
+	ktime_t start;
 	struct ufs_hba *hba = container_of(work, struct ufs_hba,
 			clk_gating.ungate_work);
 
@@ -1195,6 +1306,7 @@ static void ufshcd_ungate_work(struct work_struct *work)
 	}
 
 	spin_unlock_irqrestore(hba->host->host_lock, flags);
+	start = ktime_get();
 	ufshcd_hba_vreg_set_hpm(hba);
 	ufshcd_enable_clocks(hba);
 
@@ -1212,6 +1324,8 @@ static void ufshcd_ungate_work(struct work_struct *work)
 		}
 		hba->clk_gating.is_suspended = false;
 	}
+	ufshcd_pm_policy_avg(&hba->pm_policy.gate_exit_us,
+			     ktime_us_delta(ktime_get(), start));
 unblock_reqs:
 	ufshcd_scsi_unblock_requests(hba);
 }
@@ -1231,6 +1345,7 @@ int ufshcd_hold(struct ufs_hba *hba, bool async)
 		goto out;
 	spin_lock_irqsave(hba->host->host_lock, flags);
 	hba->clk_gating.active_reqs++;
+	ufshcd_pm_policy_idle_end(hba);
 
 	if (ufshcd_eh_in_progress(hba)) {
 		spin_unlock_irqrestore(hba->host->host_lock, flags);
@@ -1391,7 +1506,11 @@ static void __ufshcd_release(struct ufs_hba *hba, bool no_sched)
 	trace_ufshcd_clk_gating(dev_name(hba->dev), hba->clk_gating.state);
 
 	schedule_delayed_work(&hba->clk_gating.gate_work,
-			      msecs_to_jiffies(hba->clk_gating.delay_ms));
+			      msecs_to_jiffies(ufshcd_pm_policy_delay(hba,
+					hba->clk_gating.delay_ms,
+					hba->pm_policy.gate_exit_us,
+					UFS_PM_GATE_EARLY,
+					UFS_PM_GATE_DEFAULT)));
 }
 
 void ufshcd_release(struct ufs_hba *hba, bool no_sched)
@@ -1629,6 +1748,7 @@ static int ufshcd_hibern8_hold(struct ufs_hba *hba, bool async)
 
 	spin_lock_irqsave(hba->host->host_lock, flags);
 	hba->hibern8_on_idle.active_reqs++;
+	ufshcd_pm_policy_idle_end(hba);
 
 	if (ufshcd_eh_in_progress(hba)) {
 		spin_unlock_irqrestore(hba->host->host_lock, flags);
@@ -1713,7 +1833,11 @@ static void __ufshcd_hibern8_release(struct ufs_hba *hba, bool no_sched)
 	 * work gets scheduled atleast after 2 jiffies (any time between
 	 * 1000/HZ ms to 2000/HZ ms).
 	 */
-	delay_in_jiffies = msecs_to_jiffies(hba->hibern8_on_idle.delay_ms);
+	delay_in_jiffies = msecs_to_jiffies(ufshcd_pm_policy_delay(hba,
+					hba->hibern8_on_idle.delay_ms,
+					hba->pm_policy.hibern8_exit_us,
+					UFS_PM_HIBERN8_EARLY,
+					UFS_PM_HIBERN8_DEFAULT));
 	if (delay_in_jiffies == 1)
 		delay_in_jiffies++;
 
@@ -1786,6 +1910,7 @@ static void ufshcd_hibern8_exit_work(struct work_struct *work)
 {
 	int ret;
 	unsigned long flags;
+	ktime_t start;
 	struct ufs_hba *hba = container_of(work, struct ufs_hba,
 					   hibern8_on_idle.exit_work);
 
@@ -1803,9 +1928,12 @@ static void ufshcd_hibern8_exit_work(struct work_struct *work)
 	/* Exit from hibern8 */
 	if (ufshcd_is_link_hibern8(hba)) {
 		ufshcd_hold(hba, false);
+		start = ktime_get();
 		ret = ufshcd_uic_hibern8_exit(hba);
 		ufshcd_release(hba, false);
 		if (!ret) {
+			ufshcd_pm_policy_avg(&hba->pm_policy.hibern8_exit_us,
+					ktime_us_delta(ktime_get(), start));
 			spin_lock_irqsave(hba->host->host_lock, flags);
 			ufshcd_set_link_active(hba);
 			hba->hibern8_on_idle.state = HIBERN8_EXITED;
@@ -2646,7 +2774,12 @@ static int ufshcd_queuecommand(struct Scsi_Host *host, struct scsi_cmnd *cmd)
 	lrbp->sense_buffer = cmd->sense_buffer;
 	lrbp->task_tag = tag;
 	lrbp->lun = ufshcd_scsi_to_upiu_lun(cmd->device->lun);
-	lrbp->intr_cmd = !ufshcd_is_intr_aggr_allowed(hba) ? true : false;
+	/*
+	 * A request issued to an idle queue has nothing to be batched with,
+	 * don't let it wait for the aggregation timeout.
+	 */
+	lrbp->intr_cmd = !ufshcd_is_intr_aggr_allowed(hba) ||
+			 !hba->outstanding_reqs;
 	lrbp->command_type = UTP_CMD_TYPE_SCSI;
 	lrbp->req_abort_skip = false;
 
@@ -5144,12 +5277,15 @@ static void ufshcd_transfer_req_compl(struct ufs_hba *hba)
 	 * false interrupt if device completes another request after resetting
 	 * aggregation and before reading the DB.
 	 */
-	if (ufshcd_is_intr_aggr_allowed(hba))
+	if (ufshcd_is_intr_aggr_allowed(hba)) {
+		ufshcd_tune_intr_aggr(hba, hweight_long(hba->outstanding_reqs));
 		ufshcd_reset_intr_aggr(hba);
+	}
 
 	tr_doorbell = ufshcd_readl(hba, REG_UTP_TRANSFER_REQ_DOOR_BELL);
 	completed_reqs = tr_doorbell ^ hba->outstanding_reqs;
 
+	ufshcd_update_intr_batch_stats(hba, hweight_long(completed_reqs));
 	__ufshcd_transfer_req_compl(hba, completed_reqs);
 }
 
@@ -9121,6 +9257,7 @@ int ufshcd_init(struct ufs_hba *hba, void __iomem *mmio_base, unsigned int irq)
 
 	ufshcd_init_clk_gating(hba);
 	ufshcd_init_hibern8_on_idle(hba);
+	hba->pm_policy.is_enabled = true;
 
 	/*
 	 * In order to avoid any spurious interrupt immediately after
@@ -458,6 +458,44 @@ struct ufs_hibern8_on_idle {
 	bool is_enabled;
 };
 
+/* Outcomes of the idle prediction, counted in ufs_pm_policy.decisions */
+enum ufs_pm_policy_decision {
+	UFS_PM_GATE_EARLY,
+	UFS_PM_GATE_DEFAULT,
+	UFS_PM_HIBERN8_EARLY,
+	UFS_PM_HIBERN8_DEFAULT,
+	UFS_PM_MISPREDICT,
+	UFS_PM_DECISION_MAX,
+};
+
+/**
+ * struct ufs_pm_policy - idle prediction shared by clock gating and
+ * hibern8 on idle
+ * @idle_start: time the host last went idle, zero while busy
+ * @predicted_idle_us: moving average of the recent idle periods
+ * @gate_exit_us: moving average of the time taken to ungate the clocks
+ * @hibern8_exit_us: moving average of the time taken to exit hibern8
+ * @early_break_even_us: break-even of the last early decision, checked
+ * against the idle period that actually followed
+ * @decisions: number of times each ufs_pm_policy_decision was taken
+ * @is_enabled: when clear, clock gating and hibern8 on idle only use their
+ * fixed delays
+ *
+ * When the host goes idle and the predicted idle period is long enough
+ * to pay back the exit latency of clock gating or hibern8, that low power
+ * state is entered right away instead of after its fixed delay. The fixed
+ * delays stay as the fallback for idle periods that were not predicted.
+ */
+struct ufs_pm_policy {
+	ktime_t idle_start;
+	u32 predicted_idle_us;
+	u32 gate_exit_us;
+	u32 hibern8_exit_us;
+	u32 early_break_even_us;
+	u32 decisions[UFS_PM_DECISION_MAX];
+	bool is_enabled;
+};
+
 struct ufs_saved_pwr_info {
 	struct ufs_pa_layer_attr info;
 	bool is_valid;
@@ -535,6 +573,7 @@ struct debugfs_files {
 	struct dentry *dbg_print_en;
 	struct dentry *req_stats;
 	struct dentry *query_stats;
+	struct dentry *pm_policy;
 	u32 dme_local_attr_id;
 	u32 dme_peer_attr_id;
 	struct dentry *reset_controller;
@@ -594,6 +633,8 @@ struct ufshcd_req_stat {
  * @tl_err: tracks tl-uic errors
  * @dme_err: tracks dme errors
  */
+#define UFS_INTR_BATCH_BUCKETS	6
+
 struct ufs_stats {
 #ifdef CONFIG_DEBUG_FS
 	bool enabled;
@@ -602,6 +643,8 @@ struct ufs_stats {
 	int err_stats[UFS_ERR_MAX];
 	struct ufshcd_req_stat req_stats[TS_NUM_STATS];
 	int query_stats_arr[UPIU_QUERY_OPCODE_MAX][MAX_QUERY_IDN];
+	/* completion interrupts by number of requests completed, log2 */
+	u64 intr_batch_stats[UFS_INTR_BATCH_BUCKETS];
 
 #endif
 	u32 hibern8_exit_cnt;
@@ -644,6 +687,10 @@ struct ufs_stats {
  * @lrb_in_use: lrb in use
  * @outstanding_tasks: Bits representing outstanding task requests
  * @outstanding_reqs: Bits representing outstanding transfer requests
+ * @intr_aggr_cnt: interrupt aggregation counter threshold programmed
+ * @intr_aggr_tmout: interrupt aggregation timeout programmed, 40us units
+ * @intr_aggr_qd: moving average of the transfer requests outstanding on a
+ *  completion interrupt, in 1/16ths
  * @capabilities: UFS Controller Capabilities
  * @nutrs: Transfer Request Queue depth supported by controller
  * @nutmrs: Task Management Queue depth supported by controller
@@ -682,6 +729,7 @@ struct ufs_stats {
  * @pwr_info: holds current power mode
  * @max_pwr_info: keeps the device max valid pwm
  * @hibern8_on_idle: UFS Hibern8 on idle related data
+ * @pm_policy: idle prediction used by clock gating and hibern8 on idle
  * @urgent_bkops_lvl: keeps track of urgent bkops level for device
  * @is_urgent_bkops_lvl_checked: keeps track if the urgent bkops level for
  *  device is known or not.
@@ -723,6 +771,9 @@ struct ufs_hba {
 
 	unsigned long outstanding_tasks;
 	unsigned long outstanding_reqs;
+	u8 intr_aggr_cnt;
+	u8 intr_aggr_tmout;
+	u32 intr_aggr_qd;
 
 	u32 capabilities;
 	int nutrs;
@@ -841,6 +892,7 @@ struct ufs_hba {
 
 	struct ufs_clk_gating clk_gating;
 	struct ufs_hibern8_on_idle hibern8_on_idle;
+	struct ufs_pm_policy pm_policy;
 
 	/* Control to enable/disable host capabilities */
 	u32 caps;
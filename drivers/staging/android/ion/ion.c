@@ -50,16 +50,12 @@
 /**
  * struct ion_device - the metadata of the ion device node
  * @dev:		the actual misc device
- * @buffers:		an rb tree of all the existing buffers
- * @buffer_lock:	lock protecting the tree of buffers
  * @lock:		rwsem protecting the tree of heaps and clients
  * @heaps:		list of all the heaps in the system
  * @user_clients:	list of all the clients created from userspace
  */
 struct ion_device {
 	struct miscdevice dev;
-	struct rb_root buffers;
-	struct mutex buffer_lock;
 	struct rw_semaphore lock;
 	struct plist_head heaps;
 	long (*custom_ioctl)(struct ion_client *client, unsigned int cmd,
@@ -108,9 +104,13 @@ struct ion_client {
  * @node:		node in the client's handle rbtree
  * @kmap_cnt:		count of times this client has mapped to kernel
  * @id:			client-unique id allocated by client->idr
+ * @rcu:		for freeing the handle after a grace period
  *
  * Modifications to node, map_cnt or mapping should be protected by the
  * lock in the client.  Other fields are never changed after initialization.
+ * Handles are looked up by id under RCU and freed after a grace period, so
+ * that a lookup racing with the final put sees a zero refcount rather than
+ * freed memory.
  */
 struct ion_handle {
 	struct kref ref;
@@ -120,6 +120,7 @@ struct ion_handle {
 	struct rb_node node;
 	unsigned int kmap_cnt;
 	int id;
+	struct rcu_head rcu;
 };
 
 static struct ion_device *ion_dev;
@@ -155,30 +156,23 @@ static inline void ion_buffer_page_clean(struct page **page)
 	*page = (struct page *)((unsigned long)(*page) & ~(1UL));
 }
 
-/* this function should only be called while dev->lock is held */
-static void ion_buffer_add(struct ion_device *dev,
-			   struct ion_buffer *buffer)
+/*
+ * Buffers are only kept on a list for the debugfs accounting, so register
+ * them with their heap rather than in a device wide tree. Allocations from
+ * different heaps then never contend here.
+ */
+static void ion_buffer_add(struct ion_heap *heap, struct ion_buffer *buffer)
 {
-	struct rb_node **p = &dev->buffers.rb_node;
-	struct rb_node *parent = NULL;
-	struct ion_buffer *entry;
-
-	while (*p) {
-		parent = *p;
-		entry = rb_entry(parent, struct ion_buffer, node);
-
-		if (buffer < entry) {
-			p = &(*p)->rb_left;
-		} else if (buffer > entry) {
-			p = &(*p)->rb_right;
-		} else {
-			pr_err("%s: buffer already found.", __func__);
-			BUG();
-		}
-	}
+	spin_lock(&heap->buffer_lock);
+	list_add(&buffer->node, &heap->buffers);
+	spin_unlock(&heap->buffer_lock);
+}
 
-	rb_link_node(&buffer->node, parent, p);
-	rb_insert_color(&buffer->node, &dev->buffers);
+static void ion_buffer_remove(struct ion_heap *heap, struct ion_buffer *buffer)
+{
+	spin_lock(&heap->buffer_lock);
+	list_del(&buffer->node);
+	spin_unlock(&heap->buffer_lock);
 }
 
 /* this function should only be called while dev->lock is held */
@@ -264,9 +258,7 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 		if (sg_dma_address(sg) == 0)
 			sg_dma_address(sg) = sg_phys(sg);
 	}
-	mutex_lock(&dev->buffer_lock);
-	ion_buffer_add(dev, buffer);
-	mutex_unlock(&dev->buffer_lock);
+	ion_buffer_add(heap, buffer);
 	atomic_add(len, &heap->total_allocated);
 	return buffer;
 
@@ -298,13 +290,10 @@ static void _ion_buffer_destroy(struct kref *kref)
 {
 	struct ion_buffer *buffer = container_of(kref, struct ion_buffer, ref);
 	struct ion_heap *heap = buffer->heap;
-	struct ion_device *dev = buffer->dev;
 
 	msm_dma_buf_freed(buffer);
 
-	mutex_lock(&dev->buffer_lock);
-	rb_erase(&buffer->node, &dev->buffers);
-	mutex_unlock(&dev->buffer_lock);
+	ion_buffer_remove(heap, buffer);
 
 	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE)
 		ion_heap_freelist_add(heap, buffer);
@@ -395,7 +384,7 @@ static void ion_handle_destroy(struct kref *kref)
 	ion_buffer_remove_from_handle(buffer);
 	ion_buffer_put(buffer);
 
-	kfree(handle);
+	kfree_rcu(handle, rcu);
 }
 
 struct ion_buffer *ion_handle_buffer(struct ion_handle *handle)
@@ -431,6 +420,10 @@ int ion_handle_put(struct ion_handle *handle)
 	struct ion_client *client = handle->client;
 	int ret;
 
+	/* only the final put needs the client lock, for the idr removal */
+	if (atomic_add_unless(&handle->ref.refcount, -1, 1))
+		return 0;
+
 	mutex_lock(&client->lock);
 	ret = ion_handle_put_nolock(handle);
 	mutex_unlock(&client->lock);
@@ -512,14 +505,38 @@ static struct ion_handle *ion_handle_get_by_id_nolock(struct ion_client *client,
 	return ERR_PTR(-EINVAL);
 }
 
+/*
+ * Lockless counterpart of ion_handle_get_by_id_nolock(). A handle whose
+ * refcount already dropped to zero is about to be removed from the idr by
+ * its final put and is treated as absent.
+ */
 struct ion_handle *ion_handle_get_by_id(struct ion_client *client,
 						int id)
 {
 	struct ion_handle *handle;
+	int old, cur;
 
-	mutex_lock(&client->lock);
-	handle = ion_handle_get_by_id_nolock(client, id);
-	mutex_unlock(&client->lock);
+	rcu_read_lock();
+	handle = idr_find(&client->idr, id);
+	if (!handle) {
+		rcu_read_unlock();
+		return ERR_PTR(-EINVAL);
+	}
+
+	cur = atomic_read(&handle->ref.refcount);
+	do {
+		if (!cur) {
+			handle = ERR_PTR(-EINVAL);
+			break;
+		}
+		if (cur + 1 == 0) {
+			handle = ERR_PTR(-EOVERFLOW);
+			break;
+		}
+		old = cur;
+		cur = atomic_cmpxchg(&handle->ref.refcount, old, old + 1);
+	} while (cur != old);
+	rcu_read_unlock();
 
 	return handle;
 }
@@ -1224,8 +1241,7 @@ static void ion_buffer_sync_for_device(struct ion_buffer *buffer,
 				       enum dma_data_direction dir)
 {
 	struct ion_vma_list *vma_list;
-	int pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
-	int i;
+	pgoff_t start, end, i;
 
 	pr_debug("%s: syncing for device %s\n", __func__,
 		 dev ? dev_name(dev) : "null");
@@ -1234,7 +1250,16 @@ static void ion_buffer_sync_for_device(struct ion_buffer *buffer,
 		return;
 
 	mutex_lock(&buffer->lock);
-	for (i = 0; i < pages; i++) {
+	/*
+	 * Every page that is mapped to userspace was faulted in, and so lies
+	 * within the dirty range. Only that range needs to be synced and
+	 * zapped.
+	 */
+	start = buffer->dirty_start;
+	end = buffer->dirty_end;
+	buffer->dirty_start = buffer->dirty_end = 0;
+
+	for (i = start; i < end; i++) {
 		struct page *page = buffer->pages[i];
 
 		if (ion_buffer_page_is_dirty(page))
@@ -1245,9 +1270,17 @@ static void ion_buffer_sync_for_device(struct ion_buffer *buffer,
 	}
 	list_for_each_entry(vma_list, &buffer->vmas, list) {
 		struct vm_area_struct *vma = vma_list->vma;
+		pgoff_t vma_start = vma->vm_pgoff;
+		pgoff_t vma_end = vma->vm_pgoff + vma_pages(vma);
+		pgoff_t zap_start = max(start, vma_start);
+		pgoff_t zap_end = min(end, vma_end);
 
-		zap_page_range(vma, vma->vm_start, vma->vm_end - vma->vm_start,
-			       NULL);
+		if (zap_start >= zap_end)
+			continue;
+
+		zap_page_range(vma, vma->vm_start +
+			       ((zap_start - vma_start) << PAGE_SHIFT),
+			       (zap_end - zap_start) << PAGE_SHIFT, NULL);
 	}
 	mutex_unlock(&buffer->lock);
 }
@@ -1262,6 +1295,14 @@ static int ion_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	ion_buffer_page_dirty(buffer->pages + vmf->pgoff);
 	BUG_ON(!buffer->pages || !buffer->pages[vmf->pgoff]);
 
+	if (buffer->dirty_start == buffer->dirty_end) {
+		buffer->dirty_start = vmf->pgoff;
+		buffer->dirty_end = vmf->pgoff + 1;
+	} else {
+		buffer->dirty_start = min(buffer->dirty_start, vmf->pgoff);
+		buffer->dirty_end = max(buffer->dirty_end, vmf->pgoff + 1);
+	}
+
 	pfn = page_to_pfn(ion_buffer_page(buffer->pages[vmf->pgoff]));
 	ret = vm_insert_pfn(vma, (unsigned long)vmf->virtual_address, pfn);
 	mutex_unlock(&buffer->lock);
@@ -1826,6 +1867,7 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 	struct ion_heap *heap = s->private;
 	struct ion_device *dev = heap->dev;
 	struct rb_node *n;
+	struct ion_buffer *buffer;
 	size_t total_size = 0;
 	size_t total_orphaned_size = 0;
 
@@ -1854,12 +1896,8 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 	up_read(&dev->lock);
 	seq_puts(s, "----------------------------------------------------\n");
 	seq_puts(s, "orphaned allocations (info is from last known client):\n");
-	mutex_lock(&dev->buffer_lock);
-	for (n = rb_first(&dev->buffers); n; n = rb_next(n)) {
-		struct ion_buffer *buffer = rb_entry(n, struct ion_buffer,
-						     node);
-		if (buffer->heap->id != heap->id)
-			continue;
+	spin_lock(&heap->buffer_lock);
+	list_for_each_entry(buffer, &heap->buffers, node) {
 		total_size += buffer->size;
 		if (!buffer->handle_count) {
 			seq_printf(s, "%16.s %16u %16zu %d %d\n",
@@ -1869,7 +1907,7 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 			total_orphaned_size += buffer->size;
 		}
 	}
-	mutex_unlock(&dev->buffer_lock);
+	spin_unlock(&heap->buffer_lock);
 	seq_puts(s, "----------------------------------------------------\n");
 	seq_printf(s, "%16.s %16zu\n", "total orphaned",
 		   total_orphaned_size);
@@ -1970,6 +2008,8 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap)
 
 	spin_lock_init(&heap->free_lock);
 	heap->free_list_size = 0;
+	INIT_LIST_HEAD(&heap->buffers);
+	spin_lock_init(&heap->buffer_lock);
 
 	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE)
 		ion_heap_init_deferred_free(heap);
@@ -2079,8 +2119,6 @@ struct ion_device *ion_device_create(long (*custom_ioctl)
 debugfs_done:
 
 	idev->custom_ioctl = custom_ioctl;
-	idev->buffers = RB_ROOT;
-	mutex_init(&idev->buffer_lock);
 	init_rwsem(&idev->lock);
 	plist_head_init(&idev->heaps);
 	idev->clients = RB_ROOT;
@@ -42,7 +42,7 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
 /**
  * struct ion_buffer - metadata for a particular buffer
  * @ref:		refernce count
- * @node:		node in the ion_device buffers tree
+ * @node:		node in the heap's list of buffers
  * @dev:		back pointer to the ion_device
  * @heap:		back pointer to the heap the buffer came from
  * @flags:		buffer specific flags
@@ -63,6 +63,9 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  * @pages:		flat array of pages in the buffer -- used by fault
  *			handler and only valid for buffers that are faulted in
  * @vmas:		list of vma's mapping this buffer
+ * @dirty_start:	first page faulted in since the last sync for device
+ * @dirty_end:		one past the last such page, equal to @dirty_start
+ *			when no page is dirty
  * @handle_count:	count of handles referencing this buffer
  * @task_comm:		taskcomm of last client to reference this buffer in a
  *			handle, used for debugging
@@ -72,7 +75,7 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
 struct ion_buffer {
 	struct kref ref;
 	union {
-		struct rb_node node;
+		struct list_head node;
 		struct list_head list;
 	};
 	struct ion_device *dev;
@@ -90,6 +93,8 @@ struct ion_buffer {
 	struct sg_table *sg_table;
 	struct page **pages;
 	struct list_head vmas;
+	pgoff_t dirty_start;
+	pgoff_t dirty_end;
 	/* used to track orphaned buffers */
 	int handle_count;
 	char task_comm[TASK_COMM_LEN];
@@ -173,6 +178,8 @@ struct ion_heap_ops {
  * @free_list:		free list head if deferred free is used
  * @free_list_size	size of the deferred free list in bytes
  * @lock:		protects the free list
+ * @buffers:		list of the buffers allocated from this heap
+ * @buffer_lock:	protects @buffers
  * @waitqueue:		queue to wait on from deferred free thread
  * @task:		task struct of deferred free thread
  * @debug_show:		called when heap debug file is read to add any
@@ -196,6 +203,8 @@ struct ion_heap {
 	struct list_head free_list;
 	size_t free_list_size;
 	spinlock_t free_lock;
+	struct list_head buffers;
+	spinlock_t buffer_lock;
 	wait_queue_head_t waitqueue;
 	struct task_struct *task;
 
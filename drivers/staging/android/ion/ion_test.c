@@ -18,9 +18,13 @@
 #include <linux/dma-buf.h>
 #include <linux/dma-direction.h>
 #include <linux/fs.h>
+#include <linux/completion.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/msm_ion.h>
 #include <linux/platform_device.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
@@ -30,6 +34,8 @@
 #include "ion.h"
 #include "../uapi/ion_test.h"
 
+#define ION_TEST_STRESS_MAX_THREADS	32
+
 #define u64_to_uptr(x) ((void __user *)(unsigned long)(x))
 
 struct ion_test_device {
@@ -143,6 +149,105 @@ err:
 	return ret;
 }
 
+struct ion_test_stress {
+	struct ion_client *client;
+	struct ion_test_stress_data *params;
+	atomic_t running;
+	atomic_t errors;
+	struct completion done;
+};
+
+static int ion_test_stress_thread(void *arg)
+{
+	struct ion_test_stress *stress = arg;
+	struct ion_test_stress_data *params = stress->params;
+	u32 i;
+
+	for (i = 0; i < params->nr_iters; i++) {
+		struct ion_handle *handle;
+		struct dma_buf *dma_buf;
+		struct sg_table *table;
+
+		handle = ion_alloc(stress->client, params->len, PAGE_SIZE,
+				   params->heap_id_mask, params->flags);
+		if (IS_ERR_OR_NULL(handle)) {
+			atomic_inc(&stress->errors);
+			break;
+		}
+
+		dma_buf = ion_share_dma_buf(stress->client, handle);
+		if (IS_ERR(dma_buf)) {
+			atomic_inc(&stress->errors);
+			ion_free(stress->client, handle);
+			break;
+		}
+
+		table = ion_sg_table(stress->client, handle);
+		if (IS_ERR_OR_NULL(table))
+			atomic_inc(&stress->errors);
+
+		dma_buf_put(dma_buf);
+		ion_free(stress->client, handle);
+		cond_resched();
+	}
+
+	if (atomic_dec_and_test(&stress->running))
+		complete(&stress->done);
+	return 0;
+}
+
+static int ion_test_stress(struct ion_test_stress_data *params)
+{
+	struct ion_test_stress stress;
+	ktime_t start;
+	u64 total;
+	u32 i;
+
+	if (!params->nr_threads || !params->nr_iters || !params->len ||
+	    params->nr_threads > ION_TEST_STRESS_MAX_THREADS)
+		return -EINVAL;
+
+	stress.client = msm_ion_client_create("ion-test-stress");
+	if (IS_ERR_OR_NULL(stress.client))
+		return stress.client ? PTR_ERR(stress.client) : -ENODEV;
+
+	stress.params = params;
+	atomic_set(&stress.running, 1);
+	atomic_set(&stress.errors, 0);
+	init_completion(&stress.done);
+
+	start = ktime_get();
+	for (i = 0; i < params->nr_threads; i++) {
+		struct task_struct *task;
+
+		atomic_inc(&stress.running);
+		task = kthread_run(ion_test_stress_thread, &stress,
+				   "ion_stress/%u", i);
+		if (IS_ERR(task)) {
+			atomic_dec(&stress.running);
+			atomic_inc(&stress.errors);
+			break;
+		}
+	}
+	if (!atomic_dec_and_test(&stress.running))
+		wait_for_completion(&stress.done);
+
+	params->elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	total = (u64)params->nr_threads * params->nr_iters;
+	params->ops_per_sec = params->elapsed_ns ?
+		div64_u64(total * NSEC_PER_SEC, params->elapsed_ns) : 0;
+
+	ion_client_destroy(stress.client);
+
+	if (atomic_read(&stress.errors))
+		return -EIO;
+
+	pr_info("%u threads x %u iters of %llu bytes: %llu ops/sec\n",
+		params->nr_threads, params->nr_iters, params->len,
+		params->ops_per_sec);
+	return 0;
+}
+
 static long ion_test_ioctl(struct file *filp, unsigned int cmd,
 						unsigned long arg)
 {
@@ -151,6 +256,7 @@ static long ion_test_ioctl(struct file *filp, unsigned int cmd,
 
 	union {
 		struct ion_test_rw_data test_rw;
+		struct ion_test_stress_data stress;
 	} data;
 
 	if (_IOC_SIZE(cmd) > sizeof(data))
@@ -192,6 +298,11 @@ static long ion_test_ioctl(struct file *filp, unsigned int cmd,
 					data.test_rw.write);
 		break;
 	}
+	case ION_IOC_TEST_STRESS:
+	{
+		ret = ion_test_stress(&data.stress);
+		break;
+	}
 	default:
 		return -ENOTTY;
 	}
@@ -170,7 +170,10 @@ static int ion_no_pages_cache_ops(struct ion_client *client,
 	if (ret)
 		return -EINVAL;
 
-	buff_phys = buff_phys_start;
+	if (offset >= buf_length)
+		return -EINVAL;
+
+	buff_phys = buff_phys_start + offset;
 
 	if (!vaddr) {
 		/*
@@ -178,7 +181,9 @@ static int ion_no_pages_cache_ops(struct ion_client *client,
 		 * order to clean and/or invalidate the cache.
 		 */
 		size_to_vmap = ((VMALLOC_END - VMALLOC_START)/8);
-		total_size = buf_length;
+		total_size = buf_length - offset;
+		if (length)
+			total_size = min_t(unsigned long, total_size, length);
 
 		for (i = 0; i < total_size; i += size_to_vmap) {
 			size_to_vmap = min(size_to_vmap, total_size - i);
@@ -300,14 +305,27 @@ static int ion_pages_cache_ops(struct ion_client *client,
 			return -EINVAL;
 	};
 
+	/*
+	 * Only touch the lines of [offset, offset + length) rather than every
+	 * chunk the range overlaps, so that a client which wrote a small part
+	 * of a large buffer does not pay for maintaining all of it.
+	 */
 	for_each_sg(table->sgl, sg, table->nents, i) {
+		unsigned int sg_start = len;
+		unsigned int start, end;
+
 		len += sg->length;
-		if (len < offset)
+		if (len <= offset)
 			continue;
 
-		__do_cache_ops(sg_page(sg), sg->offset, sg->length, op);
+		start = max(offset, sg_start);
+		end = min(offset + length, len);
+		if (start < end)
+			__do_cache_ops(sg_page(sg),
+				       sg->offset + (start - sg_start),
+				       end - start, op);
 
-		if (len > length + offset)
+		if (len >= length + offset)
 			break;
 	}
 	return 0;
@@ -201,6 +201,19 @@ void sync_pt_free(struct sync_pt *pt)
 }
 EXPORT_SYMBOL(sync_pt_free);
 
+/*
+ * Account for a sync_pt of @fence leaving the active state. The error is
+ * published before the pending count drops so that sync_fence_get_status()
+ * never sees a fence with nothing pending but the error still missing.
+ */
+static void sync_fence_pt_signaled(struct sync_fence *fence, int status)
+{
+	if (status < 0)
+		cmpxchg(&fence->error, 0, status);
+	smp_mb__before_atomic();
+	atomic_dec(&fence->pending);
+}
+
 /* call with pt->parent->active_list_lock held */
 static int _sync_pt_has_signaled(struct sync_pt *pt)
 {
@@ -212,8 +225,10 @@ static int _sync_pt_has_signaled(struct sync_pt *pt)
 	if (!pt->status && pt->parent->destroyed)
 		pt->status = -ENOENT;
 
-	if (pt->status != old_status)
+	if (pt->status != old_status) {
 		pt->timestamp = ktime_get();
+		sync_fence_pt_signaled(pt->fence, pt->status);
+	}
 
 	return pt->status;
 }
@@ -303,6 +318,7 @@ struct sync_fence *sync_fence_create(const char *name, struct sync_pt *pt)
 
 	pt->fence = fence;
 	list_add(&pt->pt_list, &fence->pt_list_head);
+	atomic_set(&fence->pending, 1);
 	sync_pt_activate(pt);
 
 	/*
@@ -315,68 +331,60 @@ struct sync_fence *sync_fence_create(const char *name, struct sync_pt *pt)
 }
 EXPORT_SYMBOL(sync_fence_create);
 
-static int sync_fence_copy_pts(struct sync_fence *dst, struct sync_fence *src)
+static int sync_fence_add_pt(struct sync_fence *dst, struct sync_pt *pt)
 {
-	struct list_head *pos;
+	struct sync_pt *new_pt = sync_pt_dup(pt);
 
-	list_for_each(pos, &src->pt_list_head) {
-		struct sync_pt *orig_pt =
-			container_of(pos, struct sync_pt, pt_list);
-		struct sync_pt *new_pt = sync_pt_dup(orig_pt);
+	if (new_pt == NULL)
+		return -ENOMEM;
 
-		if (new_pt == NULL)
-			return -ENOMEM;
-
-		new_pt->fence = dst;
-		list_add(&new_pt->pt_list, &dst->pt_list_head);
-	}
+	new_pt->fence = dst;
+	list_add_tail(&new_pt->pt_list, &dst->pt_list_head);
+	atomic_inc(&dst->pending);
 
 	return 0;
 }
 
-static int sync_fence_merge_pts(struct sync_fence *dst, struct sync_fence *src)
+/*
+ * The pt lists of fences are kept sorted by timeline, so merging two fences
+ * is a single pass over both lists rather than comparing every pair of pts.
+ */
+static int sync_fence_merge_pts(struct sync_fence *dst, struct sync_fence *a,
+				struct sync_fence *b)
 {
-	struct list_head *src_pos, *dst_pos, *n;
+	struct list_head *a_pos = a->pt_list_head.next;
+	struct list_head *b_pos = b->pt_list_head.next;
+	int err;
+
+	while (a_pos != &a->pt_list_head || b_pos != &b->pt_list_head) {
+		struct sync_pt *a_pt = NULL, *b_pt = NULL;
 
-	list_for_each(src_pos, &src->pt_list_head) {
-		struct sync_pt *src_pt =
-			container_of(src_pos, struct sync_pt, pt_list);
-		bool collapsed = false;
+		if (a_pos != &a->pt_list_head)
+			a_pt = container_of(a_pos, struct sync_pt, pt_list);
+		if (b_pos != &b->pt_list_head)
+			b_pt = container_of(b_pos, struct sync_pt, pt_list);
 
-		list_for_each_safe(dst_pos, n, &dst->pt_list_head) {
-			struct sync_pt *dst_pt =
-				container_of(dst_pos, struct sync_pt, pt_list);
+		if (!b_pt || (a_pt && a_pt->parent < b_pt->parent)) {
+			err = sync_fence_add_pt(dst, a_pt);
+			a_pos = a_pos->next;
+		} else if (!a_pt || b_pt->parent < a_pt->parent) {
+			err = sync_fence_add_pt(dst, b_pt);
+			b_pos = b_pos->next;
+		} else {
 			/* collapse two sync_pts on the same timeline
 			 * to a single sync_pt that will signal at
 			 * the later of the two
 			 */
-			if (dst_pt->parent == src_pt->parent) {
-				if (dst_pt->parent->ops->compare(dst_pt, src_pt)
-						 == -1) {
-					struct sync_pt *new_pt =
-						sync_pt_dup(src_pt);
-					if (new_pt == NULL)
-						return -ENOMEM;
-
-					new_pt->fence = dst;
-					list_replace(&dst_pt->pt_list,
-						     &new_pt->pt_list);
-					sync_pt_free(dst_pt);
-				}
-				collapsed = true;
-				break;
-			}
+			if (a_pt->parent->ops->compare(a_pt, b_pt) == -1)
+				err = sync_fence_add_pt(dst, b_pt);
+			else
+				err = sync_fence_add_pt(dst, a_pt);
+			a_pos = a_pos->next;
+			b_pos = b_pos->next;
 		}
 
-		if (!collapsed) {
-			struct sync_pt *new_pt = sync_pt_dup(src_pt);
-
-			if (new_pt == NULL)
-				return -ENOMEM;
-
-			new_pt->fence = dst;
-			list_add(&new_pt->pt_list, &dst->pt_list_head);
-		}
+		if (err < 0)
+			return err;
 	}
 
 	return 0;
@@ -436,22 +444,19 @@ EXPORT_SYMBOL(sync_fence_install);
 
 static int sync_fence_get_status(struct sync_fence *fence)
 {
-	struct list_head *pos;
-	int status = 1;
+	int error = ACCESS_ONCE(fence->error);
 
-	list_for_each(pos, &fence->pt_list_head) {
-		struct sync_pt *pt = container_of(pos, struct sync_pt, pt_list);
-		int pt_status = pt->status;
+	if (error)
+		return error;
 
-		if (pt_status < 0) {
-			status = pt_status;
-			break;
-		} else if (status == 1) {
-			status = pt_status;
-		}
-	}
+	if (atomic_read(&fence->pending))
+		return 0;
 
-	return status;
+	/* pairs with the barrier in sync_fence_pt_signaled() */
+	smp_rmb();
+	error = ACCESS_ONCE(fence->error);
+
+	return error ? error : 1;
 }
 
 struct sync_fence *sync_fence_merge(const char *name,
@@ -465,11 +470,7 @@ struct sync_fence *sync_fence_merge(const char *name,
 	if (fence == NULL)
 		return NULL;
 
-	err = sync_fence_copy_pts(fence, a);
-	if (err < 0)
-		goto err;
-
-	err = sync_fence_merge_pts(fence, b);
+	err = sync_fence_merge_pts(fence, a, b);
 	if (err < 0)
 		goto err;
 
@@ -701,6 +702,150 @@ static long sync_fence_ioctl_wait(struct sync_fence *fence, unsigned long arg)
 	return sync_fence_wait(fence, value);
 }
 
+/*
+ * State of one SYNC_IOC_WAIT_MULTI call. @signaled and @callbacks are
+ * protected by wq.lock, which the waiter callbacks hold while touching
+ * this structure so that the ioctl can tell when none of them is still
+ * running.
+ */
+struct sync_multi_wait {
+	wait_queue_head_t	wq;
+	int			signaled;
+	int			callbacks;
+};
+
+struct sync_multi_waiter {
+	struct sync_fence_waiter	waiter;
+	struct sync_multi_wait		*wait;
+	bool				registered;
+};
+
+static void sync_multi_wait_callback(struct sync_fence *fence,
+				     struct sync_fence_waiter *waiter)
+{
+	struct sync_multi_waiter *w =
+		container_of(waiter, struct sync_multi_waiter, waiter);
+	struct sync_multi_wait *wait = w->wait;
+	unsigned long flags;
+
+	spin_lock_irqsave(&wait->wq.lock, flags);
+	wait->signaled++;
+	wait->callbacks++;
+	wake_up_locked(&wait->wq);
+	spin_unlock_irqrestore(&wait->wq.lock, flags);
+}
+
+static long sync_fence_ioctl_wait_multi(struct sync_fence *fence,
+					unsigned long arg)
+{
+	struct sync_wait_multi_data data;
+	struct sync_multi_wait wait;
+	struct sync_multi_waiter *waiters;
+	struct sync_fence **fences;
+	__s32 *fds;
+	int registered = 0, cancelled = 0;
+	int needed, i;
+	long timeout;
+	long err = 0;
+
+	if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
+		return -EFAULT;
+
+	if (!data.count || data.count > SYNC_WAIT_MULTI_MAX ||
+	    (data.flags & ~SYNC_WAIT_MULTI_ALL) || data.pad)
+		return -EINVAL;
+
+	fds = kcalloc(data.count, sizeof(*fds), GFP_KERNEL);
+	fences = kcalloc(data.count, sizeof(*fences), GFP_KERNEL);
+	waiters = kcalloc(data.count, sizeof(*waiters), GFP_KERNEL);
+	if (!fds || !fences || !waiters) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	if (copy_from_user(fds, (void __user *)(unsigned long)data.fds,
+			   data.count * sizeof(*fds))) {
+		err = -EFAULT;
+		goto out_free;
+	}
+
+	for (i = 0; i < data.count; i++) {
+		fences[i] = sync_fence_fdget(fds[i]);
+		if (fences[i] == NULL) {
+			err = -ENOENT;
+			goto out_put;
+		}
+	}
+
+	init_waitqueue_head(&wait.wq);
+	wait.signaled = 0;
+	wait.callbacks = 0;
+	needed = (data.flags & SYNC_WAIT_MULTI_ALL) ? data.count : 1;
+
+	/* register every waiter before sleeping once for all of them */
+	for (i = 0; i < data.count; i++) {
+		sync_fence_waiter_init(&waiters[i].waiter,
+				       sync_multi_wait_callback);
+		waiters[i].wait = &wait;
+
+		if (sync_fence_wait_async(fences[i], &waiters[i].waiter)) {
+			spin_lock_irq(&wait.wq.lock);
+			wait.signaled++;
+			spin_unlock_irq(&wait.wq.lock);
+		} else {
+			waiters[i].registered = true;
+			registered++;
+		}
+	}
+
+	if (data.timeout > 0) {
+		timeout = msecs_to_jiffies(data.timeout);
+		err = wait_event_interruptible_timeout(wait.wq,
+				ACCESS_ONCE(wait.signaled) >= needed, timeout);
+	} else if (data.timeout < 0) {
+		err = wait_event_interruptible(wait.wq,
+				ACCESS_ONCE(wait.signaled) >= needed);
+	}
+
+	/*
+	 * A waiter that could not be cancelled has already been taken off
+	 * its fence and its callback is running or about to run. Wait for
+	 * those, then take wq.lock once so the last of them is out of its
+	 * critical section before wait goes out of scope.
+	 */
+	for (i = 0; i < data.count; i++) {
+		if (waiters[i].registered &&
+		    !sync_fence_cancel_async(fences[i], &waiters[i].waiter))
+			cancelled++;
+	}
+	wait_event(wait.wq, ACCESS_ONCE(wait.callbacks) ==
+			    registered - cancelled);
+	spin_lock_irq(&wait.wq.lock);
+	spin_unlock_irq(&wait.wq.lock);
+
+	if (err >= 0)
+		err = wait.signaled >= needed ? 0 : -ETIME;
+
+	/* pairs with the status update in sync_fence_signal_pt() */
+	smp_rmb();
+	for (i = 0; i < data.count; i++)
+		fds[i] = fences[i]->status;
+
+	if (copy_to_user((void __user *)(unsigned long)data.status, fds,
+			 data.count * sizeof(*fds)))
+		err = -EFAULT;
+
+	i = data.count;
+out_put:
+	while (i--)
+		sync_fence_put(fences[i]);
+out_free:
+	kfree(waiters);
+	kfree(fences);
+	kfree(fds);
+	return err;
+}
+
 static long sync_fence_ioctl_merge(struct sync_fence *fence, unsigned long arg)
 {
 	int fd = get_unused_fd_flags(O_CLOEXEC);
@@ -844,6 +989,9 @@ static long sync_fence_ioctl(struct file *file, unsigned int cmd,
 	case SYNC_IOC_FENCE_INFO:
 		return sync_fence_ioctl_fence_info(fence, arg);
 
+	case SYNC_IOC_WAIT_MULTI:
+		return sync_fence_ioctl_wait_multi(fence, arg);
+
 	default:
 		return -ENOTTY;
 	}
@@ -35,6 +35,26 @@ struct ion_test_rw_data {
 	int __padding;
 };
 
+/**
+ * struct ion_test_stress_data - parameters and result of a stress run
+ * @len:		size of each allocation
+ * @heap_id_mask:	heaps to allocate from
+ * @flags:		allocation flags
+ * @nr_threads:		number of kernel threads to run concurrently
+ * @nr_iters:		alloc/share/free cycles per thread
+ * @elapsed_ns:		returned wall clock time of the run
+ * @ops_per_sec:	returned alloc/share/free cycles per second
+ */
+struct ion_test_stress_data {
+	__u64 len;
+	__u32 heap_id_mask;
+	__u32 flags;
+	__u32 nr_threads;
+	__u32 nr_iters;
+	__u64 elapsed_ns;
+	__u64 ops_per_sec;
+};
+
 #define ION_IOC_MAGIC		'I'
 
 /**
@@ -66,5 +86,16 @@ struct ion_test_rw_data {
 #define ION_IOC_TEST_KERNEL_MAPPING \
 			_IOW(ION_IOC_MAGIC, 0xf2, struct ion_test_rw_data)
 
+/**
+ * DOC: ION_IOC_TEST_STRESS - measure concurrent alloc/share/free throughput
+ *
+ * Runs nr_threads kernel threads that share one ion client and each
+ * allocate, share, look up and free a buffer nr_iters times, then reports
+ * the throughput.  Only expected to be used for debugging and testing, may
+ * not always be available.
+ */
+#define ION_IOC_TEST_STRESS \
+			_IOWR(ION_IOC_MAGIC, 0xf3, struct ion_test_stress_data)
+
 
 #endif /* _UAPI_LINUX_ION_H */
@@ -271,47 +271,73 @@ int f2fs_reserve_block(struct dnode_of_data *dn, pgoff_t index)
 	return err;
 }
 
+static void map_extent_bh(struct inode *inode, pgoff_t pgofs,
+			struct extent_info *ei, struct buffer_head *bh_result)
+{
+	unsigned int blkbits = inode->i_sb->s_blocksize_bits;
+	size_t count;
+
+	clear_buffer_new(bh_result);
+	map_bh(bh_result, inode->i_sb, ei->blk_addr + pgofs - ei->fofs);
+	count = ei->fofs + ei->len - pgofs;
+	if (count < (UINT_MAX >> blkbits))
+		bh_result->b_size = (count << blkbits);
+	else
+		bh_result->b_size = UINT_MAX;
+}
+
 static int check_extent_cache(struct inode *inode, pgoff_t pgofs,
 					struct buffer_head *bh_result)
 {
 	struct f2fs_inode_info *fi = F2FS_I(inode);
-	pgoff_t start_fofs, end_fofs;
-	block_t start_blkaddr;
+	struct extent_info ei;
 
-	if (is_inode_flag_set(fi, FI_NO_EXTENT))
-		return 0;
+	stat_inc_total_hit(inode->i_sb);
 
-	read_lock(&fi->ext.ext_lock);
-	if (fi->ext.len == 0) {
+	/* the largest extent kept in the inode comes first */
+	if (!is_inode_flag_set(fi, FI_NO_EXTENT)) {
+		read_lock(&fi->ext.ext_lock);
+		if (fi->ext.len && pgofs >= fi->ext.fofs &&
+				pgofs < fi->ext.fofs + fi->ext.len) {
+			ei.fofs = fi->ext.fofs;
+			ei.blk_addr = fi->ext.blk_addr;
+			ei.len = fi->ext.len;
+			read_unlock(&fi->ext.ext_lock);
+			map_extent_bh(inode, pgofs, &ei, bh_result);
+			stat_inc_read_hit(inode->i_sb);
+			return 1;
+		}
 		read_unlock(&fi->ext.ext_lock);
-		return 0;
 	}
 
-	stat_inc_total_hit(inode->i_sb);
+	if (f2fs_lookup_extent_tree(inode, pgofs, &ei)) {
+		map_extent_bh(inode, pgofs, &ei, bh_result);
+		return 1;
+	}
+	return 0;
+}
 
-	start_fofs = fi->ext.fofs;
-	end_fofs = fi->ext.fofs + fi->ext.len - 1;
-	start_blkaddr = fi->ext.blk_addr;
+/*
+ * Cache the run of consecutive block addresses which starts at the
+ * current offset of the locked dnode. Since every block address update
+ * is done under the dnode lock, the cached run can not go stale.
+ */
+static void cache_dnode_extent(struct dnode_of_data *dn, pgoff_t pgofs)
+{
+	struct f2fs_inode_info *fi = F2FS_I(dn->inode);
+	unsigned int ofs = dn->ofs_in_node;
+	unsigned int end_offset = ADDRS_PER_PAGE(dn->node_page, fi);
+	block_t blkaddr = dn->data_blkaddr;
+	unsigned int len = 1;
 
-	if (pgofs >= start_fofs && pgofs <= end_fofs) {
-		unsigned int blkbits = inode->i_sb->s_blocksize_bits;
-		size_t count;
+	if (blkaddr == NULL_ADDR || blkaddr == NEW_ADDR)
+		return;
 
-		clear_buffer_new(bh_result);
-		map_bh(bh_result, inode->i_sb,
-				start_blkaddr + pgofs - start_fofs);
-		count = end_fofs - pgofs + 1;
-		if (count < (UINT_MAX >> blkbits))
-			bh_result->b_size = (count << blkbits);
-		else
-			bh_result->b_size = UINT_MAX;
+	while (++ofs < end_offset &&
+			datablock_addr(dn->node_page, ofs) == blkaddr + len)
+		len++;
 
-		stat_inc_read_hit(inode->i_sb);
-		read_unlock(&fi->ext.ext_lock);
-		return 1;
-	}
-	read_unlock(&fi->ext.ext_lock);
-	return 0;
+	f2fs_insert_extent_tree(dn->inode, pgofs, blkaddr, len);
 }
 
 void update_extent_cache(block_t blk_addr, struct dnode_of_data *dn)
@@ -328,6 +354,8 @@ void update_extent_cache(block_t blk_addr, struct dnode_of_data *dn)
 	/* Update the page address in the parent node */
 	__set_data_blkaddr(dn, blk_addr);
 
+	f2fs_drop_extent_tree(dn->inode, fofs);
+
 	if (is_inode_flag_set(fi, FI_NO_EXTENT))
 		return;
 
@@ -650,6 +678,9 @@ static int __get_data_block(struct inode *inode, sector_t iblock,
 	if (dn.data_blkaddr == NEW_ADDR && !fiemap)
 		goto put_out;
 
+	if (!create && !fiemap)
+		cache_dnode_extent(&dn, pgofs);
+
 	if (dn.data_blkaddr != NULL_ADDR) {
 		map_bh(bh_result, inode->i_sb, dn.data_blkaddr);
 	} else if (create) {
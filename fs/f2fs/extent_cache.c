@@ -0,0 +1,375 @@
+/*
+ * fs/f2fs/extent_cache.c
+ *
+ * Copyright (c) 2012 Samsung Electronics Co., Ltd.
+ *             http://www.samsung.com/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/fs.h>
+#include <linux/f2fs_fs.h>
+#include <linux/rbtree.h>
+#include <linux/shrinker.h>
+
+#include "f2fs.h"
+#include "node.h"
+
+static struct kmem_cache *extent_node_slab;
+
+static inline unsigned int en_end(struct extent_node *en)
+{
+	return en->fofs + en->len;
+}
+
+void f2fs_init_extent_tree(struct inode *inode)
+{
+	struct extent_tree *et = &F2FS_I(inode)->ext_tree;
+
+	et->root = RB_ROOT;
+	et->cached_en = NULL;
+	rwlock_init(&et->lock);
+	et->count = 0;
+}
+
+/*
+ * Find the extent node which covers @fofs.
+ * If there is no such node, return NULL.
+ */
+static struct extent_node *__lookup_extent_node(struct extent_tree *et,
+							unsigned int fofs)
+{
+	struct rb_node *node = et->root.rb_node;
+	struct extent_node *en = et->cached_en;
+
+	if (en && en->fofs <= fofs && fofs < en_end(en))
+		return en;
+
+	while (node) {
+		en = rb_entry(node, struct extent_node, rb_node);
+
+		if (fofs < en->fofs)
+			node = node->rb_left;
+		else if (fofs >= en_end(en))
+			node = node->rb_right;
+		else
+			return en;
+	}
+	return NULL;
+}
+
+/*
+ * Find the first extent node which ends at or after @fofs, so that a node
+ * adjacent to the front of @fofs is also returned for merging.
+ */
+static struct extent_node *__lookup_extent_node_ge(struct extent_tree *et,
+							unsigned int fofs)
+{
+	struct rb_node *node = et->root.rb_node;
+	struct extent_node *en, *ret = NULL;
+
+	while (node) {
+		en = rb_entry(node, struct extent_node, rb_node);
+
+		if (en_end(en) >= fofs) {
+			ret = en;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+	return ret;
+}
+
+static inline struct extent_node *__next_node(struct extent_node *en)
+{
+	struct rb_node *node = rb_next(&en->rb_node);
+
+	return node ? rb_entry(node, struct extent_node, rb_node) : NULL;
+}
+
+static void __link_extent_node(struct f2fs_sb_info *sbi,
+			struct extent_tree *et, struct extent_node *en)
+{
+	struct rb_node **p = &et->root.rb_node;
+	struct rb_node *parent = NULL;
+	struct extent_node *cur;
+
+	while (*p) {
+		parent = *p;
+		cur = rb_entry(parent, struct extent_node, rb_node);
+
+		if (en->fofs < cur->fofs)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&en->rb_node, parent, p);
+	rb_insert_color(&en->rb_node, &et->root);
+	en->et = et;
+	et->count++;
+
+	spin_lock(&sbi->extent_lock);
+	list_add_tail(&en->list, &sbi->extent_list);
+	spin_unlock(&sbi->extent_lock);
+	atomic_inc(&sbi->total_ext_node);
+}
+
+/* caller should hold et->lock for write and sbi->extent_lock */
+static void __detach_extent_node(struct f2fs_sb_info *sbi,
+			struct extent_tree *et, struct extent_node *en)
+{
+	rb_erase(&en->rb_node, &et->root);
+	list_del(&en->list);
+	et->count--;
+	atomic_dec(&sbi->total_ext_node);
+
+	if (et->cached_en == en)
+		et->cached_en = NULL;
+}
+
+static void __free_extent_node(struct f2fs_sb_info *sbi,
+			struct extent_tree *et, struct extent_node *en)
+{
+	spin_lock(&sbi->extent_lock);
+	__detach_extent_node(sbi, et, en);
+	spin_unlock(&sbi->extent_lock);
+	kmem_cache_free(extent_node_slab, en);
+}
+
+bool f2fs_lookup_extent_tree(struct inode *inode, pgoff_t pgofs,
+						struct extent_info *ei)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	struct extent_tree *et = &F2FS_I(inode)->ext_tree;
+	struct extent_node *en;
+
+	read_lock(&et->lock);
+	en = __lookup_extent_node(et, pgofs);
+	if (!en) {
+		read_unlock(&et->lock);
+		return false;
+	}
+
+	ei->fofs = en->fofs;
+	ei->blk_addr = en->blk_addr;
+	ei->len = en->len;
+
+	if (et->cached_en == en) {
+		stat_inc_cached_hit(inode->i_sb);
+	} else {
+		stat_inc_rbtree_hit(inode->i_sb);
+		et->cached_en = en;
+	}
+
+	spin_lock(&sbi->extent_lock);
+	list_move_tail(&en->list, &sbi->extent_list);
+	spin_unlock(&sbi->extent_lock);
+	read_unlock(&et->lock);
+	return true;
+}
+
+/*
+ * Cache the mapping [fofs, fofs + len) -> [blk_addr, blk_addr + len).
+ * Cached nodes always reflect the current block mapping, so overlapping
+ * nodes and physically contiguous neighbours are merged into one extent.
+ */
+void f2fs_insert_extent_tree(struct inode *inode, pgoff_t fofs,
+					block_t blk_addr, unsigned int len)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	struct extent_tree *et = &F2FS_I(inode)->ext_tree;
+	struct extent_node *en, *next, *new;
+	unsigned int start = fofs, end = fofs + len;
+	block_t start_blkaddr = blk_addr;
+
+	if (!len)
+		return;
+
+	new = kmem_cache_alloc(extent_node_slab, GFP_NOFS);
+	if (!new)
+		return;
+
+	write_lock(&et->lock);
+	en = __lookup_extent_node_ge(et, start);
+
+	/* extend the new extent with the physically contiguous nodes */
+	for (next = en; next && next->fofs <= end; next = __next_node(next)) {
+		if (next->blk_addr - next->fofs != start_blkaddr - start)
+			continue;
+		if (next->fofs <= start && en_end(next) >= end)
+			goto out_free;
+		if (next->fofs < start) {
+			start_blkaddr = next->blk_addr;
+			start = next->fofs;
+		}
+		end = max(end, en_end(next));
+	}
+
+	if (end - start < F2FS_MIN_EXTENT_LEN)
+		goto out_free;
+
+	/* drop the nodes overlapped by the new extent */
+	while (en && en->fofs < end) {
+		next = __next_node(en);
+		if (en_end(en) > start)
+			__free_extent_node(sbi, et, en);
+		en = next;
+	}
+
+	new->fofs = start;
+	new->blk_addr = start_blkaddr;
+	new->len = end - start;
+	__link_extent_node(sbi, et, new);
+	et->cached_en = new;
+	write_unlock(&et->lock);
+	return;
+out_free:
+	write_unlock(&et->lock);
+	kmem_cache_free(extent_node_slab, new);
+}
+
+/*
+ * The block address of @fofs is going to be changed, so drop it from the
+ * cached extent, and keep the remaining parts if they are still long enough.
+ */
+void f2fs_drop_extent_tree(struct inode *inode, pgoff_t fofs)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	struct extent_tree *et = &F2FS_I(inode)->ext_tree;
+	struct extent_node *en, *back;
+	unsigned int front_len, back_len;
+
+	if (!et->count)
+		return;
+
+	write_lock(&et->lock);
+	en = __lookup_extent_node(et, fofs);
+	if (!en)
+		goto out;
+
+	front_len = fofs - en->fofs;
+	back_len = en_end(en) - fofs - 1;
+
+	if (back_len >= F2FS_MIN_EXTENT_LEN &&
+			front_len >= F2FS_MIN_EXTENT_LEN) {
+		back = kmem_cache_alloc(extent_node_slab, GFP_ATOMIC);
+		if (back) {
+			back->fofs = fofs + 1;
+			back->blk_addr = en->blk_addr + front_len + 1;
+			back->len = back_len;
+			en->len = front_len;
+			__link_extent_node(sbi, et, back);
+			goto out;
+		}
+		/* keep the larger part only */
+		if (front_len >= back_len)
+			back_len = 0;
+		else
+			front_len = 0;
+	}
+
+	if (front_len >= F2FS_MIN_EXTENT_LEN) {
+		en->len = front_len;
+	} else if (back_len >= F2FS_MIN_EXTENT_LEN) {
+		en->fofs = fofs + 1;
+		en->blk_addr += front_len + 1;
+		en->len = back_len;
+	} else {
+		__free_extent_node(sbi, et, en);
+	}
+out:
+	write_unlock(&et->lock);
+}
+
+void f2fs_destroy_extent_tree(struct inode *inode)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	struct extent_tree *et = &F2FS_I(inode)->ext_tree;
+	struct extent_node *en;
+	struct rb_node *node;
+
+	write_lock(&et->lock);
+	while ((node = rb_first(&et->root))) {
+		en = rb_entry(node, struct extent_node, rb_node);
+		__free_extent_node(sbi, et, en);
+	}
+	write_unlock(&et->lock);
+}
+
+static unsigned long f2fs_extent_count(struct shrinker *shrink,
+					struct shrink_control *sc)
+{
+	struct f2fs_sb_info *sbi = container_of(shrink,
+				struct f2fs_sb_info, extent_shrinker);
+
+	return atomic_read(&sbi->total_ext_node);
+}
+
+/*
+ * Reclaim the least recently used extent nodes. The lock order is et->lock
+ * followed by sbi->extent_lock, so only trylock the tree here and skip the
+ * nodes whose tree is busy.
+ */
+static unsigned long f2fs_extent_scan(struct shrinker *shrink,
+					struct shrink_control *sc)
+{
+	struct f2fs_sb_info *sbi = container_of(shrink,
+				struct f2fs_sb_info, extent_shrinker);
+	struct extent_node *en, *tmp;
+	unsigned long nr_to_scan = sc->nr_to_scan;
+	unsigned long freed = 0;
+	LIST_HEAD(free_list);
+
+	spin_lock(&sbi->extent_lock);
+	list_for_each_entry_safe(en, tmp, &sbi->extent_list, list) {
+		struct extent_tree *et = en->et;
+
+		if (!nr_to_scan--)
+			break;
+		if (!write_trylock(&et->lock))
+			continue;
+		__detach_extent_node(sbi, et, en);
+		write_unlock(&et->lock);
+		list_add(&en->list, &free_list);
+		freed++;
+	}
+	spin_unlock(&sbi->extent_lock);
+
+	list_for_each_entry_safe(en, tmp, &free_list, list)
+		kmem_cache_free(extent_node_slab, en);
+	return freed;
+}
+
+int init_extent_cache_info(struct f2fs_sb_info *sbi)
+{
+	INIT_LIST_HEAD(&sbi->extent_list);
+	spin_lock_init(&sbi->extent_lock);
+	atomic_set(&sbi->total_ext_node, 0);
+
+	sbi->extent_shrinker.count_objects = f2fs_extent_count;
+	sbi->extent_shrinker.scan_objects = f2fs_extent_scan;
+	sbi->extent_shrinker.seeks = DEFAULT_SEEKS;
+	return register_shrinker(&sbi->extent_shrinker);
+}
+
+void destroy_extent_cache_info(struct f2fs_sb_info *sbi)
+{
+	unregister_shrinker(&sbi->extent_shrinker);
+	f2fs_bug_on(sbi, atomic_read(&sbi->total_ext_node));
+}
+
+int __init create_extent_cache(void)
+{
+	extent_node_slab = f2fs_kmem_cache_create("f2fs_extent_node",
+			sizeof(struct extent_node));
+	if (!extent_node_slab)
+		return -ENOMEM;
+	return 0;
+}
+
+void destroy_extent_cache(void)
+{
+	kmem_cache_destroy(extent_node_slab);
+}
@@ -241,6 +241,29 @@ struct extent_info {
 	unsigned int len;	/* length of the extent */
 };
 
+/*
+ * Read-side extent cache: every inode keeps an rb-tree of extents found
+ * while mapping data blocks, and all extent nodes of a superblock are
+ * chained in an LRU list so that the shrinker can reclaim them.
+ */
+struct extent_tree;
+
+struct extent_node {
+	struct rb_node rb_node;		/* rb node located in rb-tree */
+	struct list_head list;		/* node in global extent lru list */
+	struct extent_tree *et;		/* extent tree this node belongs to */
+	unsigned int fofs;		/* start offset in a file */
+	u32 blk_addr;			/* start block address of the extent */
+	unsigned int len;		/* length of the extent */
+};
+
+struct extent_tree {
+	struct rb_root root;		/* root of extent node rb-tree */
+	struct extent_node *cached_en;	/* recently accessed extent node */
+	rwlock_t lock;			/* protect extent node rb-tree */
+	unsigned int count;		/* # of extent nodes in rb-tree */
+};
+
 /*
  * i_advise uses FADVISE_XXX_BIT. We can add additional hints later.
  */
@@ -267,6 +290,7 @@ struct f2fs_inode_info {
 	nid_t i_xattr_nid;		/* node id that contains xattrs */
 	unsigned long long xattr_ver;	/* cp version of xattr modification */
 	struct extent_info ext;		/* in-memory extent cache entry */
+	struct extent_tree ext_tree;	/* read-side extent cache tree */
 	struct dir_inode_entry *dirty_dir;	/* the pointer of dirty dir */
 
 	struct list_head inmem_pages;	/* inmemory pages managed by f2fs */
@@ -375,6 +399,7 @@ enum {
 struct flush_cmd {
 	struct completion wait;
 	struct llist_node llnode;
+	nid_t ino;			/* fsync'ed inode, or 0 for flush only */
 	int ret;
 };
 
@@ -383,6 +408,7 @@ struct flush_cmd_control {
 	wait_queue_head_t flush_wait_queue;	/* waiting queue for wake-up */
 	struct llist_head issue_list;		/* list for command issue */
 	struct llist_node *dispatch_list;	/* list for command dispatch */
+	unsigned int last_nr_fsync;		/* # of fsyncs in last group */
 };
 
 struct f2fs_sm_info {
@@ -413,6 +439,7 @@ struct f2fs_sm_info {
 	unsigned int ipu_policy;	/* in-place-update policy */
 	unsigned int min_ipu_util;	/* in-place-update threshold */
 	unsigned int min_fsync_blocks;	/* threshold for fsync */
+	unsigned int fsync_group_window;	/* group commit window in usec */
 
 	/* for flush command control */
 	struct flush_cmd_control *cmd_control_info;
@@ -513,6 +540,12 @@ struct f2fs_sb_info {
 	struct list_head dir_inode_list;	/* dir inode list */
 	spinlock_t dir_inode_lock;		/* for dir inode list lock */
 
+	/* for extent tree cache */
+	struct list_head extent_list;		/* lru list of extent nodes */
+	spinlock_t extent_lock;			/* for extent lru list lock */
+	atomic_t total_ext_node;		/* # of cached extent nodes */
+	struct shrinker extent_shrinker;	/* reclaim extent nodes */
+
 	/* basic filesystem units */
 	unsigned int log_sectors_per_block;	/* log2 sectors per block */
 	unsigned int log_blocksize;		/* log2 block size */
@@ -557,6 +590,7 @@ struct f2fs_sb_info {
 	unsigned int segment_count[2];		/* # of allocated segments */
 	unsigned int block_count[2];		/* # of allocated blocks */
 	int total_hit_ext, read_hit_ext;	/* extent cache hit ratio */
+	int read_hit_rbtree, read_hit_cached;	/* extent tree hit ratio */
 	int inline_inode;			/* # of inline_data inodes */
 	int bg_gc;				/* background gc calls */
 	unsigned int n_dirty_dirs;		/* # of dir inodes */
@@ -1279,6 +1313,7 @@ struct page *get_node_page(struct f2fs_sb_info *, pgoff_t);
 struct page *get_node_page_ra(struct page *, int);
 void sync_inode_page(struct dnode_of_data *);
 int sync_node_pages(struct f2fs_sb_info *, nid_t, struct writeback_control *);
+int fsync_node_pages(struct f2fs_sb_info *, nid_t, struct writeback_control *);
 bool alloc_nid(struct f2fs_sb_info *, nid_t *);
 void alloc_nid_done(struct f2fs_sb_info *, nid_t);
 void alloc_nid_failed(struct f2fs_sb_info *, nid_t);
@@ -1301,6 +1336,7 @@ void commit_inmem_pages(struct inode *, bool);
 void f2fs_balance_fs(struct f2fs_sb_info *);
 void f2fs_balance_fs_bg(struct f2fs_sb_info *);
 int f2fs_issue_flush(struct f2fs_sb_info *);
+int f2fs_issue_fsync(struct f2fs_sb_info *, nid_t);
 int create_flush_cmd_control(struct f2fs_sb_info *);
 void destroy_flush_cmd_control(struct f2fs_sb_info *);
 void invalidate_blocks(struct f2fs_sb_info *, block_t);
@@ -1376,6 +1412,19 @@ struct page *get_new_data_page(struct inode *, struct page *, pgoff_t, bool);
 int do_write_data_page(struct page *, struct f2fs_io_info *);
 int f2fs_fiemap(struct inode *inode, struct fiemap_extent_info *, u64, u64);
 
+/*
+ * extent_cache.c
+ */
+void f2fs_init_extent_tree(struct inode *);
+bool f2fs_lookup_extent_tree(struct inode *, pgoff_t, struct extent_info *);
+void f2fs_insert_extent_tree(struct inode *, pgoff_t, block_t, unsigned int);
+void f2fs_drop_extent_tree(struct inode *, pgoff_t);
+void f2fs_destroy_extent_tree(struct inode *);
+int init_extent_cache_info(struct f2fs_sb_info *);
+void destroy_extent_cache_info(struct f2fs_sb_info *);
+int __init create_extent_cache(void);
+void destroy_extent_cache(void);
+
 /*
  * gc.c
  */
@@ -1402,7 +1451,8 @@ struct f2fs_stat_info {
 	struct f2fs_sb_info *sbi;
 	int all_area_segs, sit_area_segs, nat_area_segs, ssa_area_segs;
 	int main_area_segs, main_area_sections, main_area_zones;
-	int hit_ext, total_ext;
+	int hit_ext, total_ext, hit_rbtree, hit_cached;
+	int ext_node;
 	int ndirty_node, ndirty_dent, ndirty_dirs, ndirty_meta;
 	int nats, sits, fnids;
 	int total_count, utilization;
@@ -1436,6 +1486,8 @@ static inline struct f2fs_stat_info *F2FS_STAT(struct f2fs_sb_info *sbi)
 #define stat_dec_dirty_dir(sbi)		((sbi)->n_dirty_dirs--)
 #define stat_inc_total_hit(sb)		((F2FS_SB(sb))->total_hit_ext++)
 #define stat_inc_read_hit(sb)		((F2FS_SB(sb))->read_hit_ext++)
+#define stat_inc_rbtree_hit(sb)		((F2FS_SB(sb))->read_hit_rbtree++)
+#define stat_inc_cached_hit(sb)		((F2FS_SB(sb))->read_hit_cached++)
 #define stat_inc_inline_inode(inode)					\
 	do {								\
 		if (f2fs_has_inline_data(inode))			\
@@ -1491,6 +1543,8 @@ void f2fs_destroy_root_stats(void);
 #define stat_dec_dirty_dir(sbi)
 #define stat_inc_total_hit(sb)
 #define stat_inc_read_hit(sb)
+#define stat_inc_rbtree_hit(sb)
+#define stat_inc_cached_hit(sb)
 #define stat_inc_inline_inode(inode)
 #define stat_dec_inline_inode(inode)
 #define stat_inc_seg_type(sbi, curseg)
@@ -217,7 +217,7 @@ go_write:
 		}
 	} else {
 sync_nodes:
-		sync_node_pages(sbi, ino, &wbc);
+		fsync_node_pages(sbi, ino, &wbc);
 
 		if (need_inode_block_update(sbi, ino)) {
 			mark_inode_dirty_sync(inode);
@@ -227,13 +227,17 @@ sync_nodes:
 			goto sync_nodes;
 		}
 
-		ret = wait_on_node_pages_writeback(sbi, ino);
+		/* submit and wait for the dnodes, and flush with other fsyncs */
+		ret = f2fs_issue_fsync(sbi, ino);
 		if (ret)
 			goto out;
 
 		/* once recovery info is written, don't need to tack this */
 		remove_dirty_inode(sbi, ino, APPEND_INO);
 		clear_inode_flag(fi, FI_APPEND_WRITE);
+		remove_dirty_inode(sbi, ino, UPDATE_INO);
+		clear_inode_flag(fi, FI_UPDATE_WRITE);
+		goto out;
 flush_out:
 		remove_dirty_inode(sbi, ino, UPDATE_INO);
 		clear_inode_flag(fi, FI_UPDATE_WRITE);
@@ -275,6 +275,7 @@ void f2fs_evict_inode(struct inode *inode)
 
 	trace_f2fs_evict_inode(inode);
 	truncate_inode_pages_final(&inode->i_data);
+	f2fs_destroy_extent_tree(inode);
 
 	if (inode->i_ino == F2FS_NODE_INO(sbi) ||
 			inode->i_ino == F2FS_META_INO(sbi))
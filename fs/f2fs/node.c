@@ -1114,8 +1114,8 @@ void sync_inode_page(struct dnode_of_data *dn)
 	}
 }
 
-int sync_node_pages(struct f2fs_sb_info *sbi, nid_t ino,
-					struct writeback_control *wbc)
+static int __sync_node_pages(struct f2fs_sb_info *sbi, nid_t ino,
+				struct writeback_control *wbc, bool submit)
 {
 	pgoff_t index, end;
 	struct pagevec pvec;
@@ -1217,11 +1217,28 @@ continue_unlock:
 		goto next_step;
 	}
 
-	if (wrote)
+	if (wrote && submit)
 		f2fs_submit_merged_bio(sbi, NODE, WRITE);
 	return nwritten;
 }
 
+int sync_node_pages(struct f2fs_sb_info *sbi, nid_t ino,
+					struct writeback_control *wbc)
+{
+	return __sync_node_pages(sbi, ino, wbc, true);
+}
+
+/*
+ * Write the dirty dnodes of @ino with fsync marks for roll-forward recovery.
+ * The merged node bio is not submitted here, so that the dnodes of the
+ * concurrent fsyncs can be sent down together by f2fs_issue_fsync().
+ */
+int fsync_node_pages(struct f2fs_sb_info *sbi, nid_t ino,
+					struct writeback_control *wbc)
+{
+	return __sync_node_pages(sbi, ino, wbc, false);
+}
+
 int wait_on_node_pages_writeback(struct f2fs_sb_info *sbi, nid_t ino)
 {
 	pgoff_t index = 0, end = LONG_MAX;
@@ -16,6 +16,7 @@
 #include <linux/kthread.h>
 #include <linux/vmalloc.h>
 #include <linux/swap.h>
+#include <linux/delay.h>
 
 #include "f2fs.h"
 #include "segment.h"
@@ -262,22 +263,49 @@ repeat:
 		return 0;
 
 	if (!llist_empty(&fcc->issue_list)) {
-		struct bio *bio = bio_alloc(GFP_NOIO, 0);
+		unsigned int window = SM_I(sbi)->fsync_group_window;
 		struct flush_cmd *cmd, *next;
-		int ret;
+		unsigned int nr_fsync = 0;
+		int ret = 0;
+
+		/*
+		 * If the last group had several fsyncs, the other threads are
+		 * likely writing their dnodes now, so let them join this group.
+		 */
+		if (fcc->last_nr_fsync > 1 && window)
+			usleep_range(window, window << 1);
 
 		fcc->dispatch_list = llist_del_all(&fcc->issue_list);
 		fcc->dispatch_list = llist_reverse_order(fcc->dispatch_list);
 
-		bio->bi_bdev = sbi->sb->s_bdev;
-		ret = submit_bio_wait(WRITE_FLUSH, bio);
+		llist_for_each_entry(cmd, fcc->dispatch_list, llnode)
+			if (cmd->ino)
+				nr_fsync++;
+
+		/* the dnodes of all the fsyncs go down in one merged bio */
+		if (nr_fsync) {
+			f2fs_submit_merged_bio(sbi, NODE, WRITE_SYNC);
+			llist_for_each_entry(cmd, fcc->dispatch_list, llnode)
+				if (cmd->ino)
+					cmd->ret = wait_on_node_pages_writeback(
+								sbi, cmd->ino);
+		}
+
+		if (!test_opt(sbi, NOBARRIER)) {
+			struct bio *bio = bio_alloc(GFP_NOIO, 0);
+
+			bio->bi_bdev = sbi->sb->s_bdev;
+			ret = submit_bio_wait(WRITE_FLUSH, bio);
+			bio_put(bio);
+		}
 
 		llist_for_each_entry_safe(cmd, next,
 					  fcc->dispatch_list, llnode) {
-			cmd->ret = ret;
+			if (!cmd->ret)
+				cmd->ret = ret;
 			complete(&cmd->wait);
 		}
-		bio_put(bio);
+		fcc->last_nr_fsync = nr_fsync;
 		fcc->dispatch_list = NULL;
 	}
 
@@ -286,10 +314,27 @@ repeat:
 	goto repeat;
 }
 
+static int __queue_flush_cmd(struct flush_cmd_control *fcc, nid_t ino)
+{
+	struct flush_cmd cmd;
+
+	cmd.ino = ino;
+	cmd.ret = 0;
+	init_completion(&cmd.wait);
+
+	llist_add(&cmd.llnode, &fcc->issue_list);
+
+	if (!fcc->dispatch_list)
+		wake_up(&fcc->flush_wait_queue);
+
+	wait_for_completion(&cmd.wait);
+
+	return cmd.ret;
+}
+
 int f2fs_issue_flush(struct f2fs_sb_info *sbi)
 {
 	struct flush_cmd_control *fcc = SM_I(sbi)->cmd_control_info;
-	struct flush_cmd cmd;
 
 	trace_f2fs_issue_flush(sbi->sb, test_opt(sbi, NOBARRIER),
 					test_opt(sbi, FLUSH_MERGE));
@@ -300,16 +345,27 @@ int f2fs_issue_flush(struct f2fs_sb_info *sbi)
 	if (!test_opt(sbi, FLUSH_MERGE))
 		return blkdev_issue_flush(sbi->sb->s_bdev, GFP_KERNEL, NULL);
 
-	init_completion(&cmd.wait);
-
-	llist_add(&cmd.llnode, &fcc->issue_list);
+	return __queue_flush_cmd(fcc, 0);
+}
 
-	if (!fcc->dispatch_list)
-		wake_up(&fcc->flush_wait_queue);
+/*
+ * Commit the dnodes written by fsync_node_pages() for @ino.
+ * With flush_merge, the concurrent fsyncs are grouped by the flush thread,
+ * which submits their dnodes in one bio and issues a single cache flush.
+ */
+int f2fs_issue_fsync(struct f2fs_sb_info *sbi, nid_t ino)
+{
+	struct flush_cmd_control *fcc = SM_I(sbi)->cmd_control_info;
+	int ret;
 
-	wait_for_completion(&cmd.wait);
+	if (test_opt(sbi, FLUSH_MERGE) && fcc)
+		return __queue_flush_cmd(fcc, ino);
 
-	return cmd.ret;
+	f2fs_submit_merged_bio(sbi, NODE, WRITE_SYNC);
+	ret = wait_on_node_pages_writeback(sbi, ino);
+	if (ret)
+		return ret;
+	return f2fs_issue_flush(sbi);
 }
 
 int create_flush_cmd_control(struct f2fs_sb_info *sbi)
@@ -2061,6 +2117,7 @@ int build_segment_manager(struct f2fs_sb_info *sbi)
 	sm_info->ipu_policy = 1 << F2FS_IPU_FSYNC;
 	sm_info->min_ipu_util = DEF_MIN_IPU_UTIL;
 	sm_info->min_fsync_blocks = DEF_MIN_FSYNC_BLOCKS;
+	sm_info->fsync_group_window = DEF_FSYNC_GROUP_WINDOW;
 
 	INIT_LIST_HEAD(&sm_info->discard_list);
 	sm_info->nr_discards = 0;
@@ -495,6 +495,13 @@ static inline int utilization(struct f2fs_sb_info *sbi)
 #define DEF_MIN_IPU_UTIL	70
 #define DEF_MIN_FSYNC_BLOCKS	8
 
+/*
+ * The flush thread waits for this many usecs before dispatching a group of
+ * fsyncs, but only when the last group had more than one fsync in it.
+ */
+#define DEF_FSYNC_GROUP_WINDOW	100
+#define MAX_FSYNC_GROUP_WINDOW	5000	/* every fsync waits up to twice this */
+
 enum {
 	F2FS_IPU_FORCE,
 	F2FS_IPU_SSR,
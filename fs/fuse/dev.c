@@ -22,6 +22,7 @@
 #include <linux/splice.h>
 #include <linux/aio.h>
 #include <linux/freezer.h>
+#include <linux/hash.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 MODULE_ALIAS("devname:fuse");
@@ -301,6 +302,11 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 	return nbytes;
 }
 
+static unsigned int fuse_req_hash(u64 unique)
+{
+	return hash_64(unique, FUSE_PQ_HASH_BITS);
+}
+
 static u64 fuse_get_unique(struct fuse_conn *fc)
 {
 	fc->reqctr++;
@@ -311,17 +317,57 @@ static u64 fuse_get_unique(struct fuse_conn *fc)
 	return fc->reqctr;
 }
 
+static struct fuse_iqueue *fuse_local_iqueue(struct fuse_conn *fc)
+{
+	return &fc->iq[raw_smp_processor_id() % FUSE_NR_IQUEUES];
+}
+
+/*
+ * Wake up one reader, preferring the ones sleeping on @iq, and the pollers.
+ *
+ * Called with fc->lock held, which readers also hold while checking for
+ * pending requests, so the wakeup can't be lost.
+ */
+static void fuse_wake_up_reader(struct fuse_conn *fc, struct fuse_iqueue *iq)
+{
+	int i;
+
+	if (waitqueue_active(&iq->waitq)) {
+		wake_up(&iq->waitq);
+	} else {
+		for (i = 0; i < FUSE_NR_IQUEUES; i++) {
+			if (waitqueue_active(&fc->iq[i].waitq)) {
+				wake_up(&fc->iq[i].waitq);
+				break;
+			}
+		}
+	}
+	if (waitqueue_active(&fc->waitq))
+		wake_up(&fc->waitq);
+}
+
+void fuse_wake_up_all_readers(struct fuse_conn *fc)
+{
+	int i;
+
+	for (i = 0; i < FUSE_NR_IQUEUES; i++)
+		wake_up_all(&fc->iq[i].waitq);
+	wake_up_all(&fc->waitq);
+}
+
 static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_iqueue *iq = fuse_local_iqueue(fc);
+
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
+	list_add_tail(&req->list, &iq->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
 		atomic_inc(&fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
+	fuse_wake_up_reader(fc, iq);
 	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 }
 
@@ -335,7 +381,7 @@ void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 	if (fc->connected) {
 		fc->forget_list_tail->next = forget;
 		fc->forget_list_tail = forget;
-		wake_up(&fc->waitq);
+		fuse_wake_up_reader(fc, fuse_local_iqueue(fc));
 		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 	} else {
 		kfree(forget);
@@ -417,7 +463,7 @@ __acquires(fc->lock)
 static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
 {
 	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
+	fuse_wake_up_reader(fc, fuse_local_iqueue(fc));
 	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 }
 
@@ -1008,10 +1054,51 @@ static int forget_pending(struct fuse_conn *fc)
 	return fc->forget_list_head.next != NULL;
 }
 
+/*
+ * Return the first pending request and the index of its queue.
+ *
+ * Readers look at the queue of the current CPU first and then at the
+ * queues of the other CPUs.  To keep a busy local queue from starving
+ * the others, every FUSE_IQ_BATCH requests the scan instead starts from
+ * fc->iq_next, which fuse_iqueue_advance() moves round-robin.
+ */
+static struct fuse_req *first_pending_request(struct fuse_conn *fc,
+					      unsigned *idxp)
+{
+	unsigned start, idx, i;
+
+	if (fc->iq_batch > 0)
+		start = raw_smp_processor_id() % FUSE_NR_IQUEUES;
+	else
+		start = fc->iq_next;
+
+	for (i = 0; i < FUSE_NR_IQUEUES; i++) {
+		idx = (start + i) % FUSE_NR_IQUEUES;
+		if (!list_empty(&fc->iq[idx].pending)) {
+			*idxp = idx;
+			return list_entry(fc->iq[idx].pending.next,
+					  struct fuse_req, list);
+		}
+	}
+	return NULL;
+}
+
+/* Called after a request was taken from queue @idx */
+static void fuse_iqueue_advance(struct fuse_conn *fc, unsigned idx)
+{
+	if (fc->iq_batch-- > 0)
+		return;
+
+	fc->iq_next = (idx + 1) % FUSE_NR_IQUEUES;
+	fc->iq_batch = FUSE_IQ_BATCH;
+}
+
 static int request_pending(struct fuse_conn *fc)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	unsigned idx;
+
+	return first_pending_request(fc, &idx) ||
+		!list_empty(&fc->interrupts) || forget_pending(fc);
 }
 
 /* Wait until a request is available on the pending list */
@@ -1020,8 +1107,9 @@ __releases(fc->lock)
 __acquires(fc->lock)
 {
 	DECLARE_WAITQUEUE(wait, current);
+	struct fuse_iqueue *iq = fuse_local_iqueue(fc);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
+	add_wait_queue_exclusive(&iq->waitq, &wait);
 	while (fc->connected && !request_pending(fc)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
@@ -1032,7 +1120,7 @@ __acquires(fc->lock)
 		spin_lock(&fc->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&iq->waitq, &wait);
 }
 
 /*
@@ -1203,6 +1291,7 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
+	unsigned idx;
 
  restart:
 	spin_lock(&fc->lock);
@@ -1225,15 +1314,16 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		return fuse_read_interrupt(fc, cs, nbytes, req);
 	}
 
+	req = first_pending_request(fc, &idx);
 	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
+		if (!req || fc->forget_batch-- > 0)
 			return fuse_read_forget(fc, cs, nbytes);
 
 		if (fc->forget_batch <= -8)
 			fc->forget_batch = 16;
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	fuse_iqueue_advance(fc, idx);
 	req->state = FUSE_REQ_READING;
 	list_move(&req->list, &fc->io);
 
@@ -1270,7 +1360,8 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list, &fc->processing[fuse_req_hash(
+							req->in.h.unique)]);
 		if (req->interrupted)
 			queue_interrupt(fc, req);
 		spin_unlock(&fc->lock);
@@ -1754,15 +1845,28 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 	}
 }
 
-/* Look up request on processing list by unique ID */
+/*
+ * Look up request on processing list by unique ID
+ *
+ * Replies to interrupts carry the unique ID of the interrupt, which is
+ * hashed to a different bucket, so those have to search all of them.
+ */
 static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
 {
 	struct fuse_req *req;
+	unsigned int i;
 
-	list_for_each_entry(req, &fc->processing, list) {
-		if (req->in.h.unique == unique || req->intr_unique == unique)
+	list_for_each_entry(req, &fc->processing[fuse_req_hash(unique)], list) {
+		if (req->in.h.unique == unique)
 			return req;
 	}
+
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++) {
+		list_for_each_entry(req, &fc->processing[i], list) {
+			if (req->intr_unique == unique)
+				return req;
+		}
+	}
 	return NULL;
 }
 
@@ -2060,10 +2164,14 @@ static void end_queued_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	int i;
+
 	fc->max_background = UINT_MAX;
 	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
+	for (i = 0; i < FUSE_NR_IQUEUES; i++)
+		end_requests(fc, &fc->iq[i].pending);
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		end_requests(fc, &fc->processing[i]);
 	while (forget_pending(fc))
 		kfree(dequeue_forget(fc, 1, NULL));
 }
@@ -2112,7 +2220,7 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		end_io_requests(fc);
 		end_queued_requests(fc);
 		end_polls(fc);
-		wake_up_all(&fc->waitq);
+		fuse_wake_up_all_readers(fc);
 		wake_up_all(&fc->blocked_waitq);
 		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 	}
@@ -991,6 +991,10 @@ static ssize_t fuse_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
 	struct fuse_conn *fc = get_fuse_conn(inode);
 	struct fuse_file *ff = iocb->ki_filp->private_data;
 
+	/* the lower file keeps its own size, no need to ask the daemon */
+	if (ff && ff->shortcircuit_enabled && ff->rw_lower_file)
+		return fuse_shortcircuit_read_iter(iocb, to);
+
 	/*
 	 * In auto invalidate mode, always update attributes on read.
 	 * Otherwise, only update if we attempt to read past EOF (to ensure
@@ -1004,10 +1008,7 @@ static ssize_t fuse_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
 			return err;
 	}
 
-	if (ff && ff->shortcircuit_enabled && ff->rw_lower_file)
-		ret_val = fuse_shortcircuit_read_iter(iocb, to);
-	else
-		ret_val = generic_file_read_iter(iocb, to);
+	ret_val = generic_file_read_iter(iocb, to);
 
 	return ret_val;
 }
@@ -1250,8 +1251,9 @@ static ssize_t fuse_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 	ssize_t err;
 	loff_t endbyte = 0;
 	loff_t pos = iocb->ki_pos;
+	bool shortcircuit = ff && ff->shortcircuit_enabled && ff->rw_lower_file;
 
-	if (get_fuse_conn(inode)->writeback_cache) {
+	if (get_fuse_conn(inode)->writeback_cache && !shortcircuit) {
 		/* Update size (EOF optimization) and mode (SUID clearing) */
 		err = fuse_update_attributes(mapping->host, NULL, file, NULL);
 		if (err)
@@ -1281,7 +1283,9 @@ static ssize_t fuse_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 	if (err)
 		goto out;
 
-	if (ff && ff->shortcircuit_enabled && ff->rw_lower_file) {
+	if (shortcircuit) {
+		/* generic_write_checks() may have moved pos for O_APPEND */
+		iocb->ki_pos = pos;
 		written = fuse_shortcircuit_write_iter(iocb, from);
 		goto out;
 	}
@@ -2178,6 +2182,9 @@ static int fuse_file_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	struct fuse_file *ff = file->private_data;
 
+	if (ff->shortcircuit_enabled && ff->rw_lower_file)
+		return fuse_shortcircuit_mmap(file, vma);
+
 	ff->shortcircuit_enabled = 0;
 	if ((vma->vm_flags & VM_SHARED) && (vma->vm_flags & VM_MAYWRITE))
 		fuse_link_write_file(file);
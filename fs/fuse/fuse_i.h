@@ -47,6 +47,16 @@
 /** Number of page pointers embedded in fuse_req */
 #define FUSE_REQ_INLINE_PAGES 1
 
+/** Number of per-CPU input queues of a connection */
+#define FUSE_NR_IQUEUES (NR_CPUS < 8 ? NR_CPUS : 8)
+
+/** Number of requests a reader takes from its own queue in a row */
+#define FUSE_IQ_BATCH 16
+
+/** Number of hash buckets for requests being processed by userspace */
+#define FUSE_PQ_HASH_BITS 6
+#define FUSE_PQ_HASH_SIZE (1 << FUSE_PQ_HASH_BITS)
+
 /** List of active connections */
 extern struct list_head fuse_conn_list;
 
@@ -371,6 +381,21 @@ struct fuse_req {
 	struct file *private_lower_rw_file;
 };
 
+/**
+ * A per-CPU input queue of a connection.
+ *
+ * Requests are queued on the queue of the CPU they were submitted from,
+ * and readers sleep on the queue of the CPU they are running on, so that
+ * CPU-affine daemon threads mostly pick up the requests of their own CPU.
+ */
+struct fuse_iqueue {
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** Readers running on this CPU are waiting on this */
+	wait_queue_head_t waitq;
+};
+
 /**
  * A Fuse connection.
  *
@@ -402,14 +427,20 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
+	/** Pollers of the connection are waiting on this */
 	wait_queue_head_t waitq;
 
-	/** The list of pending requests */
-	struct list_head pending;
+	/** Per-CPU queues of pending requests */
+	struct fuse_iqueue iq[FUSE_NR_IQUEUES];
+
+	/** Queue the next round-robin pick starts from */
+	unsigned iq_next;
 
-	/** The list of requests being processed */
-	struct list_head processing;
+	/** Requests left to take from the local queue before a round-robin pick */
+	int iq_batch;
+
+	/** The requests being processed, hashed by unique ID */
+	struct list_head processing[FUSE_PQ_HASH_SIZE];
 
 	/** The list of requests under I/O */
 	struct list_head io;
@@ -800,6 +831,9 @@ void fuse_request_send_background_locked(struct fuse_conn *fc,
 /* Abort all requests */
 void fuse_abort_conn(struct fuse_conn *fc);
 
+/* Wake up all the readers and pollers of the connection */
+void fuse_wake_up_all_readers(struct fuse_conn *fc);
+
 /**
  * Invalidate inode attributes
  */
@@ -72,8 +72,10 @@ static ssize_t fuse_shortcircuit_read_write_iter(struct kiocb *iocb,
 	lower_inode = file_inode(lower_file);
 
 	if (do_write) {
-		if (!lower_file->f_op->write_iter)
-			return -EIO;
+		if (!lower_file->f_op->write_iter) {
+			ret_val = -EIO;
+			goto out;
+		}
 		ret_val = lower_file->f_op->write_iter(iocb, iter);
 
 		if (ret_val >= 0 || ret_val == -EIOCBQUEUED) {
@@ -83,13 +85,16 @@ static ssize_t fuse_shortcircuit_read_write_iter(struct kiocb *iocb,
 			fsstack_copy_attr_times(fuse_inode, lower_inode);
 		}
 	} else {
-		if (!lower_file->f_op->read_iter)
-			return -EIO;
+		if (!lower_file->f_op->read_iter) {
+			ret_val = -EIO;
+			goto out;
+		}
 		ret_val = lower_file->f_op->read_iter(iocb, iter);
 		if (ret_val >= 0 || ret_val == -EIOCBQUEUED)
 			fsstack_copy_attr_atime(fuse_inode, lower_inode);
 	}
 
+out:
 	iocb->ki_filp = fuse_file;
 	fput(lower_file);
 	/* unlock lower file */
@@ -107,6 +112,36 @@ ssize_t fuse_shortcircuit_write_iter(struct kiocb *iocb, struct iov_iter *from)
 	return fuse_shortcircuit_read_write_iter(iocb, from, 1);
 }
 
+/*
+ * Map the lower file directly, so that page faults are served from the
+ * lower page cache without going through the daemon.
+ */
+int fuse_shortcircuit_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	int ret;
+	struct fuse_file *ff = file->private_data;
+	struct file *lower_file = ff->rw_lower_file;
+
+	if (!lower_file->f_op->mmap)
+		return -ENODEV;
+
+	if (WARN_ON(file != vma->vm_file))
+		return -EIO;
+
+	/* the lower file backs the mapping from now on */
+	vma->vm_file = get_file(lower_file);
+	ret = lower_file->f_op->mmap(lower_file, vma);
+	if (ret) {
+		vma->vm_file = file;
+		fput(lower_file);
+		return ret;
+	}
+	fput(file);
+
+	fsstack_copy_attr_atime(file_inode(file), file_inode(lower_file));
+	return 0;
+}
+
 void fuse_shortcircuit_release(struct fuse_file *ff)
 {
 	if (!(ff->rw_lower_file))
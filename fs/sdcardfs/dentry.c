@@ -105,6 +105,10 @@ static int sdcardfs_d_revalidate(struct dentry *dentry, unsigned int flags)
 		spin_unlock(&lower_dentry->d_lock);
 	}
 
+	/* the package list may have changed since the last access */
+	if (err == 1)
+		revalidate_derived_permission(dentry);
+
 out:
 	dput(parent_dentry);
 	dput(lower_cur_parent_dentry);
@@ -55,12 +55,19 @@ void setup_derived_state_for_multiuser_gid(struct inode *inode, perm_t perm,
 	info->d_gid = multiuser_get_uid(userid, gid);
 }
 
-void get_derived_permission(struct dentry *parent, struct dentry *dentry, bool locked)
+void get_derived_permission(struct dentry *parent, struct dentry *dentry)
 {
 	struct sdcardfs_sb_info *sbi = SDCARDFS_SB(dentry->d_sb);
 	struct sdcardfs_inode_info *info = SDCARDFS_I(dentry->d_inode);
 	struct sdcardfs_inode_info *parent_info= SDCARDFS_I(parent->d_inode);
+	void *pkgl_id;
 	appid_t appid = 0;
+	unsigned int gen;
+
+	/* Sample the generation before looking at the package list, so that
+	 * a concurrent reload leaves this inode marked as stale. */
+	gen = atomic_read(&pkgl_generation);
+	smp_rmb();
 
 	/* By default, each inode inherits from its parent.
 	 * the properties are maintained on its private fields
@@ -116,31 +123,24 @@ void get_derived_permission(struct dentry *parent, struct dentry *dentry, bool l
 		case PERM_ANDROID_DATA:
 		case PERM_ANDROID_OBB:
 		case PERM_ANDROID_MEDIA:
-			if(sbi->pkgl_id != NULL) {
-				void * g_pkgl_dat = get_pkgl_dat_pkglid(sbi->pkgl_id);
-				if(g_pkgl_dat!=NULL) {
-					if(!locked)
-						packagelist_lock(g_pkgl_dat);
-
-					/* sbi->pkgl_id can be NULL in packagelist_destroy()
-					 * so, we should check it is NULL or not again */
-					if(sbi->pkgl_id != NULL)
-						appid = get_appid(sbi->pkgl_id, dentry->d_name.name);
-
-					if(!locked)
-						packagelist_unlock(g_pkgl_dat);
-				}
-			}
+			/* sbi->pkgl_id can be cleared in packagelist_destroy(),
+			 * which waits for a grace period before freeing it */
+			rcu_read_lock();
+			pkgl_id = ACCESS_ONCE(sbi->pkgl_id);
+			if (pkgl_id != NULL)
+				appid = get_appid(pkgl_id, dentry->d_name.name);
+			rcu_read_unlock();
 
 			if (appid != 0) {
 				info->d_uid = multiuser_get_uid(parent_info->userid, appid);
 			}
 			break;
 	}
+	info->perm_gen = gen;
 }
 
 /* Based on d_walk() at dcache.c to avoid using recursive calls */
-void get_derived_permission_recursive(struct dentry *parent, bool locked)
+void get_derived_permission_recursive(struct dentry *parent)
 {
 	struct dentry *this_parent;
 	struct list_head *next;
@@ -164,7 +164,7 @@ resume:
 		/* Re-derive permission and just change uid/gid
 		 * instead of calling the fix_derived_permission(). */
 		if(dentry->d_inode){
-			get_derived_permission(this_parent, dentry, locked);
+			get_derived_permission(this_parent, dentry);
 			dentry->d_inode->i_uid = SDCARDFS_I(dentry->d_inode)->d_uid;
 			dentry->d_inode->i_gid = SDCARDFS_I(dentry->d_inode)->d_gid;
 		}
@@ -242,7 +242,7 @@ inline void update_derived_permission(struct dentry *dentry)
 	} else {
 		parent = dget_parent(dentry);
 		if(parent) {
-			get_derived_permission(parent, dentry, false);
+			get_derived_permission(parent, dentry);
 			dput(parent);
 		}
 	}
@@ -251,6 +251,39 @@ inline void update_derived_permission(struct dentry *dentry)
     fix_derived_permission(dentry->d_inode, mask);
 }
 
+static inline bool derived_permission_stale(struct dentry *dentry)
+{
+	return !IS_ROOT(dentry) && dentry->d_inode &&
+		SDCARDFS_I(dentry->d_inode)->perm_gen !=
+			atomic_read(&pkgl_generation);
+}
+
+/* A reload of packages.list only bumps pkgl_generation, and the derived
+ * permission of each inode is brought up to date here the next time it is
+ * used. Ancestors are refreshed first since the children inherit from them.
+ */
+void revalidate_derived_permission(struct dentry *dentry)
+{
+	struct dentry *cur, *parent;
+	int mask = SDCARDFS_SB(dentry->d_sb)->options.sdfs_mask;
+
+	while (derived_permission_stale(dentry)) {
+		/* find the topmost stale ancestor */
+		cur = dget(dentry);
+		for (;;) {
+			parent = dget_parent(cur);
+			if (!derived_permission_stale(parent))
+				break;
+			dput(cur);
+			cur = parent;
+		}
+		get_derived_permission(parent, cur);
+		fix_derived_permission(cur->d_inode, mask);
+		dput(parent);
+		dput(cur);
+	}
+}
+
 int need_graft_path(struct dentry *dentry)
 {
 	int ret = 0;
@@ -19,23 +19,16 @@
  */
 
 #include "sdcardfs.h"
+#include <linux/aio.h>
 #ifdef CONFIG_SDCARD_FS_FADV_NOACTIVE
 #include <linux/backing-dev.h>
 #endif
 
-static ssize_t sdcardfs_read(struct file *file, char __user *buf,
-			   size_t count, loff_t *ppos)
-{
-	int err;
-	struct file *lower_file;
-	struct dentry *dentry = file->f_path.dentry;
 #ifdef CONFIG_SDCARD_FS_FADV_NOACTIVE
+static void sdcardfs_set_noactive(struct file *file, struct file *lower_file)
+{
 	struct backing_dev_info *bdi;
-#endif
 
-	lower_file = sdcardfs_lower_file(file);
-
-#ifdef CONFIG_SDCARD_FS_FADV_NOACTIVE
 	if (file->f_mode & FMODE_NOACTIVE) {
 		if (!(lower_file->f_mode & FMODE_NOACTIVE)) {
 			bdi = lower_file->f_mapping->backing_dev_info;
@@ -45,38 +38,157 @@ static ssize_t sdcardfs_read(struct file *file, char __user *buf,
 			spin_unlock(&lower_file->f_lock);
 		}
 	}
+}
+#else
+static inline void sdcardfs_set_noactive(struct file *file,
+					struct file *lower_file) { }
 #endif
 
-	err = vfs_read(lower_file, buf, count, ppos);
+/*
+ * Reads and writes are handed to the lower file's iter methods, so that
+ * the lower file system serves them from its own page cache and direct
+ * I/O reaches it unchanged. The caller's kiocb belongs to the sdcardfs
+ * file and may be an AIO request, so the lower file gets a private sync
+ * kiocb instead, and queued lower I/O is waited for before returning.
+ */
+static ssize_t sdcardfs_lower_read_iter(struct kiocb *iocb,
+				struct file *lower_file, struct iov_iter *iter)
+{
+	struct kiocb lower_iocb;
+	ssize_t err;
+
+	init_sync_kiocb(&lower_iocb, lower_file);
+	lower_iocb.ki_pos = iocb->ki_pos;
+	lower_iocb.ki_nbytes = iov_iter_count(iter);
+
+	err = lower_file->f_op->read_iter(&lower_iocb, iter);
+	if (err == -EIOCBQUEUED)
+		err = wait_on_sync_kiocb(&lower_iocb);
+	iocb->ki_pos = lower_iocb.ki_pos;
+
+	return err;
+}
+
+static ssize_t sdcardfs_lower_write_iter(struct kiocb *iocb,
+				struct file *lower_file, struct iov_iter *iter)
+{
+	struct kiocb lower_iocb;
+	ssize_t err;
+
+	init_sync_kiocb(&lower_iocb, lower_file);
+	lower_iocb.ki_pos = iocb->ki_pos;
+	lower_iocb.ki_nbytes = iov_iter_count(iter);
+
+	file_start_write(lower_file);
+	err = lower_file->f_op->write_iter(&lower_iocb, iter);
+	if (err == -EIOCBQUEUED)
+		err = wait_on_sync_kiocb(&lower_iocb);
+	file_end_write(lower_file);
+	iocb->ki_pos = lower_iocb.ki_pos;
+
+	return err;
+}
+
+static ssize_t sdcardfs_read_iter(struct kiocb *iocb, struct iov_iter *iter)
+{
+	ssize_t err;
+	struct file *file = iocb->ki_filp;
+	struct file *lower_file;
+	struct dentry *dentry = file->f_path.dentry;
+
+	lower_file = sdcardfs_lower_file(file);
+	if (!lower_file->f_op->read_iter)
+		return -EINVAL;
+
+	sdcardfs_set_noactive(file, lower_file);
+
+	err = sdcardfs_lower_read_iter(iocb, lower_file, iter);
 	/* update our inode atime upon a successful lower read */
 	if (err >= 0)
 		fsstack_copy_attr_atime(dentry->d_inode,
-					lower_file->f_path.dentry->d_inode);
+					file_inode(lower_file));
 
 	return err;
 }
 
-static ssize_t sdcardfs_write(struct file *file, const char __user *buf,
-			    size_t count, loff_t *ppos)
+static ssize_t sdcardfs_write_iter(struct kiocb *iocb, struct iov_iter *iter)
 {
-	int err = 0;
+	ssize_t err;
+	struct file *file = iocb->ki_filp;
 	struct file *lower_file;
 	struct dentry *dentry = file->f_path.dentry;
 
 	/* check disk space */
-	if (!check_min_free_space(dentry, count, 0)) {
+	if (!check_min_free_space(dentry, iov_iter_count(iter), 0)) {
 		printk(KERN_INFO "No minimum free space.\n");
 		return -ENOSPC;
 	}
 
 	lower_file = sdcardfs_lower_file(file);
-	err = vfs_write(lower_file, buf, count, ppos);
+	if (!lower_file->f_op->write_iter)
+		return -EINVAL;
+
+	err = sdcardfs_lower_write_iter(iocb, lower_file, iter);
 	/* update our inode times+sizes upon a successful lower write */
 	if (err >= 0) {
 		fsstack_copy_inode_size(dentry->d_inode,
-					lower_file->f_path.dentry->d_inode);
+					file_inode(lower_file));
+		fsstack_copy_attr_times(dentry->d_inode,
+					file_inode(lower_file));
+	}
+
+	return err;
+}
+
+/* the pages of the lower page cache are spliced without a copy */
+static ssize_t sdcardfs_splice_read(struct file *file, loff_t *ppos,
+				struct pipe_inode_info *pipe, size_t len,
+				unsigned int flags)
+{
+	ssize_t err;
+	struct file *lower_file;
+	struct dentry *dentry = file->f_path.dentry;
+
+	lower_file = sdcardfs_lower_file(file);
+	if (!lower_file->f_op->splice_read)
+		return default_file_splice_read(file, ppos, pipe, len, flags);
+
+	sdcardfs_set_noactive(file, lower_file);
+
+	err = lower_file->f_op->splice_read(lower_file, ppos, pipe, len, flags);
+	if (err >= 0)
+		fsstack_copy_attr_atime(dentry->d_inode,
+					file_inode(lower_file));
+
+	return err;
+}
+
+static ssize_t sdcardfs_splice_write(struct pipe_inode_info *pipe,
+				struct file *file, loff_t *ppos, size_t len,
+				unsigned int flags)
+{
+	ssize_t err;
+	struct file *lower_file;
+	struct dentry *dentry = file->f_path.dentry;
+
+	/* check disk space */
+	if (!check_min_free_space(dentry, len, 0)) {
+		printk(KERN_INFO "No minimum free space.\n");
+		return -ENOSPC;
+	}
+
+	lower_file = sdcardfs_lower_file(file);
+	if (!lower_file->f_op->splice_write)
+		return iter_file_splice_write(pipe, file, ppos, len, flags);
+
+	file_start_write(lower_file);
+	err = lower_file->f_op->splice_write(pipe, lower_file, ppos, len, flags);
+	file_end_write(lower_file);
+	if (err >= 0) {
+		fsstack_copy_inode_size(dentry->d_inode,
+					file_inode(lower_file));
 		fsstack_copy_attr_times(dentry->d_inode,
-					lower_file->f_path.dentry->d_inode);
+					file_inode(lower_file));
 	}
 
 	return err;
@@ -138,61 +250,36 @@ out:
 }
 #endif
 
+/*
+ * Map the lower file directly, so that the mapping shares the lower page
+ * cache and faults, page_mkwrite and writeback are all handled by the
+ * lower file system.
+ */
 static int sdcardfs_mmap(struct file *file, struct vm_area_struct *vma)
 {
-	int err = 0;
-	bool willwrite;
+	int err;
 	struct file *lower_file;
-	const struct vm_operations_struct *saved_vm_ops = NULL;
-
-	/* this might be deferred to mmap's writepage */
-	willwrite = ((vma->vm_flags | VM_SHARED | VM_WRITE) == vma->vm_flags);
-
-	/*
-	 * File systems which do not implement ->writepage may use
-	 * generic_file_readonly_mmap as their ->mmap op.  If you call
-	 * generic_file_readonly_mmap with VM_WRITE, you'd get an -EINVAL.
-	 * But we cannot call the lower ->mmap op, so we can't tell that
-	 * writeable mappings won't work.  Therefore, our only choice is to
-	 * check if the lower file system supports the ->writepage, and if
-	 * not, return EINVAL (the same error that
-	 * generic_file_readonly_mmap returns in that case).
-	 */
-	lower_file = sdcardfs_lower_file(file);
-	if (willwrite && !lower_file->f_mapping->a_ops->writepage) {
-		err = -EINVAL;
-		printk(KERN_ERR "sdcardfs: lower file system does not "
-				"support writeable mmap\n");
-		goto out;
-	}
 
-	/*
-	 * find and save lower vm_ops.
-	 *
-	 * XXX: the VFS should have a cleaner way of finding the lower vm_ops
-	 */
-	if (!SDCARDFS_F(file)->lower_vm_ops) {
-		err = lower_file->f_op->mmap(lower_file, vma);
-		if (err) {
-			printk(KERN_ERR "sdcardfs: lower mmap failed %d\n", err);
-			goto out;
-		}
-		saved_vm_ops = vma->vm_ops; /* save: came from lower ->mmap */
+	lower_file = sdcardfs_lower_file(file);
+	if (!lower_file->f_op->mmap)
+		return -ENODEV;
+
+	if (WARN_ON(file != vma->vm_file))
+		return -EIO;
+
+	/* the lower file backs the mapping from now on */
+	vma->vm_file = get_file(lower_file);
+	err = lower_file->f_op->mmap(lower_file, vma);
+	if (err) {
+		printk(KERN_ERR "sdcardfs: lower mmap failed %d\n", err);
+		vma->vm_file = file;
+		fput(lower_file);
+		return err;
 	}
+	fput(file);
 
-	/*
-	 * Next 3 lines are all I need from generic_file_mmap.  I definitely
-	 * don't want its test for ->readpage which returns -ENOEXEC.
-	 */
-	file_accessed(file);
-	vma->vm_ops = &sdcardfs_vm_ops;
-
-	file->f_mapping->a_ops = &sdcardfs_aops; /* set our aops */
-	if (!SDCARDFS_F(file)->lower_vm_ops) /* save for our ->fault */
-		SDCARDFS_F(file)->lower_vm_ops = saved_vm_ops;
-
-out:
-	return err;
+	fsstack_copy_attr_atime(file_inode(file), file_inode(lower_file));
+	return 0;
 }
 
 static int sdcardfs_open(struct inode *inode, struct file *file)
@@ -328,13 +415,17 @@ static struct file *sdcardfs_get_lower_file(struct file *f)
 
 const struct file_operations sdcardfs_main_fops = {
 	.llseek		= generic_file_llseek,
-	.read		= sdcardfs_read,
-	.write		= sdcardfs_write,
+	.read		= new_sync_read,
+	.write		= new_sync_write,
+	.read_iter	= sdcardfs_read_iter,
+	.write_iter	= sdcardfs_write_iter,
 	.unlocked_ioctl	= sdcardfs_unlocked_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= sdcardfs_compat_ioctl,
 #endif
 	.mmap		= sdcardfs_mmap,
+	.splice_read	= sdcardfs_splice_read,
+	.splice_write	= sdcardfs_splice_write,
 	.open		= sdcardfs_open,
 	.flush		= sdcardfs_flush,
 	.release	= sdcardfs_file_release,
@@ -533,14 +533,14 @@ static int sdcardfs_rename(struct inode *old_dir, struct dentry *old_dentry,
 		new_parent = dget_parent(new_dentry);
 		if(new_parent) {
 			if(old_dentry->d_inode) {
-				get_derived_permission(new_parent, old_dentry,false);
+				get_derived_permission(new_parent, old_dentry);
                 sbi = SDCARDFS_SB(old_dentry->d_sb);
                 mask = sbi->options.sdfs_mask;
                 fix_derived_permission(old_dentry->d_inode, mask);
 			}
 			dput(new_parent);
 			if(old_dentry->d_inode){
-				get_derived_permission_recursive(old_dentry,false);
+				get_derived_permission_recursive(old_dentry);
 			}
 		}
 	}
@@ -661,6 +661,9 @@ static int sdcardfs_getattr(struct vfsmount *mnt, struct dentry *dentry,
 	}
 	dput(parent);
 
+	/* pick up a package list change before reporting the owner */
+	revalidate_derived_permission(dentry);
+
 	inode = dentry->d_inode;
 
 	sdcardfs_get_lower_path(dentry, &lower_path);
@@ -20,34 +20,6 @@
 
 #include "sdcardfs.h"
 
-static int sdcardfs_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
-{
-	int err;
-	struct file *file, *lower_file;
-	const struct vm_operations_struct *lower_vm_ops;
-	struct vm_area_struct lower_vma;
-
-	memcpy(&lower_vma, vma, sizeof(struct vm_area_struct));
-	file = lower_vma.vm_file;
-	lower_vm_ops = SDCARDFS_F(file)->lower_vm_ops;
-	BUG_ON(!lower_vm_ops);
-
-	lower_file = sdcardfs_lower_file(file);
-	/*
-	 * XXX: vm_ops->fault may be called in parallel.  Because we have to
-	 * resort to temporarily changing the vma->vm_file to point to the
-	 * lower file, a concurrent invocation of sdcardfs_fault could see a
-	 * different value.  In this workaround, we keep a different copy of
-	 * the vma structure in our stack, so we never expose a different
-	 * value of the vma->vm_file called to us, even temporarily.  A
-	 * better fix would be to change the calling semantics of ->fault to
-	 * take an explicit file pointer.
-	 */
-	lower_vma.vm_file = lower_file;
-	err = lower_vm_ops->fault(&lower_vma, vmf);
-	return err;
-}
-
 /* XXX: to support direct I/O, a_ops->direct_IO shouldn't be null.
  */
 static ssize_t sdcardfs_direct_IO(int rw, struct kiocb *iocb, struct iov_iter *iter, loff_t offset)
@@ -76,8 +48,3 @@ const struct address_space_operations sdcardfs_aops = {
 	.direct_IO		= sdcardfs_direct_IO,
 	/* empty on purpose */
 };
-
-
-const struct vm_operations_struct sdcardfs_vm_ops = {
-	.fault			= sdcardfs_fault,
-};
@@ -34,10 +34,19 @@
 DEFINE_MUTEX(pkgl_lock);
 EXPORT_SYMBOL_GPL(pkgl_lock);
 
+/* Bumped on every packages.list reload. Derived permissions computed with
+ * an older generation are refreshed lazily by revalidate_derived_permission().
+ */
+atomic_t pkgl_generation = ATOMIC_INIT(0);
+
+/* Readers walk the hashtable under rcu_read_lock(), and updates are
+ * serialized by the hashtable_lock of the global packagelist data. */
 struct hashtable_entry {
 	struct hlist_node hlist;
 	void *key;
 	int value;
+	unsigned int gen;
+	struct rcu_head rcu;
 };
 // Set 1 in case that SPIN LOCK is used for packagelist hashtable_lock
 // Set 0 in case that Mutex LOCK is used for packagelist hashtable_lock
@@ -51,6 +60,7 @@ struct packagelist_super {
 
 struct packagelist_data {
 	DECLARE_HASHTABLE(package_to_appid,8);
+	unsigned int list_gen;
 	struct task_struct *thread_id;
 	char *strtok_last;
 	char read_buf[STRING_BUF_SIZE];
@@ -78,7 +88,7 @@ static struct global_packagelist_data *g_pkgls[MAX_PKGL];
 static struct kmem_cache *hashtable_entry_cachep;
 
 
-/* This function used for get_derived_permission_recursive() */
+/* This function is used for updating the packagelist hashtable */
 void packagelist_lock_init(void *g_packagelist_data)
 {
 	struct global_packagelist_data *g_pkgl_dat = (struct global_packagelist_data *)g_packagelist_data;
@@ -98,7 +108,7 @@ void packagelist_lock(void *g_packagelist_data)
 #endif
 }
 
-/* This function used for get_derived_permission_recursive() */
+/* This function is used for updating the packagelist hashtable */
 void packagelist_unlock(void *g_packagelist_data)
 {
 	struct global_packagelist_data *g_pkgl_dat = (struct global_packagelist_data *)g_packagelist_data;
@@ -220,13 +230,15 @@ appid_t get_appid(void *pkgl_id, const char *app_name)
 		return 0;
 	}
 
-	hash_for_each_possible(pkgl_dat->package_to_appid, hash_cur, hlist, hash) {
+	rcu_read_lock();
+	hash_for_each_possible_rcu(pkgl_dat->package_to_appid, hash_cur, hlist, hash) {
 		if (!strcasecmp(app_name, hash_cur->key)) {
-			ret_id = (appid_t)hash_cur->value;
-			return ret_id;
+			ret_id = (appid_t)ACCESS_ONCE(hash_cur->value);
+			break;
 		}
 	}
-	return 0;
+	rcu_read_unlock();
+	return ret_id;
 }
 
 /* Kernel has already enforced everything we returned through
@@ -275,7 +287,8 @@ static int insert_str_to_int(struct packagelist_data *pkgl_dat, void *key, int v
 	//printk(KERN_INFO "sdcardfs: %s: %s: %d, %u\n", __func__, (char *)key, value, hash);
 	hash_for_each_possible(pkgl_dat->package_to_appid, hash_cur, hlist, hash) {
 		if (!strcasecmp(key, hash_cur->key)) {
-			hash_cur->value = value;
+			ACCESS_ONCE(hash_cur->value) = value;
+			hash_cur->gen = pkgl_dat->list_gen;
 			return 0;
 		}
 	}
@@ -283,17 +296,43 @@ static int insert_str_to_int(struct packagelist_data *pkgl_dat, void *key, int v
 	if (!new_entry)
 		return -ENOMEM;
 	new_entry->key = kstrdup(key, GFP_KERNEL);
+	if (!new_entry->key) {
+		kmem_cache_free(hashtable_entry_cachep, new_entry);
+		return -ENOMEM;
+	}
 	new_entry->value = value;
-	hash_add(pkgl_dat->package_to_appid, &new_entry->hlist, hash);
+	new_entry->gen = pkgl_dat->list_gen;
+	hash_add_rcu(pkgl_dat->package_to_appid, &new_entry->hlist, hash);
 	return 0;
 }
 
-static void remove_str_to_int(struct hashtable_entry *h_entry) {
-	//printk(KERN_INFO "sdcardfs: %s: %s: %d\n", __func__, (char *)h_entry->key, h_entry->value);
+static void free_hashtable_entry(struct rcu_head *head)
+{
+	struct hashtable_entry *h_entry =
+		container_of(head, struct hashtable_entry, rcu);
+
 	kfree(h_entry->key);
 	kmem_cache_free(hashtable_entry_cachep, h_entry);
 }
 
+static void remove_str_to_int(struct hashtable_entry *h_entry) {
+	//printk(KERN_INFO "sdcardfs: %s: %s: %d\n", __func__, (char *)h_entry->key, h_entry->value);
+	hash_del_rcu(&h_entry->hlist);
+	call_rcu(&h_entry->rcu, free_hashtable_entry);
+}
+
+/* drop the packages which were not found in the last read */
+static void remove_stale_hashentrys(struct packagelist_data *pkgl_dat)
+{
+	struct hashtable_entry *hash_cur;
+	struct hlist_node *h_t;
+	int i;
+
+	hash_for_each_safe(pkgl_dat->package_to_appid, i, h_t, hash_cur, hlist)
+		if (hash_cur->gen != pkgl_dat->list_gen)
+			remove_str_to_int(hash_cur);
+}
+
 static void remove_all_hashentrys(struct packagelist_data *pkgl_dat)
 {
 	struct hashtable_entry *hash_cur;
@@ -302,16 +341,12 @@ static void remove_all_hashentrys(struct packagelist_data *pkgl_dat)
 
 	hash_for_each_safe(pkgl_dat->package_to_appid, i, h_t, hash_cur, hlist)
 		remove_str_to_int(hash_cur);
-
-	hash_init(pkgl_dat->package_to_appid);
 }
 
 static int read_package_list(struct packagelist_data *pkgl_dat) {
 	int ret;
 	int fd;
 	int read_amount;
-	struct list_head *list_pos;
-	struct packagelist_super *pkg_super;
 	void * g_pkgl_dat;
 
 	printk(KERN_DEBUG "sdcardfs: read_package_list\n");
@@ -328,8 +363,8 @@ static int read_package_list(struct packagelist_data *pkgl_dat) {
 		return -EACCES;
 	}
 
-	remove_all_hashentrys(pkgl_dat);
-
+	/* The table is updated in place, so lookups keep seeing the previous
+	 * mapping until the new one is read in. */
 	fd = sys_open(kpackageslist_file, O_RDONLY, 0);
 	if (fd < 0) {
 		printk(KERN_ERR "sdcardfs: failed to open package list\n");
@@ -337,6 +372,7 @@ static int read_package_list(struct packagelist_data *pkgl_dat) {
 		return fd;
 	}
 
+	pkgl_dat->list_gen++;
 	while ((read_amount = sys_read(fd, pkgl_dat->read_buf,
 					sizeof(pkgl_dat->read_buf))) > 0) {
 		int appid;
@@ -367,14 +403,11 @@ static int read_package_list(struct packagelist_data *pkgl_dat) {
 	}
 
 	sys_close(fd);
+	remove_stale_hashentrys(pkgl_dat);
 
-	/* Regenerate ownership details using newly loaded mapping */
-	list_for_each(list_pos, &(pkgl_dat->pkg_supers.list)) {
-		pkg_super = list_entry(list_pos, struct packagelist_super, list);
-		if (pkg_super!=NULL && pkg_super->sb != NULL && pkg_super->sb->s_root!=NULL && pkg_super->sb->s_root->d_inode) {
-			get_derived_permission_recursive(pkg_super->sb->s_root,true);
-		}
-	}
+	/* Regenerate ownership details lazily using newly loaded mapping */
+	smp_mb__before_atomic();
+	atomic_inc(&pkgl_generation);
 	packagelist_unlock(g_pkgl_dat);
 
 	return 0;
@@ -602,6 +635,8 @@ void packagelist_destroy(void *pkgl_id, type_t type)
 				}
 			}
 			printk(KERN_INFO "sdcardfs: destroyed packagelist pkgld/%d\n", (int)pkgl_pid);
+			/* wait for the lookups which still see the pkgl_id */
+			synchronize_rcu();
 			kfree(pkgl_dat);
 			pkgl_dat = NULL;
 			packagelist_unlock(g_pkgl);
@@ -646,6 +681,8 @@ int packagelist_init(void)
 
 void packagelist_exit(void)
 {
+	/* wait for the pending frees of the hashtable entries */
+	rcu_barrier();
 	if (hashtable_entry_cachep)
 		kmem_cache_destroy(hashtable_entry_cachep);
 }
@@ -141,7 +141,6 @@ extern const struct inode_operations sdcardfs_symlink_iops;
 extern const struct super_operations sdcardfs_sops;
 extern const struct dentry_operations sdcardfs_ci_dops;
 extern const struct address_space_operations sdcardfs_aops, sdcardfs_dummy_aops;
-extern const struct vm_operations_struct sdcardfs_vm_ops;
 
 extern int sdcardfs_init_inode_cache(void);
 extern void sdcardfs_destroy_inode_cache(void);
@@ -160,7 +159,6 @@ extern long sdcardfs_propagate_rename(struct inode *parent, char * oldname, char
 /* file private data */
 struct sdcardfs_file_info {
 	struct file *lower_file;
-	const struct vm_operations_struct *lower_vm_ops;
 };
 
 /* sdcardfs inode data in memory */
@@ -172,6 +170,8 @@ struct sdcardfs_inode_info {
 	gid_t d_gid;
 	mode_t d_mode;
     bool d_under_android;
+	/* pkgl_generation when the derived state was computed */
+	unsigned int perm_gen;
 
 	struct inode vfs_inode;
 };
@@ -373,6 +373,7 @@ static inline void sdcardfs_put_real_lower(const struct dentry *dent,
 }
 
 extern struct mutex pkgl_lock;
+extern atomic_t pkgl_generation;
 
 /* for packagelist.c */
 extern appid_t get_appid(void *pkgl_id, const char *app_name);
@@ -392,9 +393,10 @@ extern void setup_derived_state(struct inode *inode, perm_t perm,
             userid_t userid, uid_t uid, gid_t gid, bool under_android);
 extern void setup_derived_state_for_multiuser_gid(struct inode *inode, perm_t perm,
             userid_t userid, uid_t uid, gid_t gid, bool under_android);
-extern void get_derived_permission(struct dentry *parent, struct dentry *dentry, bool locked);
-extern void get_derived_permission_recursive(struct dentry *parent, bool locked);
+extern void get_derived_permission(struct dentry *parent, struct dentry *dentry);
+extern void get_derived_permission_recursive(struct dentry *parent);
 extern void update_derived_permission(struct dentry *dentry);
+extern void revalidate_derived_permission(struct dentry *dentry);
 extern int need_graft_path(struct dentry *dentry);
 extern int is_base_obbpath(struct dentry *dentry);
 extern int is_obbpath_invalid(struct dentry *dentry);
@@ -252,9 +252,20 @@ enum mmc_packed_stop_reasons {
 	MAX_REASONS,
 };
 
+/* outcome of the adaptive check made before building a packed list */
+enum mmc_pack_decisions {
+	PACK_DECISION_PACK = 0,
+	PACK_DECISION_LARGE_REQ,
+	PACK_DECISION_SHALLOW_QUEUE,
+	PACK_DECISION_SLOWER,
+	PACK_DECISION_PROBE,
+	MAX_PACK_DECISIONS,
+};
+
 struct mmc_wr_pack_stats {
 	u32 *packing_events;
 	u32 pack_stop_reason[MAX_REASONS];
+	u32 pack_decisions[MAX_PACK_DECISIONS];
 	spinlock_t lock;
 	bool enabled;
 	bool print_in_read;
@@ -151,8 +151,10 @@ struct sync_pt {
  * @file:		file representing this fence
  * @kref:		reference count on fence.
  * @name:		name of sync_fence.  Useful for debugging
- * @pt_list_head:	list of sync_pts in the fence.  immutable once fence
- *			  is created
+ * @pt_list_head:	list of sync_pts in the fence, sorted by timeline.
+ *			  immutable once fence is created
+ * @pending:		number of sync_pts in the fence that have not signaled
+ * @error:		status of the first sync_pt to signal an error, or 0
  * @waiter_list_head:	list of asynchronous waiters on this fence
  * @waiter_list_lock:	lock protecting @waiter_list_head and @status
  * @status:		1: signaled, 0:active, <0: error
@@ -168,6 +170,9 @@ struct sync_fence {
 	/* this list is immutable once the fence is created */
 	struct list_head	pt_list_head;
 
+	atomic_t		pending;
+	int			error;
+
 	struct list_head	waiter_list_head;
 	spinlock_t		waiter_list_lock; /* also protects status */
 	int			status;
@@ -309,6 +309,7 @@ enum kgsl_timestamp_type {
 #define KGSL_PROP_HIGHEST_BANK_BIT	0x17
 #define KGSL_PROP_DEVICE_BITNESS	0x18
 #define KGSL_PROP_DEVICE_QDSS_STM	0x19
+#define KGSL_PROP_CONTEXT_DEADLINE	0x1A
 
 struct kgsl_shadowprop {
 	unsigned long gpuaddr;
@@ -1098,6 +1099,20 @@ struct kgsl_device_constraint_pwrlevel {
 	unsigned int level;
 };
 
+/**
+ * struct kgsl_context_deadline - argument for KGSL_PROP_CONTEXT_DEADLINE
+ * @context_id: KGSL context ID
+ * @deadline_us: Time in microseconds within which command batches queued on
+ * the context should be submitted to the GPU, 0 to use the default
+ *
+ * Among contexts of the same priority the dispatcher submits from the one
+ * whose oldest command batch has the earliest deadline.
+ */
+struct kgsl_context_deadline {
+	unsigned int context_id;
+	unsigned int deadline_us;
+};
+
 /**
  * struct kgsl_syncsource_create - Argument to IOCTL_KGSL_SYNCSOURCE_CREATE
  * @id: returned id for the syncsource that was created.
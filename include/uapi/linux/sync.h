@@ -62,6 +62,28 @@ struct sync_fence_info_data {
 	__u8	pt_info[0];
 };
 
+/**
+ * struct sync_wait_multi_data - data passed to the multi-fence wait ioctl
+ * @fds:	pointer to an array of @count fence fds to wait on
+ * @status:	pointer to an array of @count __s32 that returns the status of
+ *		each fence. 1: signaled 0:active <0:error
+ * @count:	number of fences, at most SYNC_WAIT_MULTI_MAX
+ * @flags:	SYNC_WAIT_MULTI_ALL to wait for every fence instead of any
+ * @timeout:	timeout in milliseconds.  Waits indefinitely if < 0.
+ * @pad:	must be zero
+ */
+struct sync_wait_multi_data {
+	__u64	fds;
+	__u64	status;
+	__u32	count;
+	__u32	flags;
+	__s32	timeout;
+	__u32	pad;
+};
+
+#define SYNC_WAIT_MULTI_ALL	(1 << 0)
+#define SYNC_WAIT_MULTI_MAX	256
+
 #define SYNC_IOC_MAGIC		'>'
 
 /**
@@ -94,4 +116,16 @@ struct sync_fence_info_data {
 #define SYNC_IOC_FENCE_INFO	_IOWR(SYNC_IOC_MAGIC, 2,\
 	struct sync_fence_info_data)
 
+/**
+ * DOC: SYNC_IOC_WAIT_MULTI - wait for any or all of several fences
+ *
+ * Takes a struct sync_wait_multi_data.  Can be issued on any fence fd, the
+ * fence it is issued on is only waited for if it is also in the fds array.
+ * Returns 0 once one fence (or every fence with SYNC_WAIT_MULTI_ALL) has
+ * signaled or errored, -ETIME on timeout.  The status array is filled in
+ * either way.
+ */
+#define SYNC_IOC_WAIT_MULTI	_IOWR(SYNC_IOC_MAGIC, 3,\
+	struct sync_wait_multi_data)
+
 #endif /* _UAPI_LINUX_SYNC_H */
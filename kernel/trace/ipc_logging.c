@@ -26,27 +26,30 @@
 #include <linux/sched.h>
 #include <linux/wait.h>
 #include <linux/delay.h>
-#include <linux/completion.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
 #include <linux/ipc_logging.h>
 
 #include "ipc_logging_private.h"
 
 #define LOG_PAGE_DATA_SIZE	sizeof(((struct ipc_log_page *)0)->data)
 #define LOG_PAGE_FLAG (1 << 31)
+#define LOG_PAGE_CPU_SHIFT 16
 
 static LIST_HEAD(ipc_log_context_list);
 static DEFINE_RWLOCK(context_list_lock_lha1);
+static atomic_t ipc_log_total_pages = ATOMIC_INIT(0);
 static void *get_deserialization_func(struct ipc_log_context *ilctxt,
 				      int type);
 
-static struct ipc_log_page *get_first_page(struct ipc_log_context *ilctxt)
+static struct ipc_log_page *get_first_page(struct ipc_log_cpu_buf *buf)
 {
 	struct ipc_log_page_header *p_pghdr;
 	struct ipc_log_page *pg = NULL;
 
-	if (!ilctxt)
+	if (!buf)
 		return NULL;
-	p_pghdr = list_first_entry(&ilctxt->page_list,
+	p_pghdr = list_first_entry(&buf->page_list,
 				   struct ipc_log_page_header, list);
 	pg = container_of(p_pghdr, struct ipc_log_page, hdr);
 	return pg;
@@ -55,56 +58,56 @@ static struct ipc_log_page *get_first_page(struct ipc_log_context *ilctxt)
 /**
  * is_nd_read_empty - Returns true if no data is available to read in log
  *
- * @ilctxt: logging context
+ * @buf: per-CPU sub-buffer of the logging context
  * @returns: > 1 if context is empty; 0 if not empty; <0 for failure
  *
  * This is for the debugfs read pointer which allows for a non-destructive read.
  * There may still be data in the log, but it may have already been read.
  */
-static int is_nd_read_empty(struct ipc_log_context *ilctxt)
+static int is_nd_read_empty(struct ipc_log_cpu_buf *buf)
 {
-	if (!ilctxt)
+	if (!buf)
 		return -EINVAL;
 
-	return ((ilctxt->nd_read_page == ilctxt->write_page) &&
-		(ilctxt->nd_read_page->hdr.nd_read_offset ==
-		 ilctxt->write_page->hdr.write_offset));
+	return ((buf->nd_read_page == buf->write_page) &&
+		(buf->nd_read_page->hdr.nd_read_offset ==
+		 buf->write_page->hdr.write_offset));
 }
 
 /**
  * is_read_empty - Returns true if no data is available in log
  *
- * @ilctxt: logging context
+ * @buf: per-CPU sub-buffer of the logging context
  * @returns: > 1 if context is empty; 0 if not empty; <0 for failure
  *
  * This is for the actual log contents.  If it is empty, then there
  * is no data at all in the log.
  */
-static int is_read_empty(struct ipc_log_context *ilctxt)
+static int is_read_empty(struct ipc_log_cpu_buf *buf)
 {
-	if (!ilctxt)
+	if (!buf)
 		return -EINVAL;
 
-	return ((ilctxt->read_page == ilctxt->write_page) &&
-		(ilctxt->read_page->hdr.read_offset ==
-		 ilctxt->write_page->hdr.write_offset));
+	return ((buf->read_page == buf->write_page) &&
+		(buf->read_page->hdr.read_offset ==
+		 buf->write_page->hdr.write_offset));
 }
 
 /**
  * is_nd_read_equal_read - Return true if the non-destructive read is equal to
  * the destructive read
  *
- * @ilctxt: logging context
+ * @buf: per-CPU sub-buffer of the logging context
  * @returns: true if nd read is equal to read; false otherwise
  */
-static bool is_nd_read_equal_read(struct ipc_log_context *ilctxt)
+static bool is_nd_read_equal_read(struct ipc_log_cpu_buf *buf)
 {
 	uint16_t read_offset;
 	uint16_t nd_read_offset;
 
-	if (ilctxt->nd_read_page == ilctxt->read_page) {
-		read_offset = ilctxt->read_page->hdr.read_offset;
-		nd_read_offset = ilctxt->nd_read_page->hdr.nd_read_offset;
+	if (buf->nd_read_page == buf->read_page) {
+		read_offset = buf->read_page->hdr.read_offset;
+		nd_read_offset = buf->nd_read_page->hdr.nd_read_offset;
 
 		if (read_offset == nd_read_offset)
 			return true;
@@ -114,17 +117,17 @@ static bool is_nd_read_equal_read(struct ipc_log_context *ilctxt)
 }
 
 
-static struct ipc_log_page *get_next_page(struct ipc_log_context *ilctxt,
+static struct ipc_log_page *get_next_page(struct ipc_log_cpu_buf *buf,
 					  struct ipc_log_page *cur_pg)
 {
 	struct ipc_log_page_header *p_pghdr;
 	struct ipc_log_page *pg = NULL;
 
-	if (!ilctxt || !cur_pg)
+	if (!buf || !cur_pg)
 		return NULL;
 
-	if (ilctxt->last_page == cur_pg)
-		return ilctxt->first_page;
+	if (buf->last_page == cur_pg)
+		return buf->first_page;
 
 	p_pghdr = list_first_entry(&cur_pg->hdr.list,
 			struct ipc_log_page_header, list);
@@ -133,10 +136,55 @@ static struct ipc_log_page *get_next_page(struct ipc_log_context *ilctxt,
 	return pg;
 }
 
+/**
+ * ipc_log_is_nd_read_empty - Returns true if no CPU has data left to read
+ *
+ * @ilctxt: logging context
+ *
+ * Used as the wake-up condition of the continuous debugfs reader, so the
+ * sub-buffers are checked without their locks.
+ */
+bool ipc_log_is_nd_read_empty(struct ipc_log_context *ilctxt)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		if (!is_nd_read_empty(per_cpu_ptr(ilctxt->cpu_buf, cpu)))
+			return false;
+
+	return true;
+}
+
+/**
+ * ipc_log_peek - copy data at the non-destructive read pointer
+ *
+ * @buf:  per-CPU sub-buffer of the logging context
+ * @data:  Data pointer to receive the data
+ * @data_size:  Number of bytes to copy (must be <= bytes available in log)
+ *
+ * Same as ipc_log_read() but leaves the read pointer where it is.
+ */
+static void ipc_log_peek(struct ipc_log_cpu_buf *buf, void *data,
+			 int data_size)
+{
+	struct ipc_log_page *pg = buf->nd_read_page;
+	int bytes_to_read;
+
+	bytes_to_read = MIN(LOG_PAGE_DATA_SIZE - pg->hdr.nd_read_offset,
+			    data_size);
+	memcpy(data, pg->data + pg->hdr.nd_read_offset, bytes_to_read);
+
+	if (bytes_to_read != data_size) {
+		pg = get_next_page(buf, pg);
+		memcpy(data + bytes_to_read, pg->data,
+		       data_size - bytes_to_read);
+	}
+}
+
 /**
  * ipc_log_read - do non-destructive read of the log
  *
- * @ilctxt:  Logging context
+ * @buf:  per-CPU sub-buffer of the logging context
  * @data:  Data pointer to receive the data
  * @data_size:  Number of bytes to read (must be <= bytes available in log)
  *
@@ -145,87 +193,84 @@ static struct ipc_log_page *get_next_page(struct ipc_log_context *ilctxt,
  * debugging and if the system crashes, then the full logs can still be
  * extracted.
  */
-static void ipc_log_read(struct ipc_log_context *ilctxt,
+static void ipc_log_read(struct ipc_log_cpu_buf *buf,
 			 void *data, int data_size)
 {
 	int bytes_to_read;
 
 	bytes_to_read = MIN(LOG_PAGE_DATA_SIZE
-				- ilctxt->nd_read_page->hdr.nd_read_offset,
+				- buf->nd_read_page->hdr.nd_read_offset,
 			      data_size);
 
-	memcpy(data, (ilctxt->nd_read_page->data +
-		ilctxt->nd_read_page->hdr.nd_read_offset), bytes_to_read);
+	memcpy(data, (buf->nd_read_page->data +
+		buf->nd_read_page->hdr.nd_read_offset), bytes_to_read);
 
 	if (bytes_to_read != data_size) {
 		/* not enough space, wrap read to next page */
-		ilctxt->nd_read_page->hdr.nd_read_offset = 0;
-		ilctxt->nd_read_page = get_next_page(ilctxt,
-			ilctxt->nd_read_page);
-		BUG_ON(ilctxt->nd_read_page == NULL);
+		buf->nd_read_page->hdr.nd_read_offset = 0;
+		buf->nd_read_page = get_next_page(buf, buf->nd_read_page);
+		BUG_ON(buf->nd_read_page == NULL);
 
 		memcpy((data + bytes_to_read),
-			   (ilctxt->nd_read_page->data +
-			ilctxt->nd_read_page->hdr.nd_read_offset),
+			   (buf->nd_read_page->data +
+			buf->nd_read_page->hdr.nd_read_offset),
 			   (data_size - bytes_to_read));
 		bytes_to_read = (data_size - bytes_to_read);
 	}
-	ilctxt->nd_read_page->hdr.nd_read_offset += bytes_to_read;
+	buf->nd_read_page->hdr.nd_read_offset += bytes_to_read;
 }
 
 /**
  * ipc_log_drop - do destructive read of the log
  *
- * @ilctxt:  Logging context
+ * @buf:  per-CPU sub-buffer of the logging context
  * @data:  Data pointer to receive the data (or NULL)
  * @data_size:  Number of bytes to read (must be <= bytes available in log)
  */
-static void ipc_log_drop(struct ipc_log_context *ilctxt, void *data,
+static void ipc_log_drop(struct ipc_log_cpu_buf *buf, void *data,
 		int data_size)
 {
 	int bytes_to_read;
 	bool push_nd_read;
 
 	bytes_to_read = MIN(LOG_PAGE_DATA_SIZE
-				- ilctxt->read_page->hdr.read_offset,
+				- buf->read_page->hdr.read_offset,
 			      data_size);
 	if (data)
-		memcpy(data, (ilctxt->read_page->data +
-			ilctxt->read_page->hdr.read_offset), bytes_to_read);
+		memcpy(data, (buf->read_page->data +
+			buf->read_page->hdr.read_offset), bytes_to_read);
 
 	if (bytes_to_read != data_size) {
 		/* not enough space, wrap read to next page */
-		push_nd_read = is_nd_read_equal_read(ilctxt);
+		push_nd_read = is_nd_read_equal_read(buf);
 
-		ilctxt->read_page->hdr.read_offset = 0;
+		buf->read_page->hdr.read_offset = 0;
 		if (push_nd_read) {
-			ilctxt->read_page->hdr.nd_read_offset = 0;
-			ilctxt->read_page = get_next_page(ilctxt,
-				ilctxt->read_page);
-			BUG_ON(ilctxt->read_page == NULL);
-			ilctxt->nd_read_page = ilctxt->read_page;
+			buf->read_page->hdr.nd_read_offset = 0;
+			buf->read_page = get_next_page(buf, buf->read_page);
+			BUG_ON(buf->read_page == NULL);
+			buf->nd_read_page = buf->read_page;
 		} else {
-			ilctxt->read_page = get_next_page(ilctxt,
-				ilctxt->read_page);
-			BUG_ON(ilctxt->read_page == NULL);
+			buf->read_page = get_next_page(buf, buf->read_page);
+			BUG_ON(buf->read_page == NULL);
 		}
 
 		if (data)
 			memcpy((data + bytes_to_read),
-				   (ilctxt->read_page->data +
-				ilctxt->read_page->hdr.read_offset),
+				   (buf->read_page->data +
+				buf->read_page->hdr.read_offset),
 				   (data_size - bytes_to_read));
 
 		bytes_to_read = (data_size - bytes_to_read);
 	}
 
 	/* update non-destructive read pointer if necessary */
-	push_nd_read = is_nd_read_equal_read(ilctxt);
-	ilctxt->read_page->hdr.read_offset += bytes_to_read;
-	ilctxt->write_avail += data_size;
+	push_nd_read = is_nd_read_equal_read(buf);
+	buf->read_page->hdr.read_offset += bytes_to_read;
+	buf->write_avail += data_size;
 
 	if (push_nd_read)
-		ilctxt->nd_read_page->hdr.nd_read_offset += bytes_to_read;
+		buf->nd_read_page->hdr.nd_read_offset += bytes_to_read;
 }
 
 /**
@@ -236,12 +281,12 @@ static void ipc_log_drop(struct ipc_log_context *ilctxt, void *data,
  *     .hdr    message header .size and .type values
  *     .offset beginning of message data
  *
- * @ilctxt	Logging context
+ * @buf	per-CPU sub-buffer of the logging context
  * @ectxt   Message context
  *
  * @returns 0 - no message available; >0 message size; <0 error
  */
-static int msg_read(struct ipc_log_context *ilctxt,
+static int msg_read(struct ipc_log_cpu_buf *buf,
 	     struct encode_context *ectxt)
 {
 	struct tsv_header hdr;
@@ -249,41 +294,72 @@ static int msg_read(struct ipc_log_context *ilctxt,
 	if (!ectxt)
 		return -EINVAL;
 
-	if (is_nd_read_empty(ilctxt))
+	if (is_nd_read_empty(buf))
 		return 0;
 
-	ipc_log_read(ilctxt, &hdr, sizeof(hdr));
+	ipc_log_read(buf, &hdr, sizeof(hdr));
 	ectxt->hdr.type = hdr.type;
 	ectxt->hdr.size = hdr.size;
 	ectxt->offset = sizeof(hdr);
-	ipc_log_read(ilctxt, (ectxt->buff + ectxt->offset),
+	ipc_log_read(buf, (ectxt->buff + ectxt->offset),
 			 (int)hdr.size);
 
 	return sizeof(hdr) + (int)hdr.size;
 }
 
+/**
+ * msg_timestamp - Returns the timestamp of the next message to read
+ *
+ * @buf	per-CPU sub-buffer of the logging context
+ *
+ * Messages normally start with a TSV_TYPE_TIMESTAMP field, which is what
+ * the sub-buffers are merged on.  Messages without one sort first.
+ */
+static uint64_t msg_timestamp(struct ipc_log_cpu_buf *buf)
+{
+	struct {
+		struct tsv_header msg_hdr;
+		struct tsv_header hdr;
+		uint64_t ts;
+	} __packed msg;
+
+	ipc_log_peek(buf, &msg.msg_hdr, sizeof(msg.msg_hdr));
+	if (msg.msg_hdr.size < sizeof(msg.hdr) + sizeof(msg.ts))
+		return 0;
+
+	ipc_log_peek(buf, &msg, sizeof(msg));
+	if (msg.hdr.type != TSV_TYPE_TIMESTAMP)
+		return 0;
+
+	return msg.ts;
+}
+
 /**
  * msg_drop - Drops a message.
  *
- * @ilctxt	Logging context
+ * @buf	per-CPU sub-buffer of the logging context
  */
-static void msg_drop(struct ipc_log_context *ilctxt)
+static void msg_drop(struct ipc_log_cpu_buf *buf)
 {
 	struct tsv_header hdr;
 
-	if (!is_read_empty(ilctxt)) {
-		ipc_log_drop(ilctxt, &hdr, sizeof(hdr));
-		ipc_log_drop(ilctxt, NULL, (int)hdr.size);
+	if (!is_read_empty(buf)) {
+		ipc_log_drop(buf, &hdr, sizeof(hdr));
+		ipc_log_drop(buf, NULL, (int)hdr.size);
 	}
 }
 
 /*
- * Commits messages to the FIFO.  If the FIFO is full, then enough
- * messages are dropped to create space for the new message.
+ * Commits messages to the FIFO of the current CPU.  If the FIFO is full,
+ * then enough messages are dropped to create space for the new message.
+ *
+ * Writers on different CPUs never share any lock or cache line, so this
+ * stays cheap when called from hot interrupt paths.
  */
 void ipc_log_write(void *ctxt, struct encode_context *ectxt)
 {
 	struct ipc_log_context *ilctxt = (struct ipc_log_context *)ctxt;
+	struct ipc_log_cpu_buf *buf;
 	int bytes_to_write;
 	unsigned long flags;
 
@@ -292,39 +368,44 @@ void ipc_log_write(void *ctxt, struct encode_context *ectxt)
 		return;
 	}
 
-	read_lock_irqsave(&context_list_lock_lha1, flags);
-	spin_lock(&ilctxt->context_lock_lhb1);
-	while (ilctxt->write_avail <= ectxt->offset)
-		msg_drop(ilctxt);
+	local_irq_save(flags);
+	buf = this_cpu_ptr(ilctxt->cpu_buf);
+	spin_lock(&buf->lock_lhb2);
+	while (buf->write_avail <= ectxt->offset)
+		msg_drop(buf);
 
 	bytes_to_write = MIN(LOG_PAGE_DATA_SIZE
-				- ilctxt->write_page->hdr.write_offset,
+				- buf->write_page->hdr.write_offset,
 				ectxt->offset);
-	memcpy((ilctxt->write_page->data +
-		ilctxt->write_page->hdr.write_offset),
+	memcpy((buf->write_page->data +
+		buf->write_page->hdr.write_offset),
 		ectxt->buff, bytes_to_write);
 
 	if (bytes_to_write != ectxt->offset) {
 		uint64_t t_now = sched_clock();
 
-		ilctxt->write_page->hdr.write_offset += bytes_to_write;
-		ilctxt->write_page->hdr.end_time = t_now;
+		buf->write_page->hdr.write_offset += bytes_to_write;
+		buf->write_page->hdr.end_time = t_now;
 
-		ilctxt->write_page = get_next_page(ilctxt, ilctxt->write_page);
-		BUG_ON(ilctxt->write_page == NULL);
-		ilctxt->write_page->hdr.write_offset = 0;
-		ilctxt->write_page->hdr.start_time = t_now;
-		memcpy((ilctxt->write_page->data +
-			ilctxt->write_page->hdr.write_offset),
+		buf->write_page = get_next_page(buf, buf->write_page);
+		BUG_ON(buf->write_page == NULL);
+		buf->write_page->hdr.write_offset = 0;
+		buf->write_page->hdr.start_time = t_now;
+		memcpy((buf->write_page->data +
+			buf->write_page->hdr.write_offset),
 		       (ectxt->buff + bytes_to_write),
 		       (ectxt->offset - bytes_to_write));
 		bytes_to_write = (ectxt->offset - bytes_to_write);
 	}
-	ilctxt->write_page->hdr.write_offset += bytes_to_write;
-	ilctxt->write_avail -= ectxt->offset;
-	complete(&ilctxt->read_avail);
-	spin_unlock(&ilctxt->context_lock_lhb1);
-	read_unlock_irqrestore(&context_list_lock_lha1, flags);
+	buf->write_page->hdr.write_offset += bytes_to_write;
+	buf->write_avail -= ectxt->offset;
+	spin_unlock(&buf->lock_lhb2);
+	local_irq_restore(flags);
+
+	/* pairs with the barrier in wait_event() of the debugfs reader */
+	smp_mb();
+	if (waitqueue_active(&ilctxt->read_avail))
+		wake_up_interruptible(&ilctxt->read_avail);
 }
 EXPORT_SYMBOL(ipc_log_write);
 
@@ -518,6 +599,50 @@ int ipc_log_string(void *ilctxt, const char *fmt, ...)
 }
 EXPORT_SYMBOL(ipc_log_string);
 
+/**
+ * ipc_log_next_buf - Find the sub-buffer holding the oldest unread message
+ *
+ * @ilctxt:  logging context
+ * @flags:  receives the saved interrupt state
+ * @returns: the sub-buffer with its lock held, or NULL if all are empty
+ */
+static struct ipc_log_cpu_buf *ipc_log_next_buf(struct ipc_log_context *ilctxt,
+						unsigned long *flags)
+{
+	struct ipc_log_cpu_buf *buf, *oldest = NULL;
+	uint64_t ts, oldest_ts = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		buf = per_cpu_ptr(ilctxt->cpu_buf, cpu);
+
+		spin_lock_irqsave(&buf->lock_lhb2, *flags);
+		if (!is_nd_read_empty(buf)) {
+			ts = msg_timestamp(buf);
+			if (!oldest || ts < oldest_ts) {
+				oldest = buf;
+				oldest_ts = ts;
+			}
+		}
+		spin_unlock_irqrestore(&buf->lock_lhb2, *flags);
+	}
+
+	if (!oldest)
+		return NULL;
+
+	/*
+	 * If the writer overwrote the message in the meantime, the next one
+	 * in this sub-buffer is still a valid message to return.
+	 */
+	spin_lock_irqsave(&oldest->lock_lhb2, *flags);
+	if (is_nd_read_empty(oldest)) {
+		spin_unlock_irqrestore(&oldest->lock_lhb2, *flags);
+		return NULL;
+	}
+
+	return oldest;
+}
+
 /**
  * ipc_log_extract - Reads and deserializes log
  *
@@ -526,9 +651,9 @@ EXPORT_SYMBOL(ipc_log_string);
  * @size:    size of the buffer
  * @returns: 0 if no data read; >0 number of bytes read; < 0 error
  *
- * If no data is available to be read, then the ilctxt::read_avail
- * completion is reinitialized.  This allows clients to block
- * until new log data is save.
+ * Messages from the per-CPU sub-buffers are returned in timestamp order.
+ * If no data is available to be read, then clients can block on
+ * ilctxt::read_avail until new log data is saved.
  */
 int ipc_log_extract(void *ctxt, char *buff, int size)
 {
@@ -537,6 +662,7 @@ int ipc_log_extract(void *ctxt, char *buff, int size)
 	void (*deserialize_func)(struct encode_context *ectxt,
 				 struct decode_context *dctxt);
 	struct ipc_log_context *ilctxt = (struct ipc_log_context *)ctxt;
+	struct ipc_log_cpu_buf *buf;
 	unsigned long flags;
 
 	if (size < MAX_MSG_DECODED_SIZE)
@@ -545,27 +671,23 @@ int ipc_log_extract(void *ctxt, char *buff, int size)
 	dctxt.output_format = OUTPUT_DEBUGFS;
 	dctxt.buff = buff;
 	dctxt.size = size;
-	read_lock_irqsave(&context_list_lock_lha1, flags);
-	spin_lock(&ilctxt->context_lock_lhb1);
-	while (dctxt.size >= MAX_MSG_DECODED_SIZE &&
-	       !is_nd_read_empty(ilctxt)) {
-		msg_read(ilctxt, &ectxt);
+	while (dctxt.size >= MAX_MSG_DECODED_SIZE) {
+		buf = ipc_log_next_buf(ilctxt, &flags);
+		if (!buf)
+			break;
+		msg_read(buf, &ectxt);
+		spin_unlock_irqrestore(&buf->lock_lhb2, flags);
+
+		spin_lock_irqsave(&ilctxt->context_lock_lhb1, flags);
 		deserialize_func = get_deserialization_func(ilctxt,
 							ectxt.hdr.type);
-		spin_unlock(&ilctxt->context_lock_lhb1);
-		read_unlock_irqrestore(&context_list_lock_lha1, flags);
+		spin_unlock_irqrestore(&ilctxt->context_lock_lhb1, flags);
 		if (deserialize_func)
 			deserialize_func(&ectxt, &dctxt);
 		else
 			pr_err("%s: unknown message 0x%x\n",
 				__func__, ectxt.hdr.type);
-		read_lock_irqsave(&context_list_lock_lha1, flags);
-		spin_lock(&ilctxt->context_lock_lhb1);
 	}
-	if ((size - dctxt.size) == 0)
-		reinit_completion(&ilctxt->read_avail);
-	spin_unlock(&ilctxt->context_lock_lhb1);
-	read_unlock_irqrestore(&context_list_lock_lha1, flags);
 	return size - dctxt.size;
 }
 EXPORT_SYMBOL(ipc_log_extract);
@@ -726,13 +848,11 @@ int add_deserialization_func(void *ctxt, int type,
 	if (!df_info)
 		return -ENOSPC;
 
-	read_lock_irqsave(&context_list_lock_lha1, flags);
-	spin_lock(&ilctxt->context_lock_lhb1);
+	spin_lock_irqsave(&ilctxt->context_lock_lhb1, flags);
 	df_info->type = type;
 	df_info->dfunc = dfunc;
 	list_add_tail(&df_info->list, &ilctxt->dfunc_info_list);
-	spin_unlock(&ilctxt->context_lock_lhb1);
-	read_unlock_irqrestore(&context_list_lock_lha1, flags);
+	spin_unlock_irqrestore(&ilctxt->context_lock_lhb1, flags);
 	return 0;
 }
 EXPORT_SYMBOL(add_deserialization_func);
@@ -752,6 +872,79 @@ static void *get_deserialization_func(struct ipc_log_context *ilctxt,
 	return NULL;
 }
 
+/*
+ * Free the pages of all the per-CPU sub-buffers of a context
+ */
+static void ipc_log_free_pages(struct ipc_log_context *ilctxt)
+{
+	struct ipc_log_cpu_buf *buf;
+	struct ipc_log_page *pg;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		buf = per_cpu_ptr(ilctxt->cpu_buf, cpu);
+
+		while (!list_empty(&buf->page_list)) {
+			pg = get_first_page(buf);
+			list_del(&pg->hdr.list);
+			kfree(pg);
+		}
+	}
+}
+
+/*
+ * Allocate the ring of pages of one per-CPU sub-buffer
+ */
+static int ipc_log_init_cpu_buf(struct ipc_log_context *ctxt, int cpu,
+				int num_pages)
+{
+	struct ipc_log_cpu_buf *buf = per_cpu_ptr(ctxt->cpu_buf, cpu);
+	struct ipc_log_page *pg = NULL;
+	int page_cnt;
+
+	spin_lock_init(&buf->lock_lhb2);
+	for (page_cnt = 0; page_cnt < num_pages; page_cnt++) {
+		pg = kzalloc(sizeof(struct ipc_log_page), GFP_KERNEL);
+		if (!pg) {
+			pr_err("%s: cannot create ipc_log_page\n", __func__);
+			return -ENOMEM;
+		}
+		pg->hdr.log_id = (uint64_t)(uintptr_t)ctxt;
+		pg->hdr.page_num = LOG_PAGE_FLAG |
+			(cpu << LOG_PAGE_CPU_SHIFT) | page_cnt;
+		pg->hdr.ctx_offset = (int64_t)((uint64_t)(uintptr_t)ctxt -
+			(uint64_t)(uintptr_t)&pg->hdr);
+
+		/* set magic last to signal that page init is complete */
+		pg->hdr.magic = IPC_LOGGING_MAGIC_NUM;
+		pg->hdr.nmagic = ~(IPC_LOGGING_MAGIC_NUM);
+
+		list_add_tail(&pg->hdr.list, &buf->page_list);
+	}
+
+	buf->first_page = get_first_page(buf);
+	buf->last_page = pg;
+	buf->write_page = buf->first_page;
+	buf->read_page = buf->first_page;
+	buf->nd_read_page = buf->first_page;
+	buf->write_avail = num_pages * LOG_PAGE_DATA_SIZE;
+	return 0;
+}
+
+/*
+ * Account @nr_pages against IPC_LOG_MAX_TOTAL_PAGES, failing if that
+ * would exceed it
+ */
+static bool ipc_log_reserve_pages(int nr_pages)
+{
+	if (atomic_add_return(nr_pages, &ipc_log_total_pages) <=
+	    IPC_LOG_MAX_TOTAL_PAGES)
+		return true;
+
+	atomic_sub(nr_pages, &ipc_log_total_pages);
+	return false;
+}
+
 /**
  * ipc_log_context_create: Create a debug log context
  *                         Should not be called from atomic context
@@ -760,14 +953,23 @@ static void *get_deserialization_func(struct ipc_log_context *ilctxt,
  * @mod_name     : Name of the directory entry under DEBUGFS
  * @user_version : Version number of user-defined message formats
  *
+ * Each CPU logs into its own sub-buffer of @max_num_pages pages, so a
+ * producer that always logs from the same CPU keeps as much history as
+ * with a single shared buffer, at the cost of @max_num_pages pages per
+ * possible CPU.  Once all contexts together would exceed
+ * IPC_LOG_MAX_TOTAL_PAGES, new contexts instead spread @max_num_pages
+ * over the CPUs, one page at least each, and a producer bound to one CPU
+ * then only keeps its share of the history.
+ *
  * returns context id on success, NULL on failure
  */
 void *ipc_log_context_create(int max_num_pages,
 			     const char *mod_name, uint16_t user_version)
 {
 	struct ipc_log_context *ctxt;
-	struct ipc_log_page *pg = NULL;
-	int page_cnt;
+	int ncpus = num_possible_cpus();
+	int num_pages;
+	int cpu;
 	unsigned long flags;
 
 	ctxt = kzalloc(sizeof(struct ipc_log_context), GFP_KERNEL);
@@ -776,40 +978,36 @@ void *ipc_log_context_create(int max_num_pages,
 		return 0;
 	}
 
-	init_completion(&ctxt->read_avail);
-	INIT_LIST_HEAD(&ctxt->page_list);
+	ctxt->cpu_buf = alloc_percpu(struct ipc_log_cpu_buf);
+	if (!ctxt->cpu_buf) {
+		pr_err("%s: cannot create ipc_log_cpu_buf\n", __func__);
+		kfree(ctxt);
+		return 0;
+	}
+
+	init_waitqueue_head(&ctxt->read_avail);
 	INIT_LIST_HEAD(&ctxt->dfunc_info_list);
 	spin_lock_init(&ctxt->context_lock_lhb1);
-	for (page_cnt = 0; page_cnt < max_num_pages; page_cnt++) {
-		pg = kzalloc(sizeof(struct ipc_log_page), GFP_KERNEL);
-		if (!pg) {
-			pr_err("%s: cannot create ipc_log_page\n", __func__);
-			goto release_ipc_log_context;
-		}
-		pg->hdr.log_id = (uint64_t)(uintptr_t)ctxt;
-		pg->hdr.page_num = LOG_PAGE_FLAG | page_cnt;
-		pg->hdr.ctx_offset = (int64_t)((uint64_t)(uintptr_t)ctxt -
-			(uint64_t)(uintptr_t)&pg->hdr);
 
-		/* set magic last to signal that page init is complete */
-		pg->hdr.magic = IPC_LOGGING_MAGIC_NUM;
-		pg->hdr.nmagic = ~(IPC_LOGGING_MAGIC_NUM);
+	num_pages = max_num_pages;
+	if (!ipc_log_reserve_pages(num_pages * ncpus)) {
+		num_pages = max(DIV_ROUND_UP(max_num_pages, ncpus), 1);
+		atomic_add(num_pages * ncpus, &ipc_log_total_pages);
+	}
+	ctxt->nr_pages = num_pages * ncpus;
 
-		spin_lock_irqsave(&ctxt->context_lock_lhb1, flags);
-		list_add_tail(&pg->hdr.list, &ctxt->page_list);
-		spin_unlock_irqrestore(&ctxt->context_lock_lhb1, flags);
+	/* initialize all lists first so that a partial failure can be undone */
+	for_each_possible_cpu(cpu)
+		INIT_LIST_HEAD(&per_cpu_ptr(ctxt->cpu_buf, cpu)->page_list);
+	for_each_possible_cpu(cpu) {
+		if (ipc_log_init_cpu_buf(ctxt, cpu, num_pages))
+			goto release_ipc_log_context;
 	}
 
 	ctxt->log_id = (uint64_t)(uintptr_t)ctxt;
 	ctxt->version = IPC_LOG_VERSION;
 	strlcpy(ctxt->name, mod_name, IPC_LOG_MAX_CONTEXT_NAME_LEN);
 	ctxt->user_version = user_version;
-	ctxt->first_page = get_first_page(ctxt);
-	ctxt->last_page = pg;
-	ctxt->write_page = ctxt->first_page;
-	ctxt->read_page = ctxt->first_page;
-	ctxt->nd_read_page = ctxt->first_page;
-	ctxt->write_avail = max_num_pages * LOG_PAGE_DATA_SIZE;
 	ctxt->header_size = sizeof(struct ipc_log_page_header);
 	create_ctx_debugfs(ctxt, mod_name);
 
@@ -823,11 +1021,9 @@ void *ipc_log_context_create(int max_num_pages,
 	return (void *)ctxt;
 
 release_ipc_log_context:
-	while (page_cnt-- > 0) {
-		pg = get_first_page(ctxt);
-		list_del(&pg->hdr.list);
-		kfree(pg);
-	}
+	ipc_log_free_pages(ctxt);
+	atomic_sub(ctxt->nr_pages, &ipc_log_total_pages);
+	free_percpu(ctxt->cpu_buf);
 	kfree(ctxt);
 	return 0;
 }
@@ -841,24 +1037,21 @@ EXPORT_SYMBOL(ipc_log_context_create);
 int ipc_log_context_destroy(void *ctxt)
 {
 	struct ipc_log_context *ilctxt = (struct ipc_log_context *)ctxt;
-	struct ipc_log_page *pg = NULL;
 	unsigned long flags;
 
 	if (!ilctxt)
 		return 0;
 
-	while (!list_empty(&ilctxt->page_list)) {
-		pg = get_first_page(ctxt);
-		list_del(&pg->hdr.list);
-		kfree(pg);
-	}
-
 	write_lock_irqsave(&context_list_lock_lha1, flags);
 	list_del(&ilctxt->list);
 	write_unlock_irqrestore(&context_list_lock_lha1, flags);
 
 	debugfs_remove_recursive(ilctxt->dent);
 
+	ipc_log_free_pages(ilctxt);
+	atomic_sub(ilctxt->nr_pages, &ipc_log_total_pages);
+	free_percpu(ilctxt->cpu_buf);
+
 	kfree(ilctxt);
 	return 0;
 }
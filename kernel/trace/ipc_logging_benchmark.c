@@ -0,0 +1,157 @@
+/*
+ * ipc_logging throughput benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Modelled after ring_buffer_benchmark.c: one writer thread is bound to
+ * each online CPU, and all of them log into the same context for RUN_TIME
+ * seconds, then report their throughput and sleep for SLEEP_TIME seconds.
+ */
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/ipc_logging.h>
+
+/* run time and sleep time in seconds */
+#define RUN_TIME	10
+#define SLEEP_TIME	10
+
+static int nr_pages = 10;
+module_param(nr_pages, int, 0444);
+MODULE_PARM_DESC(nr_pages, "# of log pages of the benchmark context");
+
+static int writer_fifo = -1;
+module_param(writer_fifo, int, 0444);
+MODULE_PARM_DESC(writer_fifo, "fifo prio for the writers");
+
+static void *ipc_log_ctxt;
+static struct task_struct **writers;
+static int nr_writers;
+
+static void ipc_log_bench_run(int cpu)
+{
+	unsigned long writes = 0;
+	ktime_t start, end;
+	s64 ns;
+
+	start = ktime_get();
+	end = ktime_add_ns(start, (u64)RUN_TIME * NSEC_PER_SEC);
+
+	for (;;) {
+		ipc_log_string(ipc_log_ctxt, "cpu %d write %lu", cpu, writes);
+		writes++;
+
+		/* check the time and give others a chance every 1000 writes */
+		if (!(writes % 1000)) {
+			if (kthread_should_stop() ||
+			    !ktime_before(ktime_get(), end))
+				break;
+			cond_resched();
+		}
+	}
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	pr_info("ipc_logging_benchmark: cpu %d: %lu writes in %lld ms, %lld ns/write\n",
+		cpu, writes, ns / NSEC_PER_MSEC,
+		writes ? div64_s64(ns, writes) : 0);
+}
+
+static int ipc_log_bench_thread(void *arg)
+{
+	int cpu = (long)arg;
+
+	while (!kthread_should_stop()) {
+		ipc_log_bench_run(cpu);
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule_timeout(HZ * SLEEP_TIME);
+		__set_current_state(TASK_RUNNING);
+	}
+
+	return 0;
+}
+
+static void ipc_log_bench_stop(void)
+{
+	int i;
+
+	for (i = 0; i < nr_writers; i++)
+		kthread_stop(writers[i]);
+	nr_writers = 0;
+}
+
+static int __init ipc_logging_benchmark_init(void)
+{
+	struct task_struct *writer;
+	int cpu, i;
+	int ret;
+
+	ipc_log_ctxt = ipc_log_context_create(nr_pages,
+					      "ipc_logging_benchmark", 0);
+	if (!ipc_log_ctxt)
+		return -ENOMEM;
+
+	writers = kcalloc(nr_cpu_ids, sizeof(*writers), GFP_KERNEL);
+	if (!writers) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		writer = kthread_create(ipc_log_bench_thread, (void *)(long)cpu,
+					"ipc_log_bench/%d", cpu);
+		if (IS_ERR(writer)) {
+			put_online_cpus();
+			ret = PTR_ERR(writer);
+			goto out_stop;
+		}
+
+		kthread_bind(writer, cpu);
+		if (writer_fifo >= 0) {
+			struct sched_param param = {
+				.sched_priority = writer_fifo
+			};
+			sched_setscheduler(writer, SCHED_FIFO, &param);
+		}
+
+		writers[nr_writers++] = writer;
+	}
+	put_online_cpus();
+
+	for (i = 0; i < nr_writers; i++)
+		wake_up_process(writers[i]);
+
+	return 0;
+
+out_stop:
+	ipc_log_bench_stop();
+	kfree(writers);
+out_free:
+	ipc_log_context_destroy(ipc_log_ctxt);
+	return ret;
+}
+
+static void __exit ipc_logging_benchmark_exit(void)
+{
+	ipc_log_bench_stop();
+	kfree(writers);
+	ipc_log_context_destroy(ipc_log_ctxt);
+}
+
+module_init(ipc_logging_benchmark_init);
+module_exit(ipc_logging_benchmark_exit);
+
+MODULE_DESCRIPTION("ipc_logging_benchmark");
+MODULE_LICENSE("GPL v2");
@@ -25,7 +25,6 @@
 #include <linux/sched.h>
 #include <linux/wait.h>
 #include <linux/delay.h>
-#include <linux/completion.h>
 #include <linux/ipc_logging.h>
 
 #include "ipc_logging_private.h"
@@ -47,8 +46,8 @@ static int debug_log(struct ipc_log_context *ilctxt,
 	do {
 		i = ipc_log_extract(ilctxt, buff, size - 1);
 		if (cont && i == 0) {
-			ret = wait_for_completion_interruptible(
-				&ilctxt->read_avail);
+			ret = wait_event_interruptible(ilctxt->read_avail,
+				!ipc_log_is_nd_read_empty(ilctxt));
 			if (ret < 0)
 				return ret;
 		}
@@ -15,15 +15,23 @@
 
 #include <linux/ipc_logging.h>
 
-#define IPC_LOG_VERSION 0x0003
+#define IPC_LOG_VERSION 0x0004
 #define IPC_LOG_MAX_CONTEXT_NAME_LEN 32
 
+/*
+ * Upper bound on the log pages of all contexts together.  Contexts created
+ * past this bound get their pages spread over the CPUs instead of a full
+ * set per CPU, see ipc_log_context_create().
+ */
+#define IPC_LOG_MAX_TOTAL_PAGES 2048
+
 /**
  * struct ipc_log_page_header - Individual log page header
  *
  * @magic: Magic number (used for log extraction)
  * @nmagic: Inverse of magic number (used for log extraction)
- * @page_num: Index of page (0.. N - 1) (note top bit is always set)
+ * @page_num: Index of page (0.. N - 1) within its per-CPU sub-buffer, with
+ *            the CPU number in bits 16..30 (note top bit is always set)
  * @read_offset:  Read offset in page
  * @write_offset: Write offset in page (or 0xFFFF if full)
  * @log_id: ID of logging context that owns this page
@@ -70,6 +78,33 @@ struct ipc_log_page {
 	char data[PAGE_SIZE - sizeof(struct ipc_log_page_header)];
 };
 
+/**
+ * struct ipc_log_cpu_buf - per-CPU sub-buffer of a logging context
+ *
+ * @page_list:  List of log pages (struct ipc_log_page)
+ * @first_page:  First page in list of logging pages
+ * @last_page:  Last page in list of logging pages
+ * @write_page:  Current write page
+ * @read_page:  Current read page (for internal reads)
+ * @nd_read_page:  Current debugfs extraction page (non-destructive)
+ * @write_avail:  Number of bytes available to write in all pages
+ * @lock_lhb2:  Lock for the sub-buffer.  Writers only ever take the lock of
+ *              the CPU they run on, so it is only contended by readers.
+ *
+ * Every CPU logs into its own ring of pages, and messages are merged back
+ * into timestamp order when the log is read.
+ */
+struct ipc_log_cpu_buf {
+	struct list_head page_list;
+	struct ipc_log_page *first_page;
+	struct ipc_log_page *last_page;
+	struct ipc_log_page *write_page;
+	struct ipc_log_page *read_page;
+	struct ipc_log_page *nd_read_page;
+	uint32_t write_avail;
+	spinlock_t lock_lhb2;
+};
+
 /**
  * struct ipc_log_context - main logging context
  *
@@ -83,18 +118,14 @@ struct ipc_log_page {
  * @name:  Name of the log used to uniquely identify the log during extraction
  *
  * @list:  List of log contexts (struct ipc_log_context)
- * @page_list:  List of log pages (struct ipc_log_page)
- * @first_page:  First page in list of logging pages
- * @last_page:  Last page in list of logging pages
- * @write_page:  Current write page
- * @read_page:  Current read page (for internal reads)
- * @nd_read_page:  Current debugfs extraction page (non-destructive)
+ * @cpu_buf:  Per-CPU sub-buffers holding the log pages
+ * @nr_pages:  Pages of all sub-buffers, counted against
+ *             IPC_LOG_MAX_TOTAL_PAGES
  *
- * @write_avail:  Number of bytes available to write in all pages
  * @dent:  Debugfs node for run-time log extraction
  * @dfunc_info_list:  List of deserialization functions
- * @context_lock_lhb1:  Lock for entire structure
- * @read_avail:  Completed when new data is added to the log
+ * @context_lock_lhb1:  Lock for the list of deserialization functions
+ * @read_avail:  Woken up when new data is added to the log
  */
 struct ipc_log_context {
 	uint32_t magic;
@@ -107,18 +138,13 @@ struct ipc_log_context {
 
 	/* add local data structures after this point */
 	struct list_head list;
-	struct list_head page_list;
-	struct ipc_log_page *first_page;
-	struct ipc_log_page *last_page;
-	struct ipc_log_page *write_page;
-	struct ipc_log_page *read_page;
-	struct ipc_log_page *nd_read_page;
+	struct ipc_log_cpu_buf __percpu *cpu_buf;
+	int nr_pages;
 
-	uint32_t write_avail;
 	struct dentry *dent;
 	struct list_head dfunc_info_list;
 	spinlock_t context_lock_lhb1;
-	struct completion read_avail;
+	wait_queue_head_t read_avail;
 };
 
 struct dfunc_info {
@@ -147,6 +173,8 @@ enum {
 			((x) < TSV_TYPE_MSG_END))
 #define MAX_MSG_DECODED_SIZE (MAX_MSG_SIZE*4)
 
+bool ipc_log_is_nd_read_empty(struct ipc_log_context *ilctxt);
+
 #if (defined(CONFIG_DEBUG_FS))
 void check_and_create_debugfs(void);
 
@@ -0,0 +1,145 @@
+/*
+ * blk-mq tag allocation benchmark
+ *
+ * Binds one reader thread to each of the first N online CPUs and has
+ * them all issue 4k O_DIRECT reads to a null_blk device for RUN_TIME
+ * seconds.  With null_blk in blk-mq mode and completions done inline
+ * (queue_mode=2 irqmode=0) every read is little more than a tag
+ * allocation and free, so the reads per second measure the throughput
+ * of the tag allocator.  It is reported for N = 1, 2, 4, ... up to the
+ * number of online CPUs, to show how it scales with CPU count.
+ *
+ * Usage: blk_tag_bench <null_blk device>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ */
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUN_TIME	5
+#define BLOCK_SIZE	4096
+#define NR_BLOCKS	1024
+
+static const char *dev;
+static volatile int stop;
+
+struct reader {
+	pthread_t thread;
+	int cpu;
+	unsigned long reads;
+};
+
+static void *reader_fn(void *arg)
+{
+	struct reader *r = arg;
+	cpu_set_t mask;
+	void *buf;
+	int fd;
+
+	CPU_ZERO(&mask);
+	CPU_SET(r->cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask)) {
+		printf("cannot bind to cpu %d: %m\n", r->cpu);
+		exit(1);
+	}
+
+	fd = open(dev, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		printf("open %s failed: %m\n", dev);
+		exit(1);
+	}
+	if (posix_memalign(&buf, BLOCK_SIZE, BLOCK_SIZE)) {
+		printf("cannot allocate the read buffer\n");
+		exit(1);
+	}
+
+	while (!stop) {
+		if (pread(fd, buf, BLOCK_SIZE,
+			  (off_t)(r->reads % NR_BLOCKS) * BLOCK_SIZE) !=
+		    BLOCK_SIZE) {
+			printf("read from %s failed: %m\n", dev);
+			exit(1);
+		}
+		r->reads++;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static void run(int *cpus, int nr)
+{
+	struct reader *readers;
+	unsigned long total = 0;
+	int i;
+
+	readers = calloc(nr, sizeof(*readers));
+	if (!readers)
+		exit(1);
+
+	stop = 0;
+	for (i = 0; i < nr; i++) {
+		readers[i].cpu = cpus[i];
+		if (pthread_create(&readers[i].thread, NULL, reader_fn,
+				   &readers[i])) {
+			printf("cannot create reader thread\n");
+			exit(1);
+		}
+	}
+
+	sleep(RUN_TIME);
+	stop = 1;
+
+	for (i = 0; i < nr; i++) {
+		pthread_join(readers[i].thread, NULL);
+		total += readers[i].reads;
+	}
+
+	printf("blk_tag_bench: %3d cpus: %lu allocs/s, %lu allocs/s per cpu\n",
+	       nr, total / RUN_TIME, total / RUN_TIME / nr);
+	free(readers);
+}
+
+int main(int argc, char **argv)
+{
+	cpu_set_t online;
+	int *cpus;
+	int nr_cpus = 0;
+	int cpu, n;
+
+	if (argc != 2) {
+		printf("usage: %s <null_blk device>\n", argv[0]);
+		return 1;
+	}
+	dev = argv[1];
+
+	if (sched_getaffinity(0, sizeof(online), &online)) {
+		printf("sched_getaffinity failed: %m\n");
+		return 1;
+	}
+
+	cpus = calloc(CPU_SETSIZE, sizeof(*cpus));
+	if (!cpus)
+		return 1;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &online))
+			cpus[nr_cpus++] = cpu;
+
+	for (n = 1; n < nr_cpus; n *= 2)
+		run(cpus, n);
+	run(cpus, nr_cpus);
+
+	free(cpus);
+	return 0;
+}
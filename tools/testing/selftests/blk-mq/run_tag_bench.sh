@@ -0,0 +1,28 @@
+#!/bin/bash
+#
+# Load null_blk in blk-mq mode with inline completions and run
+# blk_tag_bench against it.  A null_blk module that is already loaded is
+# used as it is.
+
+skip()
+{
+	echo "blk_tag_bench: $1, skipping"
+	exit 0
+}
+
+[ "$(id -u)" -eq 0 ] || skip "not root"
+
+LOADED=0
+if [ ! -b /dev/nullb0 ]; then
+	modprobe null_blk queue_mode=2 irqmode=0 nr_devices=1 2>/dev/null ||
+		skip "cannot load null_blk"
+	LOADED=1
+	udevadm settle 2>/dev/null
+fi
+[ -b /dev/nullb0 ] || skip "/dev/nullb0 not found"
+
+./blk_tag_bench /dev/nullb0
+RET=$?
+
+[ $LOADED -eq 1 ] && rmmod null_blk
+exit $RET
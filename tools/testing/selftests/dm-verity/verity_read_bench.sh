@@ -0,0 +1,115 @@
+#!/bin/bash
+#
+# dm-verity cold sequential read benchmark
+#
+# Sets up a verity device over a data image and reads it sequentially
+# with cold caches, the way a system image is read at boot, and reports
+# MB/s for:
+#  - serial verification (parallel_blocks=0),
+#  - parallel verification of large bios (the parallel_blocks default),
+#  - parallel verification with check_hash_at_most_once, read twice, so
+#    that the second read shows the cost once the hash blocks are known
+#    to be good.
+#
+# Usage: verity_read_bench.sh [data image] [size in MB]
+#
+# Without a data image, one of 256 MB (or the given size) filled with
+# random data is created in $TMPDIR.  Needs root, veritysetup, dmsetup
+# and losetup.
+
+SIZE_MB=${2:-256}
+PARAM=/sys/module/dm_verity/parameters/parallel_blocks
+NAME=verity_bench
+
+skip()
+{
+	echo "verity_read_bench: $1, skipping"
+	exit 0
+}
+
+[ "$(id -u)" -eq 0 ] || skip "not root"
+for tool in veritysetup dmsetup losetup dd; do
+	which $tool >/dev/null 2>&1 || skip "$tool not found"
+done
+[ -e $PARAM ] || modprobe dm-verity 2>/dev/null
+[ -e $PARAM ] || skip "dm-verity with parallel_blocks not available"
+
+WORK=$(mktemp -d ${TMPDIR:-/tmp}/verity_bench.XXXXXX) || exit 1
+DATA_LOOP=
+HASH_LOOP=
+OLD_PARAM=$(cat $PARAM)
+
+cleanup()
+{
+	dmsetup remove $NAME 2>/dev/null
+	[ -n "$DATA_LOOP" ] && losetup -d $DATA_LOOP
+	[ -n "$HASH_LOOP" ] && losetup -d $HASH_LOOP
+	echo $OLD_PARAM > $PARAM
+	rm -rf $WORK
+}
+trap cleanup EXIT
+
+if [ -n "$1" ]; then
+	DATA=$1
+else
+	DATA=$WORK/data.img
+	dd if=/dev/urandom of=$DATA bs=1M count=$SIZE_MB 2>/dev/null || exit 1
+fi
+HASH=$WORK/hash.img
+
+FORMAT=$(veritysetup format --data-block-size=4096 --hash-block-size=4096 \
+	 $DATA $HASH) || exit 1
+ROOT=$(echo "$FORMAT" | awk '/^Root hash:/ { print $3 }')
+SALT=$(echo "$FORMAT" | awk '/^Salt:/ { print $2 }')
+
+DATA_LOOP=$(losetup -f --show $DATA) || exit 1
+HASH_LOOP=$(losetup -f --show $HASH) || exit 1
+SECTORS=$(blockdev --getsz $DATA_LOOP)
+BLOCKS=$((SECTORS / 8))
+MB=$((SECTORS / 2048))
+
+# verity_open <optional args...>
+verity_open()
+{
+	local opts=
+
+	[ $# -gt 0 ] && opts="$# $*"
+	dmsetup create $NAME --readonly --table "0 $SECTORS verity 1 \
+$DATA_LOOP $HASH_LOOP 4096 4096 $BLOCKS 1 sha256 $ROOT $SALT $opts" || exit 1
+	dmsetup mknodes $NAME
+}
+
+# cold_read <label>
+cold_read()
+{
+	local start end ms
+
+	sync
+	echo 3 > /proc/sys/vm/drop_caches
+	start=$(date +%s%N)
+	dd if=/dev/mapper/$NAME of=/dev/null bs=1M 2>/dev/null || {
+		echo "verity_read_bench: read failed"
+		exit 1
+	}
+	end=$(date +%s%N)
+	ms=$(((end - start) / 1000000))
+	[ $ms -gt 0 ] || ms=1
+	echo "verity_read_bench: $1: $MB MB in $ms ms, $((MB * 1000 / ms)) MB/s"
+}
+
+echo 0 > $PARAM
+verity_open
+cold_read "serial"
+dmsetup remove $NAME
+
+echo $OLD_PARAM > $PARAM
+verity_open
+cold_read "parallel_blocks=$OLD_PARAM"
+dmsetup remove $NAME
+
+verity_open check_hash_at_most_once
+cold_read "parallel_blocks=$OLD_PARAM, check_hash_at_most_once, first read"
+cold_read "parallel_blocks=$OLD_PARAM, check_hash_at_most_once, second read"
+dmsetup remove $NAME
+
+exit 0
@@ -0,0 +1,157 @@
+/*
+ * Sync fence merge and signal microbenchmark
+ *
+ * Creates N fences spread over NR_TIMELINES sw_sync timelines, merges them
+ * one by one into a single fence the way a compositor merges the release
+ * fences of its layers, and then signals the timelines one step at a time
+ * until the merged fence signals.  The time per merge and per signal is
+ * reported for growing N, so a merge or status update that is not linear
+ * in the number of pts shows up as a growing per-operation cost.
+ *
+ * Needs CONFIG_SW_SYNC_USER for /dev/sw_sync.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ */
+#define _GNU_SOURCE
+#define __EXPORTED_HEADERS__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <linux/sync.h>
+#include <linux/sw_sync.h>
+
+#define NR_TIMELINES	8
+#define NR_ROUNDS	20
+
+static int timelines[NR_TIMELINES];
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int fence_create(int timeline, unsigned int value)
+{
+	struct sw_sync_create_fence_data data = { .value = value };
+
+	strcpy(data.name, "sync_bench");
+	if (ioctl(timeline, SW_SYNC_IOC_CREATE_FENCE, &data) < 0) {
+		printf("SW_SYNC_IOC_CREATE_FENCE failed: %m\n");
+		exit(1);
+	}
+	return data.fence;
+}
+
+static int fence_merge(int fd1, int fd2)
+{
+	struct sync_merge_data data = { .fd2 = fd2 };
+
+	strcpy(data.name, "sync_bench_merged");
+	if (ioctl(fd1, SYNC_IOC_MERGE, &data) < 0) {
+		printf("SYNC_IOC_MERGE failed: %m\n");
+		exit(1);
+	}
+	return data.fence;
+}
+
+static int fence_wait(int fd, int timeout)
+{
+	return ioctl(fd, SYNC_IOC_WAIT, &timeout);
+}
+
+/*
+ * Run one round with @n fences, adding the time spent merging and
+ * signaling to @merge_ns and @signal_ns
+ */
+static void bench_round(int n, unsigned long long *merge_ns,
+			unsigned long long *signal_ns)
+{
+	unsigned int steps = (n + NR_TIMELINES - 1) / NR_TIMELINES;
+	unsigned long long start;
+	int merged, fd, tmp;
+	unsigned int s;
+	int i;
+
+	for (i = 0; i < NR_TIMELINES; i++) {
+		timelines[i] = open("/dev/sw_sync", O_RDWR);
+		if (timelines[i] < 0) {
+			printf("open /dev/sw_sync failed: %m\n");
+			exit(1);
+		}
+	}
+
+	merged = fence_create(timelines[0], 1);
+	start = now_ns();
+	for (i = 1; i < n; i++) {
+		fd = fence_create(timelines[i % NR_TIMELINES],
+				  i / NR_TIMELINES + 1);
+		tmp = fence_merge(merged, fd);
+		close(fd);
+		close(merged);
+		merged = tmp;
+	}
+	*merge_ns += now_ns() - start;
+
+	if (fence_wait(merged, 0) == 0) {
+		printf("merged fence signaled before its timelines\n");
+		exit(1);
+	}
+
+	start = now_ns();
+	for (s = 0; s < steps; s++)
+		for (i = 0; i < NR_TIMELINES; i++) {
+			unsigned int inc = 1;
+
+			ioctl(timelines[i], SW_SYNC_IOC_INC, &inc);
+		}
+	*signal_ns += now_ns() - start;
+
+	if (fence_wait(merged, 0) < 0) {
+		printf("merged fence not signaled: %m\n");
+		exit(1);
+	}
+
+	close(merged);
+	for (i = 0; i < NR_TIMELINES; i++)
+		close(timelines[i]);
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 8, 32, 128, 512 };
+	unsigned long long merge_ns, signal_ns;
+	unsigned int i, r;
+	int n;
+
+	if (access("/dev/sw_sync", R_OK | W_OK)) {
+		printf("sync_bench: /dev/sw_sync not available, skipping\n");
+		return 0;
+	}
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		n = sizes[i];
+		merge_ns = signal_ns = 0;
+		for (r = 0; r < NR_ROUNDS; r++)
+			bench_round(n, &merge_ns, &signal_ns);
+
+		printf("sync_bench: %4d fences: %llu ns/merge, %llu ns/signal\n",
+		       n, merge_ns / (NR_ROUNDS * (n - 1)),
+		       signal_ns / (NR_ROUNDS *
+				    ((n + NR_TIMELINES - 1) / NR_TIMELINES) *
+				    NR_TIMELINES));
+	}
+
+	return 0;
+}